@@ -0,0 +1,508 @@
+// Load generator and benchmark suite for webby.
+//
+// By default an embedded webby::server is started on the loopback interface with a route for
+// each scenario, and every scenario is run against it in turn. Each scenario prints one line of
+// JSON with its throughput and latency percentiles so that the results can be compared between
+// builds by a script.
+//
+//   webby_bench [--scenarios small,file-1k,...] [--connections 32] [--duration 5]
+//               [--warmup 1] [--rate 0] [--engine blocking|epoll] [--server-threads 4]
+//               [--reuse-port 0|1] [--cpus 0,1,...] [--port 18080] [--target host:port]
+//
+// With --rate 0 the load is closed-loop: every connection sends its next request as soon as the
+// previous response has arrived, which measures the maximum throughput. With a positive rate the
+// load is open-loop: requests are scheduled at a fixed total rate, and latency is measured from
+// the time a request was due rather than the time it was sent, so that a stalled server is not
+// hidden by the load generator waiting for it.
+//
+// With --target the embedded server is not started, and the scenarios are run against another
+// server that provides the same paths.
+
+#include <webby.hpp>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+  typedef std::chrono::steady_clock clock_type;
+
+  // Number of routes registered for the "routes" scenario.
+  const int route_count = 1000;
+
+  // Sizes of the files served by the static file scenarios.
+  const struct {
+    const char* name;
+    size_t size;
+  } files[] = {
+    {"file-1k", 1024},
+    {"file-64k", 65536},
+    {"file-1m", 1048576}
+  };
+
+  // Command line options.
+  struct options {
+    std::vector<std::string> scenarios = {
+      "small", "small-close", "routes", "file-1k", "file-64k", "file-1m"
+    };
+    unsigned connections = 32;
+    double duration = 5.0;
+    double warmup = 1.0;
+    double rate = 0.0;
+    webby::engine engine = webby::engine::BLOCKING;
+    unsigned server_threads = 0;
+    bool reuse_port = false;
+    std::vector<unsigned> cpus;
+    std::string host = "127.0.0.1";
+    unsigned short port = 18080;
+    bool embedded = true;
+  };
+
+  // Results gathered by a single connection.
+  struct results {
+    std::vector<uint32_t> latencies;
+    unsigned long long bytes = 0;
+    unsigned long errors = 0;
+  };
+
+  void usage() {
+    fprintf(stderr,
+            "usage: webby_bench [--scenarios a,b,...] [--connections N] [--duration S]\n"
+            "                   [--warmup S] [--rate R] [--engine blocking|epoll]\n"
+            "                   [--server-threads N] [--reuse-port 0|1] [--cpus 0,1,...]\n"
+            "                   [--port P] [--target host:port]\n"
+            "scenarios: small small-close routes file-1k file-64k file-1m\n");
+    exit(2);
+  }
+
+  std::vector<std::string> split(const std::string& s, const char separator) {
+    std::vector<std::string> parts;
+    std::istringstream in(s);
+    std::string part;
+    while(std::getline(in, part, separator)) {
+      if(!part.empty()) {
+        parts.push_back(part);
+      }
+    }
+    return parts;
+  }
+
+  options parse_options(int argc, char** argv) {
+    options opts;
+    for(int i = 1; i < argc; ++i) {
+      std::string arg = argv[i];
+      if(i + 1 >= argc) {
+        usage();
+      }
+      std::string value = argv[++i];
+      if(arg == "--scenarios") {
+        opts.scenarios = split(value, ',');
+      }
+      else if(arg == "--connections") {
+        opts.connections = static_cast<unsigned>(std::max(1, atoi(value.c_str())));
+      }
+      else if(arg == "--duration") {
+        opts.duration = atof(value.c_str());
+      }
+      else if(arg == "--warmup") {
+        opts.warmup = atof(value.c_str());
+      }
+      else if(arg == "--rate") {
+        opts.rate = atof(value.c_str());
+      }
+      else if(arg == "--engine") {
+        if(value == "epoll") {
+          opts.engine = webby::engine::EPOLL;
+        }
+        else if(value != "blocking") {
+          usage();
+        }
+      }
+      else if(arg == "--server-threads") {
+        opts.server_threads = static_cast<unsigned>(atoi(value.c_str()));
+      }
+      else if(arg == "--reuse-port") {
+        opts.reuse_port = value != "0";
+      }
+      else if(arg == "--cpus") {
+        for(auto& cpu : split(value, ',')) {
+          opts.cpus.push_back(static_cast<unsigned>(atoi(cpu.c_str())));
+        }
+      }
+      else if(arg == "--port") {
+        opts.port = static_cast<unsigned short>(atoi(value.c_str()));
+      }
+      else if(arg == "--target") {
+        size_t colon = value.rfind(':');
+        if(colon == std::string::npos) {
+          usage();
+        }
+        opts.host = value.substr(0, colon);
+        opts.port = static_cast<unsigned short>(atoi(value.c_str() + colon + 1));
+        opts.embedded = false;
+      }
+      else {
+        usage();
+      }
+    }
+    return opts;
+  }
+
+  // Gets the path of the next request of a scenario.
+  std::string next_path(const std::string& scenario, std::mt19937& random) {
+    if(scenario == "routes") {
+      std::uniform_int_distribution<int> route(0, route_count - 1);
+      return "/api/v1/resource" + std::to_string(route(random)) + "/items/" +
+             std::to_string(route(random));
+    }
+    if(scenario.compare(0, 5, "file-") == 0) {
+      return "/" + scenario + ".bin";
+    }
+    return "/small";
+  }
+
+  // Opens a connection to the server, or returns -1.
+  int connect_to(const options& opts) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addresses = nullptr;
+    if(getaddrinfo(opts.host.c_str(), std::to_string(opts.port).c_str(), &hints,
+                   &addresses) != 0) {
+      return -1;
+    }
+    int fd = -1;
+    for(struct addrinfo* a = addresses; a != nullptr && fd < 0; a = a->ai_next) {
+      fd = ::socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+      if(fd >= 0 && ::connect(fd, a->ai_addr, a->ai_addrlen) < 0) {
+        ::close(fd);
+        fd = -1;
+      }
+    }
+    freeaddrinfo(addresses);
+    if(fd >= 0) {
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+  }
+
+  // Sends a whole buffer.
+  bool send_all(const int fd, const std::string& data) {
+    size_t sent = 0;
+    while(sent < data.length()) {
+      ssize_t count = ::send(fd, data.data() + sent, data.length() - sent, MSG_NOSIGNAL);
+      if(count <= 0) {
+        return false;
+      }
+      sent += static_cast<size_t>(count);
+    }
+    return true;
+  }
+
+  // Reads one response. Returns the number of body bytes, or -1 on error. Sets `open` to false
+  // if the server is closing the connection.
+  long read_response(const int fd, std::string& buffer, bool& open) {
+    char data[65536];
+    size_t end;
+    while((end = buffer.find("\r\n\r\n")) == std::string::npos) {
+      ssize_t count = ::recv(fd, data, sizeof(data), 0);
+      if(count <= 0) {
+        return -1;
+      }
+      buffer.append(data, static_cast<size_t>(count));
+    }
+    if(buffer.compare(0, 9, "HTTP/1.1 ") != 0 || buffer.compare(9, 1, "2") != 0) {
+      return -1;
+    }
+
+    // Finds the framing of the body.
+    long content_length = -1;
+    bool chunked = false;
+    open = true;
+    size_t pos = buffer.find("\r\n") + 2;
+    while(pos < end + 2) {
+      size_t eol = buffer.find("\r\n", pos);
+      size_t colon = buffer.find(':', pos);
+      if(colon < eol) {
+        size_t start = buffer.find_first_not_of(" \t", colon + 1);
+        const webby::slice name(buffer.data() + pos, colon - pos);
+        const webby::slice value(buffer.data() + start, start < eol ? eol - start : 0);
+        if(name.equals_nocase("Content-Length")) {
+          content_length = atol(value.str().c_str());
+        }
+        else if(name.equals_nocase("Transfer-Encoding")) {
+          chunked = value.equals_nocase("chunked");
+        }
+        else if(name.equals_nocase("Connection")) {
+          open = !value.equals_nocase("close");
+        }
+      }
+      pos = eol + 2;
+    }
+    buffer.erase(0, end + 4);
+
+    long length = 0;
+    if(chunked) {
+      webby::chunked_decoder decoder(0);
+      while(true) {
+        size_t used = 0;
+        length += static_cast<long>(decoder.decode(buffer.data(), buffer.length(), used, nullptr,
+                                                   static_cast<size_t>(-1)));
+        buffer.erase(0, used);
+        if(decoder.done()) {
+          return length;
+        }
+        ssize_t count = ::recv(fd, data, sizeof(data), 0);
+        if(count <= 0) {
+          return -1;
+        }
+        buffer.append(data, static_cast<size_t>(count));
+      }
+    }
+    if(content_length < 0) {
+      // The body ends when the connection is closed.
+      open = false;
+      ssize_t count;
+      while((count = ::recv(fd, data, sizeof(data), 0)) > 0) {
+        buffer.append(data, static_cast<size_t>(count));
+      }
+      length = static_cast<long>(buffer.length());
+      buffer.clear();
+      return length;
+    }
+    while(buffer.length() < static_cast<size_t>(content_length)) {
+      ssize_t count = ::recv(fd, data, sizeof(data), 0);
+      if(count <= 0) {
+        return -1;
+      }
+      buffer.append(data, static_cast<size_t>(count));
+    }
+    buffer.erase(0, static_cast<size_t>(content_length));
+    return content_length;
+  }
+
+  // Drives one connection until `stop` is set. Requests that complete before `measure` is set
+  // warm the server up and are not recorded.
+  void run_connection(const options& opts, const std::string& scenario, const unsigned index,
+                      const std::atomic<bool>& measure, const std::atomic<bool>& stop,
+                      results& out) {
+    const bool keep_alive = scenario != "small-close";
+    std::mt19937 random(index);
+    std::string buffer;
+    int fd = -1;
+
+    // In open-loop mode each connection sends its share of the total rate at fixed intervals.
+    const bool open_loop = opts.rate > 0;
+    const auto interval = std::chrono::duration_cast<clock_type::duration>(
+        std::chrono::duration<double>(open_loop ? opts.connections / opts.rate : 0));
+    auto due = clock_type::now() + interval * index / opts.connections;
+
+    while(!stop) {
+      if(open_loop) {
+        std::this_thread::sleep_until(due);
+      }
+      const auto start = open_loop ? due : clock_type::now();
+      due += interval;
+
+      if(fd < 0) {
+        buffer.clear();
+        fd = connect_to(opts);
+        if(fd < 0) {
+          ++out.errors;
+          std::this_thread::sleep_for(std::chrono::milliseconds(10));
+          continue;
+        }
+      }
+      std::string request = "GET " + next_path(scenario, random) + " HTTP/1.1\r\n"
+                            "Host: " + opts.host + "\r\n" +
+                            (keep_alive ? "" : "Connection: close\r\n") + "\r\n";
+      bool open = false;
+      long length = send_all(fd, request) ? read_response(fd, buffer, open) : -1;
+      if(length < 0 || !open) {
+        ::close(fd);
+        fd = -1;
+      }
+      if(!measure) {
+        continue;
+      }
+      if(length < 0) {
+        ++out.errors;
+        continue;
+      }
+      out.bytes += static_cast<unsigned long long>(length);
+      out.latencies.push_back(static_cast<uint32_t>(
+          std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now() - start)
+              .count()));
+    }
+    if(fd >= 0) {
+      ::close(fd);
+    }
+  }
+
+  // Gets a percentile of sorted latencies.
+  uint32_t percentile(const std::vector<uint32_t>& sorted, const double p) {
+    if(sorted.empty()) {
+      return 0;
+    }
+    size_t index = static_cast<size_t>(p * static_cast<double>(sorted.size() - 1) + 0.5);
+    return sorted[index];
+  }
+
+  // Runs a scenario and prints its results as a line of JSON.
+  void run_scenario(const options& opts, const std::string& scenario) {
+    std::atomic<bool> measure(false);
+    std::atomic<bool> stop(false);
+    std::vector<results> per_connection(opts.connections);
+    std::vector<std::thread> threads;
+    for(unsigned i = 0; i < opts.connections; ++i) {
+      threads.emplace_back(run_connection, std::cref(opts), std::cref(scenario), i,
+                           std::cref(measure), std::cref(stop), std::ref(per_connection[i]));
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(opts.warmup));
+    const auto start = clock_type::now();
+    measure = true;
+    std::this_thread::sleep_for(std::chrono::duration<double>(opts.duration));
+    measure = false;
+    const double elapsed = std::chrono::duration<double>(clock_type::now() - start).count();
+    stop = true;
+    for(auto& thread : threads) {
+      thread.join();
+    }
+
+    std::vector<uint32_t> latencies;
+    unsigned long long bytes = 0;
+    unsigned long errors = 0;
+    for(auto& r : per_connection) {
+      latencies.insert(latencies.end(), r.latencies.begin(), r.latencies.end());
+      bytes += r.bytes;
+      errors += r.errors;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    printf("{\"scenario\":\"%s\",\"mode\":\"%s\",\"engine\":\"%s\",\"connections\":%u,"
+           "\"rate\":%.0f,\"duration_s\":%.3f,\"requests\":%zu,\"errors\":%lu,"
+           "\"requests_per_s\":%.1f,\"bytes_per_s\":%.0f,\"p50_us\":%u,\"p99_us\":%u,"
+           "\"p999_us\":%u,\"max_us\":%u}\n",
+           scenario.c_str(), opts.rate > 0 ? "open" : "closed",
+           !opts.embedded ? "external" : opts.engine == webby::engine::EPOLL ? "epoll" : "blocking",
+           opts.connections, opts.rate, elapsed, latencies.size(), errors,
+           static_cast<double>(latencies.size()) / elapsed, static_cast<double>(bytes) / elapsed,
+           percentile(latencies, 0.5), percentile(latencies, 0.99), percentile(latencies, 0.999),
+           latencies.empty() ? 0 : latencies.back());
+    fflush(stdout);
+  }
+
+  // Writes the files served by the static file scenarios.
+  std::string create_files() {
+    char root[] = "/tmp/webby_bench.XXXXXX";
+    if(mkdtemp(root) == nullptr) {
+      perror("mkdtemp");
+      exit(1);
+    }
+    for(auto& file : files) {
+      std::ofstream out(std::string(root) + "/" + file.name + ".bin", std::ios::binary);
+      std::string block(file.size, 'x');
+      out.write(block.data(), static_cast<std::streamsize>(block.size()));
+    }
+    return root;
+  }
+
+  void remove_files(const std::string& root) {
+    for(auto& file : files) {
+      unlink((root + "/" + file.name + ".bin").c_str());
+    }
+    rmdir(root.c_str());
+  }
+}
+
+int main(int argc, char** argv) {
+  const options opts = parse_options(argc, argv);
+
+  std::string root;
+  std::unique_ptr<qlog::logger> error_log(new qlog::logger(std::cerr, qlog::severity::ERROR));
+  webby::config config;
+  webby::router router;
+  std::unique_ptr<webby::server> server;
+  std::thread server_thread;
+  if(opts.embedded) {
+    root = create_files();
+
+    // The blocking engine occupies a worker for as long as a connection stays open, so by
+    // default it gets one worker per client connection.
+    unsigned server_threads = opts.server_threads;
+    if(server_threads == 0) {
+      server_threads = opts.engine == webby::engine::EPOLL ?
+                       std::max(1u, std::thread::hardware_concurrency()) : opts.connections;
+    }
+
+    config.set_address(opts.host)
+          .set_port(opts.port)
+          .set_engine(opts.engine)
+          .set_worker_threads(server_threads)
+          .set_reuse_port(opts.reuse_port)
+          .set_cpu_affinity(opts.cpus)
+          .set_max_requests_per_connection(0)
+          .set_error_log(error_log)
+          .set_log_level(webby::log_level::ERROR);
+
+    router.add("/small", webby::method::GET, [](const webby::request&, webby::response& res) {
+      static const char body[] = "{\"ok\":true}\n";
+      res.set_header("Content-Type", "application/json")
+         .set_header("Content-Length", std::to_string(sizeof(body) - 1))
+         .write_block(reinterpret_cast<const unsigned char*>(body), sizeof(body) - 1);
+    });
+    for(int i = 0; i < route_count; ++i) {
+      router.add("/api/v1/resource" + std::to_string(i) + "/items/:id", webby::method::GET,
+                 [](const webby::request& req, webby::response& res) {
+        const webby::slice id = req.param("id");
+        res.set_header("Content-Length", std::to_string(id.length()))
+           .write_block(reinterpret_cast<const unsigned char*>(id.data()), id.length());
+      });
+    }
+    router.add("/", webby::method::GET, webby::file_handler(root));
+
+    server.reset(new webby::server(config, router));
+    server_thread = std::thread([&server] { server->run(); });
+
+    // Waits for the server to accept connections.
+    for(int i = 0; i < 100; ++i) {
+      int fd = connect_to(opts);
+      if(fd >= 0) {
+        ::close(fd);
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+  }
+
+  for(auto& scenario : opts.scenarios) {
+    run_scenario(opts, scenario);
+  }
+
+  if(opts.embedded) {
+    server->stop();
+    server_thread.join();
+    remove_files(root);
+  }
+  return 0;
+}
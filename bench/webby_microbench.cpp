@@ -0,0 +1,266 @@
+// Microbenchmarks for the hot paths of a request.
+//
+// The request parser, router and response serialization are driven through a
+// webby::memory_connection, so the results are not disturbed by sockets or the kernel.
+//
+//   webby_microbench [--benchmarks parse,route,serialize] [--headers 12] [--routes 100]
+//                    [--path-length 32] [--iterations 200000]
+//
+//   parse      Parses a request with the given number of headers and path length, constructs
+//              a webby::request and looks up a header.
+//   route      Dispatches a request through a table of the given number of routes, each of
+//              which captures a parameter.
+//   serialize  Constructs a webby::response with the given number of headers and sends its
+//              status line and headers.
+//
+// Each benchmark prints one line of JSON with the time per operation.
+
+#include <webby.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+  typedef std::chrono::steady_clock clock_type;
+
+  // Command line options.
+  struct options {
+    std::vector<std::string> benchmarks = {"parse", "route", "serialize"};
+    unsigned headers = 12;
+    unsigned routes = 100;
+    unsigned path_length = 32;
+    unsigned long iterations = 200000;
+  };
+
+  // Number of dispatches made with each parsed request by the route benchmark.
+  const unsigned long route_batch = 1000;
+
+  // Keeps the compiler from discarding the results of the benchmarks.
+  volatile size_t sink;
+
+  void usage() {
+    fprintf(stderr,
+            "usage: webby_microbench [--benchmarks a,b,...] [--headers N] [--routes N]\n"
+            "                        [--path-length N] [--iterations N]\n"
+            "benchmarks: parse route serialize\n");
+    exit(2);
+  }
+
+  std::vector<std::string> split(const std::string& s, const char separator) {
+    std::vector<std::string> parts;
+    std::istringstream in(s);
+    std::string part;
+    while(std::getline(in, part, separator)) {
+      if(!part.empty()) {
+        parts.push_back(part);
+      }
+    }
+    return parts;
+  }
+
+  options parse_options(int argc, char** argv) {
+    options opts;
+    for(int i = 1; i < argc; ++i) {
+      std::string arg = argv[i];
+      if(i + 1 >= argc) {
+        usage();
+      }
+      std::string value = argv[++i];
+      if(arg == "--benchmarks") {
+        opts.benchmarks = split(value, ',');
+      }
+      else if(arg == "--headers") {
+        opts.headers = static_cast<unsigned>(atoi(value.c_str()));
+      }
+      else if(arg == "--routes") {
+        opts.routes = static_cast<unsigned>(std::max(1, atoi(value.c_str())));
+      }
+      else if(arg == "--path-length") {
+        opts.path_length = static_cast<unsigned>(atoi(value.c_str()));
+      }
+      else if(arg == "--iterations") {
+        opts.iterations = static_cast<unsigned long>(std::max(1, atoi(value.c_str())));
+      }
+      else {
+        usage();
+      }
+    }
+    return opts;
+  }
+
+  // Gets the headers of the requests and responses. The first few are the ones that browsers
+  // send, and the rest are custom headers.
+  std::vector<std::pair<std::string, std::string>> make_headers(const unsigned count) {
+    static const char* const common[][2] = {
+      {"Host", "localhost:8080"},
+      {"User-Agent", "Mozilla/5.0 (X11; Linux x86_64; rv:120.0) Gecko/20100101 Firefox/120.0"},
+      {"Accept", "text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8"},
+      {"Accept-Language", "en-US,en;q=0.5"},
+      {"Accept-Encoding", "gzip, deflate, br"},
+      {"Connection", "keep-alive"},
+      {"Cookie", "session=0123456789abcdef0123456789abcdef; theme=dark"},
+      {"Referer", "http://localhost:8080/index.html"},
+      {"Cache-Control", "no-cache"}
+    };
+    std::vector<std::pair<std::string, std::string>> headers;
+    for(unsigned i = 0; i < count; ++i) {
+      if(i < sizeof(common) / sizeof(common[0])) {
+        headers.emplace_back(common[i][0], common[i][1]);
+      }
+      else {
+        headers.emplace_back("X-Custom-Header-" + std::to_string(i), "value-" + std::to_string(i));
+      }
+    }
+    return headers;
+  }
+
+  // Gets the literal part of a route, padded so that a request for it has about the given path
+  // length once the parameter has been appended.
+  std::string route_prefix(const unsigned index, const unsigned path_length) {
+    std::string prefix = "/resource" + std::to_string(index) + "/";
+    if(prefix.length() + 6 < path_length) {
+      prefix += std::string(path_length - prefix.length() - 6, 'x') + "/";
+    }
+    return prefix;
+  }
+
+  // Builds a request for a path.
+  std::string make_request(const std::string& path, const unsigned headers) {
+    std::string request = "GET " + path + " HTTP/1.1\r\n";
+    for(auto& header : make_headers(headers)) {
+      request += header.first + ": " + header.second + "\r\n";
+    }
+    return request + "\r\n";
+  }
+
+  // Parses the request that has been fed to a connection.
+  void parse(webby::memory_connection& conn) {
+    while(!conn.parse()) {
+      if(!conn.fill()) {
+        fprintf(stderr, "webby_microbench: incomplete request\n");
+        exit(1);
+      }
+    }
+  }
+
+  void report(const options& opts, const std::string& name, const unsigned long iterations,
+              const clock_type::duration elapsed) {
+    const double ns = static_cast<double>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    printf("{\"benchmark\":\"%s\",\"headers\":%u,\"routes\":%u,\"path_length\":%u,"
+           "\"iterations\":%lu,\"ns_per_op\":%.1f,\"ops_per_s\":%.0f}\n",
+           name.c_str(), opts.headers, opts.routes, opts.path_length, iterations,
+           ns / static_cast<double>(iterations), static_cast<double>(iterations) * 1e9 / ns);
+    fflush(stdout);
+  }
+
+  // Parses requests and constructs a webby::request for each of them.
+  void bench_parse(const options& opts, const webby::config& config) {
+    const std::string raw = make_request(route_prefix(0, opts.path_length) + "12345",
+                                         opts.headers);
+    webby::memory_connection conn(config);
+    const auto start = clock_type::now();
+    for(unsigned long i = 0; i < opts.iterations; ++i) {
+      conn.feed(raw);
+      parse(conn);
+      {
+        webby::request req(config, conn);
+        sink = req.path().length() + (req.has_header(webby::header_id::HOST) ? 1 : 0);
+      }
+      conn.next();
+    }
+    report(opts, "parse", opts.iterations, clock_type::now() - start);
+  }
+
+  // Dispatches requests through a table of routes.
+  void bench_route(const options& opts, const webby::config& config) {
+    webby::router router;
+    for(unsigned i = 0; i < opts.routes; ++i) {
+      router.add(route_prefix(i, opts.path_length) + ":id", webby::method::GET,
+                 [](const webby::request& req, webby::response&) {
+        sink = req.param("id").length();
+      });
+    }
+
+    // Each batch of dispatches uses a request for a different route.
+    std::mt19937 random(1);
+    std::uniform_int_distribution<unsigned> route(0, opts.routes - 1);
+    webby::memory_connection conn(config);
+    clock_type::duration elapsed(0);
+    unsigned long count = 0;
+    while(count < opts.iterations) {
+      conn.feed(make_request(route_prefix(route(random), opts.path_length) + "12345",
+                             opts.headers));
+      parse(conn);
+      {
+        webby::request req(config, conn);
+        webby::response res(config, conn);
+        const unsigned long batch = std::min(route_batch, opts.iterations - count);
+        const auto start = clock_type::now();
+        for(unsigned long i = 0; i < batch; ++i) {
+          router.dispatch(req, res);
+        }
+        elapsed += clock_type::now() - start;
+        count += batch;
+      }
+      conn.clear_output();
+      conn.next();
+    }
+    report(opts, "route", count, elapsed);
+  }
+
+  // Sends the status line and headers of responses.
+  void bench_serialize(const options& opts, const webby::config& config) {
+    const auto headers = make_headers(opts.headers);
+    webby::memory_connection conn(config);
+    size_t length = 0;
+    const auto start = clock_type::now();
+    for(unsigned long i = 0; i < opts.iterations; ++i) {
+      {
+        webby::response res(config, conn);
+        res.set_status_code(200);
+        for(auto& header : headers) {
+          res.set_header(header.first, header.second);
+        }
+      }
+      length += conn.output().length();
+      conn.clear_output();
+      conn.next();
+    }
+    sink = length;
+    report(opts, "serialize", opts.iterations, clock_type::now() - start);
+  }
+}
+
+int main(int argc, char** argv) {
+  const options opts = parse_options(argc, argv);
+
+  std::unique_ptr<qlog::logger> error_log(new qlog::logger(std::cerr, qlog::severity::ERROR));
+  webby::config config;
+  config.set_error_log(error_log)
+        .set_log_level(webby::log_level::ERROR)
+        .set_max_header_count(std::max(100u, opts.headers + 1));
+
+  for(auto& name : opts.benchmarks) {
+    if(name == "parse") {
+      bench_parse(opts, config);
+    }
+    else if(name == "route") {
+      bench_route(opts, config);
+    }
+    else if(name == "serialize") {
+      bench_serialize(opts, config);
+    }
+    else {
+      usage();
+    }
+  }
+  return 0;
+}
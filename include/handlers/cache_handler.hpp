@@ -0,0 +1,388 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <webby/response_cache.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Caches the responses of another handler in memory.
+   *
+   *     router.add("/item", webby::method::GET,
+   *                webby::cache_handler(item(), std::chrono::seconds(30)));
+   *
+   * The status, headers and body that the handler produces for a `GET` request are recorded and
+   * replayed for later requests with the same path, including the query string, and the same
+   * values of the request headers named in @p vary, until the time to live runs out. Replayed
+   * responses carry an `Age` header, and are still compressed for each client if compression is
+   * enabled, since the body is recorded before compression.
+   *
+   * Only one request for a given response runs the handler at a time; the others wait for it and
+   * are answered from the cache. The response is held in memory while the handler produces it,
+   * so the waiting requests are released as soon as it has been recorded rather than once it has
+   * reached a client that may be slow. A request that has waited for @p max_wait runs the
+   * handler itself without caching the result. With `webby::engine::EPOLL` a wait would block
+   * the event loop and every connection on it, so requests never wait there: one that arrives
+   * while the response is being produced runs the handler without caching the result.
+   *
+   * The cache is shared by every copy of the handler, and is split into shards that are locked
+   * separately, each evicting its least recently used responses to stay within its share of
+   * @p max_bytes.
+   *
+   * A response is not cached if:
+   * - its status code is not one that is cacheable by default, such as `200` or `404`;
+   * - it has a `Cache-Control` header with `no-store`, `no-cache` or `private`, or with
+   *   `max-age=0`. Any other `max-age` replaces the time to live;
+   * - it has a `Set-Cookie` header, or a `Vary` header that names a request header other than
+   *   `Accept-Encoding` that is not in @p vary;
+   * - the handler set its own `Content-Encoding` and `Accept-Encoding` is not in @p vary;
+   * - part of its body was sent from a file, or the handler deferred it.
+   *
+   * Requests with other methods, or with an `Authorization` header, are passed straight to the
+   * handler.
+   */
+  class cache_handler {
+    public:
+      /**
+       * @brief Constructs a new cache_handler object.
+       * @param[in] handler Handler whose responses are cached.
+       * @param[in] ttl Time for which a response is served from the cache.
+       * @param[in] max_bytes Maximum total size of the cached responses, in bytes.
+       * @param[in] vary Request headers whose values select between different responses for the
+       *                 same path.
+       * @param[in] shards Number of independently locked parts of the cache.
+       * @param[in] max_wait Longest time a request waits for another one that is running the
+       *                     handler for the same response.
+       */
+      cache_handler(router::handler_t handler,
+                    const std::chrono::milliseconds ttl = std::chrono::milliseconds(10000),
+                    const unsigned long max_bytes = 64ul * 1024 * 1024,
+                    const std::vector<std::string>& vary = std::vector<std::string>(),
+                    const std::size_t shards = 16,
+                    const std::chrono::milliseconds max_wait = std::chrono::milliseconds(500))
+          : _handler(std::move(handler)), _ttl(ttl), _max_wait(max_wait), _vary(vary),
+            _cache(std::make_shared<response_cache>(max_bytes, shards)) { }
+
+      /**
+       * @brief Invoked by the router.
+       * @param[in] req Request that triggered the use of this handler.
+       * @param[out] res Response sent to the connected host.
+       */
+      void operator()(const webby::request& req, webby::response& res) {
+        if(req.method() != webby::method::GET || req.has_header(header_id::AUTHORIZATION)) {
+          _handler(req, res);
+          return;
+        }
+
+        const std::string key = make_key(req);
+        const auto now = std::chrono::steady_clock::now();
+        bool produce;
+        const std::chrono::milliseconds max_wait =
+            res._config.engine() == webby::engine::EPOLL ? std::chrono::milliseconds(0) :
+                                                           _max_wait;
+        std::shared_ptr<const cached_response> cached = _cache->acquire(key, now, max_wait,
+                                                                        produce);
+        if(cached) {
+          replay(*cached, res, now);
+          return;
+        }
+        if(!produce) {
+          _handler(req, res);
+          return;
+        }
+
+        // The waiting requests are released even if the handler throws.
+        struct fill_guard {
+          ~fill_guard() {
+            fill();
+          }
+          void fill() {
+            if(!filled) {
+              filled = true;
+              cache.fill(key, std::move(response));
+            }
+          }
+          response_cache& cache;
+          const std::string& key;
+          std::shared_ptr<const cached_response> response;
+          bool filled;
+        } guard{*_cache, key, nullptr, false};
+
+        // Headers that were set before the handler ran, such as the server's defaults, belong to
+        // this request rather than to the response.
+        std::vector<std::pair<std::string, std::string>> defaults;
+        for(auto& header : res._header) {
+          defaults.emplace_back(std::string(header.name.data(), header.name.length()),
+                                std::string(header.value.data(), header.value.length()));
+        }
+
+        std::string body;
+        res._capture = &body;
+        res._hold = true;
+        try {
+          _handler(req, res);
+        }
+        catch(...) {
+          res._capture = nullptr;
+          res._hold = false;
+          throw;
+        }
+        const bool complete = res._capture == &body && !res._deferred;
+        res._capture = nullptr;
+        if(complete) {
+          guard.response = record(res, defaults, std::move(body), now);
+        }
+        guard.fill();
+
+        // The held output is sent once the response is finished.
+        res._hold = false;
+      }
+
+    private:
+      /**
+       * @brief Builds the key of the response to a request.
+       */
+      std::string make_key(const webby::request& req) const {
+        const slice path = req.path();
+        std::string key("GET ", 4);
+        key.append(path.data(), path.length());
+        for(auto& name : _vary) {
+          key.append("\n", 1);
+          if(req.has_header(name)) {
+            const slice value = req.header(name);
+            key.append(value.data(), value.length());
+          }
+        }
+        return key;
+      }
+
+      /**
+       * @brief Records the response that the handler produced.
+       * @param[in] res The response.
+       * @param[in] defaults Headers that were set before the handler ran.
+       * @param[in] body The uncompressed body.
+       * @param[in] now Time the request arrived.
+       * @returns The recorded response, or `nullptr` if it cannot be cached.
+       */
+      std::shared_ptr<const cached_response> record(
+          const webby::response& res,
+          const std::vector<std::pair<std::string, std::string>>& defaults, std::string body,
+          const std::chrono::steady_clock::time_point now) const {
+        if(!cacheable_status(res._status_code)) {
+          return nullptr;
+        }
+
+        std::chrono::milliseconds ttl = _ttl;
+        std::shared_ptr<cached_response> recorded = std::make_shared<cached_response>();
+        for(auto& header : res._header) {
+          const slice name(header.name.data(), header.name.length());
+          const slice value(header.value.data(), header.value.length());
+          switch(header.id) {
+            case header_id::SET_COOKIE:
+              return nullptr;
+            case header_id::CACHE_CONTROL:
+              if(!cache_control(value, ttl)) {
+                return nullptr;
+              }
+              break;
+            case header_id::VARY:
+              if(!covered(value)) {
+                return nullptr;
+              }
+              break;
+            case header_id::AGE:
+            case header_id::CONNECTION:
+            case header_id::CONTENT_LENGTH:
+            case header_id::DATE:
+            case header_id::TRANSFER_ENCODING:
+              continue;
+            case header_id::CONTENT_ENCODING:
+#ifdef WEBBY_HAVE_ZLIB
+              // Set by the response itself when it compressed the body.
+              if(res._gzip) {
+                continue;
+              }
+#endif
+              // A body that the handler encoded itself depends on what the client accepts.
+              if(!keyed("Accept-Encoding")) {
+                return nullptr;
+              }
+              break;
+            default:
+              break;
+          }
+          if(is_default(defaults, name, value)) {
+            continue;
+          }
+          recorded->headers.emplace_back(std::string(name.data(), name.length()),
+                                         std::string(value.data(), value.length()));
+        }
+
+        recorded->status_code = res._status_code;
+        recorded->body = std::move(body);
+        recorded->stored = now;
+        recorded->expires = now + ttl;
+        return recorded;
+      }
+
+      /**
+       * @brief Sends a recorded response.
+       */
+      static void replay(const cached_response& cached, webby::response& res,
+                         const std::chrono::steady_clock::time_point now) {
+        res.set_status_code(cached.status_code);
+        for(auto& header : cached.headers) {
+          res.set_header(header.first, header.second);
+        }
+        const auto age = std::chrono::duration_cast<std::chrono::seconds>(now - cached.stored);
+        res._header.set(header_id::AGE, std::to_string(age.count()));
+        if(cached.status_code >= 200 && cached.status_code != 204 && cached.status_code != 304) {
+          res._header.set(header_id::CONTENT_LENGTH, std::to_string(cached.body.length()));
+        }
+        if(!cached.body.empty()) {
+          res.write_block(reinterpret_cast<const unsigned char*>(cached.body.data()),
+                          cached.body.length());
+        }
+      }
+
+      /**
+       * @brief Gets a value that indicates whether responses with a status code are cacheable by
+       *        default.
+       */
+      static bool cacheable_status(const unsigned short status_code) {
+        switch(status_code) {
+          case 200: case 203: case 204: case 300: case 301: case 308: case 404: case 405:
+          case 410: case 414: case 501:
+            return true;
+          default:
+            return false;
+        }
+      }
+
+      /**
+       * @brief Applies the directives of a `Cache-Control` header.
+       * @param[in] value Value of the header.
+       * @param[in,out] ttl Time to live, which is replaced by a `max-age` directive.
+       * @returns `false` if the response must not be cached.
+       */
+      static bool cache_control(const slice& value, std::chrono::milliseconds& ttl) {
+        for(const slice& directive : split(value)) {
+          if(directive.equals_nocase("no-store") || directive.equals_nocase("no-cache") ||
+             directive.equals_nocase("private")) {
+            return false;
+          }
+          if(directive.length() > 8 && slice(directive.data(), 8).equals_nocase("max-age=")) {
+            const std::string seconds(directive.data() + 8, directive.length() - 8);
+            ttl = std::chrono::seconds(strtol(seconds.c_str(), nullptr, 10));
+            if(ttl.count() <= 0) {
+              return false;
+            }
+          }
+        }
+        return true;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether every request header named by a `Vary` header
+       *        is part of the key.
+       *
+       * `Accept-Encoding` is always covered, since the body is recorded before the response
+       * compresses it for each client.
+       */
+      bool covered(const slice& value) const {
+        for(const slice& name : split(value)) {
+          if(!name.equals_nocase("Accept-Encoding") && !keyed(name)) {
+            return false;
+          }
+        }
+        return true;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether a request header is part of the key.
+       */
+      bool keyed(const slice& name) const {
+        for(auto& vary : _vary) {
+          if(name.equals_nocase(vary)) {
+            return true;
+          }
+        }
+        return false;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether a header was set before the handler ran.
+       */
+      static bool is_default(const std::vector<std::pair<std::string, std::string>>& defaults,
+                             const slice& name, const slice& value) {
+        for(auto& header : defaults) {
+          if(name.equals_nocase(header.first) && value == header.second) {
+            return true;
+          }
+        }
+        return false;
+      }
+
+      /**
+       * @brief Splits a comma separated header value into its trimmed, non-empty elements.
+       */
+      static std::vector<slice> split(const slice& value) {
+        std::vector<slice> parts;
+        size_t pos = 0;
+        while(pos < value.length()) {
+          size_t end = pos;
+          while(end < value.length() && value[end] != ',') {
+            ++end;
+          }
+          size_t first = pos;
+          size_t last = end;
+          while(first < last && (value[first] == ' ' || value[first] == '\t')) {
+            ++first;
+          }
+          while(last > first && (value[last - 1] == ' ' || value[last - 1] == '\t')) {
+            --last;
+          }
+          if(last > first) {
+            parts.push_back(slice(value.data() + first, last - first));
+          }
+          pos = end + 1;
+        }
+        return parts;
+      }
+
+      /**
+       * @brief Handler whose responses are cached.
+       */
+      router::handler_t _handler;
+
+      /**
+       * @brief Default time for which a response is served from the cache.
+       */
+      const std::chrono::milliseconds _ttl;
+
+      /**
+       * @brief Longest time a request waits for another one that is running the handler.
+       */
+      const std::chrono::milliseconds _max_wait;
+
+      /**
+       * @brief Request headers that are part of the key.
+       */
+      const std::vector<std::string> _vary;
+
+      /**
+       * @brief Recorded responses, shared by every copy of the handler.
+       */
+      std::shared_ptr<response_cache> _cache;
+  };
+}
@@ -1,6 +1,20 @@
 #pragma once
 
-#include <mapped_file.hpp>
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <webby/compression.hpp>
+#include <webby/file_cache.hpp>
+#include <webby/utility.hpp>
 
 /**
  * @namespace webby
@@ -8,14 +22,33 @@
 namespace webby {
   /**
    * @brief Serves static files from disk.
+   *
+   * Files are sent with webby::response::send_file(), so their contents are copied from the page
+   * cache to the socket by the kernel rather than through the server's memory. Open files are kept
+   * in a webby::file_cache that is shared by every copy of the handler.
+   *
+   * Every response carries an `ETag` and a `Last-Modified` header derived from the file's
+   * metadata. Requests whose `If-None-Match` or `If-Modified-Since` header shows that the client
+   * already has the file are answered with `304 Not Modified`, and `Range` requests are answered
+   * with `206 Partial Content`, using `multipart/byteranges` for more than one range.
+   *
+   * If a client accepts Brotli or gzip and a precompressed copy of the file exists alongside it,
+   * e.g. `app.js.br` or `app.js.gz`, the copy is sent instead with the matching
+   * `Content-Encoding`.
    */
   class file_handler {
     public:
       /**
        * @brief Constructs a new file_handler object.
        * @param[in] root Root path of the directory to serve files from.
+       * @param[in] max_entries Maximum number of files kept open.
+       * @param[in] max_bytes Maximum total size of the files kept open, in bytes.
+       * @param[in] ttl Time before an open file is checked for changes on disk.
        */
-      file_handler(const std::string& root) : _root(root) { }
+      file_handler(const std::string& root, const std::size_t max_entries = 1024,
+                   const unsigned long max_bytes = 256ul * 1024 * 1024,
+                   const std::chrono::milliseconds ttl = std::chrono::milliseconds(2000))
+          : _root(root), _cache(std::make_shared<file_cache>(max_entries, max_bytes, ttl)) { }
 
       /**
        * @brief Invoked by the router.
@@ -23,48 +56,399 @@ namespace webby {
        * @param[out] res Response sent to the connected host.
        */
       void operator()(const webby::request& req, webby::response& res) {
-        // Appends the requested path to the root path and adds "/index.html" if the request was for
-        // a directory.
-        std::string path = fix_path(_root + req.path());
+        // Appends the requested path to the root path. The cache adds "/index.html" if the
+        // request was for a directory.
+        std::shared_ptr<const cached_file> file = _cache->open(_root + req.path().str());
+        if(!file) {
+          res.set_status_code(errno == ENOENT || errno == ENOTDIR ? 404 : 500);
+          return;
+        }
 
-        try {
-          mapped::file mf(path);
-          mapped::buffer_t b = mf.map();
-          res.set_status_code(200)
-             .set_header("Content-Length", std::to_string(b.second))
-             .write_block(reinterpret_cast<unsigned char const*>(b.first), b.second);
+        const char* type = mime_type(file->path());
+        if(type != nullptr) {
+          res.set_header("Content-Type", type);
         }
-        catch(std::system_error const& ex) {
-          if(ex.code().value() == 2) {
-            res.set_status_code(404);
+
+        // Prefers a precompressed copy of the file. Missing copies are remembered by the cache,
+        // so looking for them costs nothing on most requests. Once any copy exists, every
+        // response for the file depends on `Accept-Encoding`, including the uncompressed one.
+        const slice accept = req.has_header(header_id::ACCEPT_ENCODING) ?
+                             req.header(header_id::ACCEPT_ENCODING) : slice();
+        std::shared_ptr<const cached_file> encoded;
+        bool varies = false;
+        for(auto& encoding : _encodings) {
+          std::shared_ptr<const cached_file> copy = _cache->open(file->path() + encoding.suffix);
+          if(copy) {
+            varies = true;
+            if(!encoded && accepts_encoding(accept, encoding.name)) {
+              encoded = copy;
+              res.set_header("Content-Encoding", encoding.name);
+            }
           }
-          else {
-            res.set_status_code(500);
+        }
+        if(varies) {
+          res.set_header("Vary", "Accept-Encoding");
+        }
+        if(encoded) {
+          file = encoded;
+        }
+
+        const std::string etag = entity_tag(*file);
+        res.set_header("ETag", etag)
+           .set_header("Last-Modified", http_date(file->mtime()))
+           .set_header("Accept-Ranges", "bytes");
+
+        if(not_modified(req, *file, etag)) {
+          res.set_status_code(304);
+          return;
+        }
+
+        // Responses to HEAD requests carry the same headers as GET, but no body.
+        const bool head = req.method() == webby::method::HEAD;
+
+        std::vector<range> ranges;
+        if(req.has_header(header_id::RANGE) && if_range(req, *file, etag)) {
+          // The Content-Encoding of a compressed copy would label the multipart body rather than
+          // its parts, so several ranges of one are answered with the whole copy instead.
+          if(!parse_ranges(req.header(header_id::RANGE), file->size(), ranges) ||
+             (encoded && ranges.size() > 1)) {
+            ranges.clear();
+          }
+          else if(ranges.empty()) {
+            res.set_status_code(416)
+               .set_header("Content-Range", "bytes */" + std::to_string(file->size()));
+            return;
           }
         }
+
+        if(ranges.empty()) {
+          res.set_status_code(200)
+             .set_header("Content-Length", std::to_string(file->size()));
+          if(!head) {
+            res.send_file(file->fd(), 0, file->size());
+          }
+        }
+        else if(ranges.size() == 1) {
+          const range& r = ranges.front();
+          res.set_status_code(206)
+             .set_header("Content-Range", content_range(r, file->size()))
+             .set_header("Content-Length", std::to_string(r.length));
+          if(!head) {
+            res.send_file(file->fd(), static_cast<off_t>(r.first), r.length);
+          }
+        }
+        else {
+          send_multipart(res, *file, type, ranges, etag, head);
+        }
       }
 
     private:
       /**
-       * @brief Appends "/index.html" to the path if it specified a directory.
-       * @param[in] path Path to fix.
-       * @return Fixed path.
+       * @brief Range of bytes in a file.
+       */
+      struct range {
+        /**
+         * @brief Offset of the first byte.
+         */
+        unsigned long first;
+
+        /**
+         * @brief Number of bytes.
+         */
+        unsigned long length;
+      };
+
+      /**
+       * @brief Content coding of a precompressed copy of a file.
+       */
+      struct encoding {
+        /**
+         * @brief Name of the coding in the `Accept-Encoding` and `Content-Encoding` headers.
+         */
+        const char* name;
+
+        /**
+         * @brief Suffix added to the path of the file to find the compressed copy.
+         */
+        const char* suffix;
+      };
+
+      /**
+       * @brief Precompressed copies that are looked for, in order of preference.
+       */
+      static const encoding _encodings[2];
+
+      /**
+       * @brief Gets the media type of a file from its extension.
+       * @returns The media type, or `nullptr` if the extension is not known.
+       */
+      static const char* mime_type(const std::string& path) {
+        static const char* const types[][2] = {
+          {".html", "text/html"},
+          {".htm",  "text/html"},
+          {".css",  "text/css"},
+          {".js",   "application/javascript"},
+          {".json", "application/json"},
+          {".txt",  "text/plain"},
+          {".csv",  "text/csv"},
+          {".xml",  "application/xml"},
+          {".svg",  "image/svg+xml"},
+          {".png",  "image/png"},
+          {".jpg",  "image/jpeg"},
+          {".jpeg", "image/jpeg"},
+          {".gif",  "image/gif"},
+          {".ico",  "image/x-icon"},
+          {".webp", "image/webp"},
+          {".woff2", "font/woff2"},
+          {".wasm", "application/wasm"},
+          {".pdf",  "application/pdf"}
+        };
+        size_t dot = path.rfind('.');
+        if(dot == std::string::npos || path.find('/', dot) != std::string::npos) {
+          return nullptr;
+        }
+        const char* extension = path.c_str() + dot;
+        for(auto& type : types) {
+          if(strcasecmp(extension, type[0]) == 0) {
+            return type[1];
+          }
+        }
+        return nullptr;
+      }
+
+      /**
+       * @brief Maximum number of ranges served in one response. Requests for more are answered
+       *        with the whole file.
+       */
+      static const std::size_t max_ranges = 16;
+
+      /**
+       * @brief Generates a strong entity tag from the file's inode, size, and modification time.
+       */
+      static std::string entity_tag(const cached_file& file) {
+        char buffer[64];
+        int length = snprintf(buffer, sizeof(buffer), "\"%lx-%lx-%lx\"",
+                              static_cast<unsigned long>(file.inode()), file.size(),
+                              static_cast<unsigned long>(file.mtime()));
+        return std::string(buffer, static_cast<size_t>(length));
+      }
+
+      /**
+       * @brief Determines whether the client's cached copy of the file is current.
+       *
+       * `If-None-Match` takes precedence over `If-Modified-Since`, as required by RFC 7232.
+       */
+      static bool not_modified(const webby::request& req, const cached_file& file,
+                               const std::string& etag) {
+        if(req.has_header(header_id::IF_NONE_MATCH)) {
+          return etag_matches(req.header(header_id::IF_NONE_MATCH), etag, true);
+        }
+        if(req.has_header(header_id::IF_MODIFIED_SINCE)) {
+          time_t since = parse_http_date(req.header(header_id::IF_MODIFIED_SINCE).str());
+          return since != -1 && file.mtime() <= since;
+        }
+        return false;
+      }
+
+      /**
+       * @brief Determines whether a `Range` header should be honored.
+       *
+       * A request with an `If-Range` header only receives part of the file if the validator still
+       * matches it; otherwise the whole file is sent.
        */
-      std::string fix_path(std::string path) {
-        struct stat st;
-        ::stat(path.c_str(), &st);
-        if(S_ISDIR(st.st_mode)) {
-          if(path[path.length() - 1] != '/') {
-            path += "/";
+      static bool if_range(const webby::request& req, const cached_file& file,
+                           const std::string& etag) {
+        if(!req.has_header(header_id::IF_RANGE)) {
+          return true;
+        }
+        slice value = req.header(header_id::IF_RANGE);
+        if(!value.empty() && (value[0] == '"' || value.starts_with("W/"))) {
+          return etag_matches(value, etag, false);
+        }
+        return parse_http_date(value.str()) == file.mtime();
+      }
+
+      /**
+       * @brief Determines whether a list of entity tags contains @p etag.
+       * @param[in] list Value of an `If-None-Match` or `If-Range` header.
+       * @param[in] etag Entity tag of the file.
+       * @param[in] weak `true` to use weak comparison, which ignores the `W/` prefix.
+       */
+      static bool etag_matches(const slice& list, const std::string& etag, const bool weak) {
+        size_t pos = 0;
+        while(pos < list.length()) {
+          size_t end = pos;
+          while(end < list.length() && list[end] != ',') {
+            ++end;
+          }
+          slice tag = list.substr(pos, end - pos);
+          pos = end + 1;
+
+          // Trims the whitespace around the tag.
+          while(!tag.empty() && (tag[0] == ' ' || tag[0] == '\t')) {
+            tag = tag.substr(1);
+          }
+          while(!tag.empty() && (tag[tag.length() - 1] == ' ' || tag[tag.length() - 1] == '\t')) {
+            tag = tag.substr(0, tag.length() - 1);
+          }
+
+          if(tag == "*") {
+            return true;
+          }
+          if(tag.starts_with("W/")) {
+            if(!weak) {
+              continue;
+            }
+            tag = tag.substr(2);
+          }
+          if(tag == etag) {
+            return true;
           }
-          path += "index.html";
         }
-        return path;
+        return false;
+      }
+
+      /**
+       * @brief Parses the value of a `Range` header.
+       * @param[in] value Value of the header.
+       * @param[in] size Size of the file.
+       * @param[out] ranges Receives the satisfiable ranges, which is empty if none of them are.
+       * @returns `false` if the header is invalid or asks for too many ranges, in which case it is
+       *          ignored.
+       */
+      static bool parse_ranges(const slice& value, const unsigned long size,
+                               std::vector<range>& ranges) {
+        if(!value.starts_with("bytes=")) {
+          return false;
+        }
+        const std::string spec = value.substr(6).str();
+        const char* pos = spec.c_str();
+        while(*pos != '\0') {
+          while(*pos == ' ' || *pos == '\t') {
+            ++pos;
+          }
+
+          char* end;
+          unsigned long first;
+          unsigned long last;
+          if(*pos == '-') {
+            // A suffix range selects the last N bytes of the file.
+            if(!isdigit(pos[1])) {
+              return false;
+            }
+            unsigned long suffix = strtoul(pos + 1, &end, 10);
+            first = suffix == 0 ? size : (suffix < size ? size - suffix : 0);
+            last = size - 1;
+            pos = end;
+          }
+          else {
+            if(!isdigit(*pos)) {
+              return false;
+            }
+            first = strtoul(pos, &end, 10);
+            if(*end != '-') {
+              return false;
+            }
+            pos = end + 1;
+            last = size - 1;
+            if(isdigit(*pos)) {
+              unsigned long value = strtoul(pos, &end, 10);
+              if(value < first) {
+                return false;
+              }
+              if(value < last) {
+                last = value;
+              }
+              pos = end;
+            }
+          }
+
+          // Ranges that start past the end of the file cannot be satisfied, and are skipped.
+          if(first < size) {
+            if(ranges.size() == max_ranges) {
+              return false;
+            }
+            ranges.push_back(range{first, last - first + 1});
+          }
+
+          while(*pos == ' ' || *pos == '\t') {
+            ++pos;
+          }
+          if(*pos == ',') {
+            ++pos;
+          }
+          else if(*pos != '\0') {
+            return false;
+          }
+        }
+        return true;
+      }
+
+      /**
+       * @brief Formats the value of a `Content-Range` header.
+       */
+      static std::string content_range(const range& r, const unsigned long size) {
+        return "bytes " + std::to_string(r.first) + "-" + std::to_string(r.first + r.length - 1) +
+               "/" + std::to_string(size);
+      }
+
+      /**
+       * @brief Sends several ranges of a file as a `multipart/byteranges` body.
+       * @param[out] res Response sent to the connected host.
+       * @param[in] file The file.
+       * @param[in] type Media type of the file, or `nullptr` if it is not known.
+       * @param[in] ranges Ranges to send.
+       * @param[in] etag Entity tag of the file.
+       * @param[in] head `true` to send only the headers.
+       */
+      static void send_multipart(webby::response& res, const cached_file& file, const char* type,
+                                 const std::vector<range>& ranges, const std::string& etag,
+                                 const bool head) {
+        // The entity tag only contains hexadecimal digits and dashes, so it cannot be mistaken for
+        // the start of a header when it is used in the boundary.
+        const std::string boundary = "webby-" + etag.substr(1, etag.length() - 2);
+
+        // Every part is formatted first so that the Content-Length is known. The media type of
+        // the file moves from the response to each part.
+        const std::string part_type = type != nullptr ?
+                                      std::string("\r\nContent-Type: ") + type : std::string();
+        std::vector<std::string> parts;
+        unsigned long length = 0;
+        for(auto& r : ranges) {
+          parts.push_back("\r\n--" + boundary + part_type + "\r\nContent-Range: " +
+                          content_range(r, file.size()) + "\r\n\r\n");
+          length += parts.back().length() + r.length;
+        }
+        const std::string trailer = "\r\n--" + boundary + "--\r\n";
+        length += trailer.length();
+
+        res.set_status_code(206)
+           .set_header("Content-Type", "multipart/byteranges; boundary=" + boundary)
+           .set_header("Content-Length", std::to_string(length));
+        if(head) {
+          return;
+        }
+        for(size_t i = 0; i < ranges.size(); ++i) {
+          res.write_block(reinterpret_cast<const unsigned char*>(parts[i].data()),
+                          parts[i].length());
+          res.send_file(file.fd(), static_cast<off_t>(ranges[i].first), ranges[i].length);
+        }
+        res.write_block(reinterpret_cast<const unsigned char*>(trailer.data()), trailer.length());
       }
 
       /**
        * @brief Root path of the served directory.
        */
       const std::string _root;
+
+      /**
+       * @brief Open files, shared by every copy of the handler.
+       */
+      std::shared_ptr<file_cache> _cache;
+  };
+
+  const file_handler::encoding file_handler::_encodings[2] = {
+    {"br", ".br"},
+    {"gzip", ".gz"}
   };
 }
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+
+#include <webby/metrics.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Publishes a server's statistics in the Prometheus text exposition format.
+   *
+   *     webby::metrics metrics;
+   *     config.set_metrics(metrics);
+   *     router.add("/metrics", webby::method::GET, webby::metrics_handler(metrics));
+   *
+   * The per-thread counters are only added up when this handler is invoked.
+   */
+  class metrics_handler {
+    public:
+      /**
+       * @brief Constructs a new metrics_handler object.
+       * @param[in] metrics Statistics to publish. They must outlive the handler.
+       */
+      explicit metrics_handler(const webby::metrics& metrics) : _metrics(&metrics) { }
+
+      /**
+       * @brief Invoked by the router.
+       * @param[in] req Request that triggered the use of this handler.
+       * @param[out] res Response sent to the connected host.
+       */
+      void operator()(const webby::request& req, webby::response& res) {
+        (void)req;
+        const std::string body = _metrics->prometheus();
+        res.set_header("Content-Type", "text/plain; version=0.0.4")
+           .set_header("Cache-Control", "no-store")
+           .set_header("Content-Length", std::to_string(body.length()))
+           .write_block(reinterpret_cast<const unsigned char*>(body.data()), body.length());
+      }
+
+    private:
+      /**
+       * @brief Statistics to publish.
+       */
+      const webby::metrics* _metrics;
+  };
+}
@@ -1,4 +1,6 @@
 #pragma once
 #include <webby/server.hpp>
+#include <handlers/cache_handler.hpp>
 #include <handlers/file_handler.hpp>
+#include <handlers/metrics_handler.hpp>
 #include <handlers/rest_handler.hpp>
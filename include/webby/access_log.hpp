@@ -0,0 +1,281 @@
+/**
+ * @file access_log.hpp
+ */
+#pragma once
+
+#include <time.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <webby/config.hpp>
+#include <webby/method.hpp>
+#include <webby/ring_buffer.hpp>
+#include <webby/slice.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Everything that is written to the access log about a single request.
+   *
+   * The record has a fixed size so that it can be copied into the access log's ring buffer
+   * without allocating. Paths longer than access_record::max_path are truncated.
+   */
+  struct access_record {
+    /**
+     * @brief Maximum number of characters of the path that are recorded.
+     */
+    static const std::size_t max_path = 256;
+
+    /**
+     * @brief Maximum length of the client's IP address, including the terminator.
+     */
+    static const std::size_t max_client_ip = 46;
+
+    /**
+     * @brief Time the request was completed.
+     */
+    std::chrono::system_clock::time_point time;
+
+    /**
+     * @brief Time taken to process the request.
+     */
+    std::chrono::microseconds latency;
+
+    /**
+     * @brief Number of body bytes sent to the client.
+     */
+    unsigned long bytes_sent;
+
+    /**
+     * @brief Request method.
+     */
+    webby::method method;
+
+    /**
+     * @brief Status code of the response.
+     */
+    unsigned short status_code;
+
+    /**
+     * @brief Number of characters in access_record::path.
+     */
+    unsigned short path_length;
+
+    /**
+     * @brief Request path. Not null terminated.
+     */
+    char path[max_path];
+
+    /**
+     * @brief Null terminated IP address of the client.
+     */
+    char client_ip[max_client_ip];
+  };
+
+  /**
+   * @brief Writes access records to `webby::config::access_log()` on a background thread.
+   *
+   * Threads that serve requests only copy a record into a lock-free ring buffer. A background
+   * thread wakes up every `webby::config::access_log_flush_interval()`, formats every record that
+   * is waiting, and writes them to the access log in a single batch. If the buffer is full the
+   * record is dropped rather than making the request wait, and the number of dropped records is
+   * reported in the error log.
+   *
+   * Records are written in the Common Log Format, followed by the latency in microseconds:
+   *
+   *     127.0.0.1 - - [16/Oct/2026:16:51:15 +0000] "GET /item/1" 200 31 84
+   */
+  class access_log_writer {
+    public:
+      /**
+       * @brief Starts the background thread.
+       * @param[in] config Server configuration.
+       */
+      explicit access_log_writer(const webby::config& config)
+          : _config(config), _records(config.access_log_capacity()), _dropped(0),
+            _reported(0), _stopping(false) {
+        _thread = std::thread([this] { drain(); });
+      }
+
+      /**
+       * @brief Writes the records that are still buffered and stops the background thread.
+       */
+      ~access_log_writer() {
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          _stopping = true;
+        }
+        _wake.notify_one();
+        _thread.join();
+      }
+
+      access_log_writer(const access_log_writer&) = delete;
+      access_log_writer& operator=(const access_log_writer&) = delete;
+
+      /**
+       * @brief Queues a record without blocking.
+       * @param[in] method Request method.
+       * @param[in] path Request path.
+       * @param[in] status_code Status code of the response.
+       * @param[in] bytes_sent Number of body bytes sent to the client.
+       * @param[in] latency Time taken to process the request.
+       * @param[in] client_ip IP address of the client.
+       */
+      void log(const webby::method method, const slice& path, const unsigned short status_code,
+               const unsigned long bytes_sent, const std::chrono::microseconds latency,
+               const std::string& client_ip) {
+        access_record record;
+        record.time = std::chrono::system_clock::now();
+        record.latency = latency;
+        record.bytes_sent = bytes_sent;
+        record.method = method;
+        record.status_code = status_code;
+        size_t path_length = path.length();
+        if(path_length > access_record::max_path) {
+          path_length = access_record::max_path;
+        }
+        record.path_length = static_cast<unsigned short>(path_length);
+        memcpy(record.path, path.data(), path_length);
+        size_t ip_length = client_ip.length();
+        if(ip_length >= access_record::max_client_ip) {
+          ip_length = access_record::max_client_ip - 1;
+        }
+        memcpy(record.client_ip, client_ip.data(), ip_length);
+        record.client_ip[ip_length] = '\0';
+        if(!_records.push(record)) {
+          _dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+
+      /**
+       * @brief Gets the number of records that were dropped because the buffer was full.
+       */
+      unsigned long dropped() const {
+        return _dropped.load(std::memory_order_relaxed);
+      }
+
+    private:
+      /**
+       * @brief Body of the background thread.
+       */
+      void drain() {
+        std::string batch;
+        std::unique_lock<std::mutex> lock(_mutex);
+        while(1) {
+          _wake.wait_for(lock, _config.access_log_flush_interval(), [this] { return _stopping; });
+          bool stopping = _stopping;
+          lock.unlock();
+
+          write(batch);
+
+          unsigned long dropped = _dropped.load(std::memory_order_relaxed);
+          if(dropped != _reported) {
+            WEBBY_ERROR(_config) << "Dropped " << dropped - _reported
+                                 << " access log records" << std::endl;
+            _reported = dropped;
+          }
+
+          if(stopping) {
+            return;
+          }
+          lock.lock();
+        }
+      }
+
+      /**
+       * @brief Formats every buffered record and writes them to the access log.
+       * @param[in,out] batch Scratch buffer, reused between batches.
+       */
+      void write(std::string& batch) {
+        access_record record;
+        time_t second = 0;
+        char timestamp[32] = "";
+        batch.clear();
+        while(_records.pop(record)) {
+          // Records arrive in roughly chronological order, so the timestamp is usually reused.
+          time_t t = std::chrono::system_clock::to_time_t(record.time);
+          if(t != second) {
+            struct tm tm;
+            gmtime_r(&t, &tm);
+            strftime(timestamp, sizeof(timestamp), "%d/%b/%Y:%H:%M:%S +0000", &tm);
+            second = t;
+          }
+
+          if(!batch.empty()) {
+            batch += '\n';
+          }
+          batch.append(record.client_ip);
+          batch.append(" - - [");
+          batch.append(timestamp);
+          batch.append("] \"");
+          // Requests that were rejected before the request line was parsed have no path.
+          if(record.path_length == 0) {
+            batch += '-';
+          }
+          else {
+            batch.append(to_string(record.method));
+            batch += ' ';
+            batch.append(record.path, record.path_length);
+          }
+          batch.append("\" ");
+          batch.append(std::to_string(record.status_code));
+          batch += ' ';
+          batch.append(std::to_string(record.bytes_sent));
+          batch += ' ';
+          batch.append(std::to_string(record.latency.count()));
+        }
+        if(!batch.empty()) {
+          _config.access_log() << qlog::info << batch << std::endl;
+        }
+      }
+
+      /**
+       * @brief Server configuration.
+       */
+      const webby::config& _config;
+
+      /**
+       * @brief Records waiting to be written.
+       */
+      ring_buffer<access_record> _records;
+
+      /**
+       * @brief Number of records dropped because the buffer was full.
+       */
+      std::atomic<unsigned long> _dropped;
+
+      /**
+       * @brief Number of dropped records that have been reported in the error log.
+       */
+      unsigned long _reported;
+
+      /**
+       * @brief `true` once the destructor has asked the background thread to stop.
+       */
+      bool _stopping;
+
+      /**
+       * @brief Guards access_log_writer::_stopping.
+       */
+      std::mutex _mutex;
+
+      /**
+       * @brief Wakes the background thread early when it is asked to stop.
+       */
+      std::condition_variable _wake;
+
+      /**
+       * @brief Background thread.
+       */
+      std::thread _thread;
+  };
+}
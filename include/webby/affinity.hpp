@@ -0,0 +1,48 @@
+/**
+ * @file affinity.hpp
+ */
+#pragma once
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+#include <vector>
+
+#include <webby/config.hpp>
+#include <webby/log.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Pins the calling worker thread to its CPU from webby::config::cpu_affinity().
+   * @param[in] config Server configuration.
+   * @param[in] index Index of the worker thread.
+   *
+   * Nothing is done if no CPUs are configured. A CPU that cannot be used is logged, and the thread
+   * carries on without being pinned.
+   */
+  void pin_thread(const webby::config& config, const unsigned index) {
+    const std::vector<unsigned>& cpus = config.cpu_affinity();
+    if(cpus.empty()) {
+      return;
+    }
+    const unsigned cpu = cpus[index % cpus.size()];
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+    }
+    const int result = cpu < CPU_SETSIZE ?
+                       ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set) : EINVAL;
+    if(result != 0) {
+      WEBBY_ERROR(config) << "Cannot pin worker thread " << index << " to CPU " << cpu << ": "
+                          << strerror(result) << std::endl;
+      return;
+    }
+    WEBBY_DEBUG(config) << "Pinned worker thread " << index << " to CPU " << cpu << std::endl;
+  }
+}
@@ -0,0 +1,234 @@
+/**
+ * @file arena.hpp
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Monotonic memory arena.
+   *
+   * Memory is handed out by bumping a pointer through large blocks and is only given back all at
+   * once by arena::reset(). Each connection owns an arena that backs the short-lived containers of
+   * the request being served, and resets it before the next request. When a request needed more
+   * than one block, the blocks are replaced by a single block of their combined size, so a
+   * persistent connection soon serves every request without calling `malloc`.
+   */
+  class arena {
+    public:
+      /**
+       * @brief Constructs an empty arena.
+       * @param[in] block_size Size of the first block, allocated when it is first needed.
+       */
+      explicit arena(const std::size_t block_size = 4096)
+          : _block_size(block_size), _cursor(nullptr), _end(nullptr) { }
+
+      arena(const arena&) = delete;
+      arena& operator=(const arena&) = delete;
+
+      /**
+       * @brief Allocates memory from the arena.
+       * @param[in] size Number of bytes.
+       * @param[in] alignment Alignment of the memory, which must be a power of two.
+       * @returns The memory, which remains valid until arena::reset() is called.
+       */
+      void* allocate(const std::size_t size, const std::size_t alignment) {
+        char* p = align(_cursor, alignment);
+        if(p == nullptr || size > static_cast<std::size_t>(_end - p)) {
+          grow(size + alignment);
+          p = align(_cursor, alignment);
+        }
+        _cursor = p + size;
+        return p;
+      }
+
+      /**
+       * @brief Returns memory to the arena.
+       *
+       * Memory is only reused if it was the last allocation, which lets a growing string or
+       * vector extend itself in place; otherwise it is reclaimed by arena::reset().
+       */
+      void deallocate(void* p, const std::size_t size) {
+        if(static_cast<char*>(p) + size == _cursor) {
+          _cursor = static_cast<char*>(p);
+        }
+      }
+
+      /**
+       * @brief Releases everything that has been allocated from the arena.
+       */
+      void reset() {
+        if(_blocks.size() > 1) {
+          std::size_t size = 0;
+          for(auto& block : _blocks) {
+            size += block.size;
+          }
+          _blocks.clear();
+          _blocks.push_back(block(size));
+        }
+        if(!_blocks.empty()) {
+          _cursor = _blocks.back().data.get();
+          _end = _cursor + _blocks.back().size;
+        }
+      }
+
+    private:
+      /**
+       * @brief A block of memory.
+       */
+      struct block {
+        /**
+         * @brief Allocates the block.
+         */
+        explicit block(const std::size_t length) : data(new char[length]), size(length) { }
+
+        /**
+         * @brief The memory.
+         */
+        std::unique_ptr<char[]> data;
+
+        /**
+         * @brief Size of the block in bytes.
+         */
+        std::size_t size;
+      };
+
+      /**
+       * @brief Rounds a pointer up to an alignment.
+       * @returns The aligned pointer, or `nullptr` if @p p is `nullptr`.
+       */
+      static char* align(char* p, const std::size_t alignment) {
+        if(p == nullptr) {
+          return nullptr;
+        }
+        const std::uintptr_t value = reinterpret_cast<std::uintptr_t>(p);
+        return p + ((alignment - (value & (alignment - 1))) & (alignment - 1));
+      }
+
+      /**
+       * @brief Starts a new block that can hold at least @p size bytes.
+       */
+      void grow(const std::size_t size) {
+        std::size_t length = _blocks.empty() ? _block_size : _blocks.back().size * 2;
+        while(length < size) {
+          length *= 2;
+        }
+        _blocks.push_back(block(length));
+        _cursor = _blocks.back().data.get();
+        _end = _cursor + length;
+      }
+
+      /**
+       * @brief Size of the first block.
+       */
+      const std::size_t _block_size;
+
+      /**
+       * @brief Blocks of memory, the current one last.
+       */
+      std::vector<block> _blocks;
+
+      /**
+       * @brief Next free byte of the current block.
+       */
+      char* _cursor;
+
+      /**
+       * @brief End of the current block.
+       */
+      char* _end;
+  };
+
+  /**
+   * @brief Standard allocator that takes its memory from a webby::arena.
+   *
+   * A default constructed allocator is not bound to an arena and uses the global heap instead, so
+   * containers that use it can still be created where no arena is at hand.
+   */
+  template<typename T>
+  class arena_allocator {
+    public:
+      typedef T value_type;
+
+      /**
+       * @brief Constructs an allocator that uses the global heap.
+       */
+      arena_allocator() noexcept : _arena(nullptr) { }
+
+      /**
+       * @brief Constructs an allocator that uses an arena.
+       * @param[in] a The arena, which must outlive everything allocated from it.
+       */
+      explicit arena_allocator(webby::arena& a) noexcept : _arena(&a) { }
+
+      /**
+       * @brief Converts an allocator for another type.
+       */
+      template<typename U>
+      arena_allocator(const arena_allocator<U>& other) noexcept : _arena(other.get_arena()) { }
+
+      /**
+       * @brief Allocates memory for @p n objects.
+       */
+      T* allocate(const std::size_t n) {
+        if(_arena == nullptr) {
+          return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+        return static_cast<T*>(_arena->allocate(n * sizeof(T), alignof(T)));
+      }
+
+      /**
+       * @brief Releases memory for @p n objects.
+       */
+      void deallocate(T* p, const std::size_t n) {
+        if(_arena == nullptr) {
+          ::operator delete(p);
+        }
+        else {
+          _arena->deallocate(p, n * sizeof(T));
+        }
+      }
+
+      /**
+       * @brief Gets the arena, or `nullptr` if the global heap is used.
+       */
+      webby::arena* get_arena() const noexcept {
+        return _arena;
+      }
+
+      template<typename U>
+      struct rebind {
+        typedef arena_allocator<U> other;
+      };
+
+    private:
+      /**
+       * @brief The arena, or `nullptr` to use the global heap.
+       */
+      webby::arena* _arena;
+  };
+
+  template<typename T, typename U>
+  bool operator==(const arena_allocator<T>& lhs, const arena_allocator<U>& rhs) noexcept {
+    return lhs.get_arena() == rhs.get_arena();
+  }
+
+  template<typename T, typename U>
+  bool operator!=(const arena_allocator<T>& lhs, const arena_allocator<U>& rhs) noexcept {
+    return lhs.get_arena() != rhs.get_arena();
+  }
+
+  /**
+   * @brief String whose characters are allocated from a webby::arena.
+   */
+  typedef std::basic_string<char, std::char_traits<char>, arena_allocator<char>> arena_string;
+}
@@ -0,0 +1,391 @@
+/**
+ * @file body_reader.hpp
+ */
+#pragma once
+
+#include <string.h>
+#include <cstddef>
+#include <limits>
+
+#include <webby/connection.hpp>
+#include <webby/parser.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Incremental decoder for a body sent with `Transfer-Encoding: chunked`.
+   *
+   * The decoder accepts the body in pieces of any size, so it never needs the whole body, or even
+   * a whole chunk, to be buffered. Chunk extensions and trailers are skipped.
+   */
+  class chunked_decoder {
+    public:
+      /**
+       * @brief Constructs the decoder.
+       * @param[in] max_size Maximum size of the decoded body in bytes, or `0` for no limit.
+       */
+      explicit chunked_decoder(const size_t max_size)
+          : _max_size(max_size), _state(state::SIZE), _chunk(0), _digits(0), _line(0),
+            _total(0) { }
+
+      /**
+       * @brief Decodes as much of the body as possible.
+       * @param[in] in Encoded input.
+       * @param[in] in_length Length of the input.
+       * @param[out] used Receives the number of input bytes consumed.
+       * @param[out] out Buffer that receives the decoded data, or `nullptr` to skip it.
+       * @param[in] out_length Length of the buffer.
+       * @returns The number of decoded bytes.
+       * @throws request_parser::error if the encoding is invalid, or the body is too large.
+       *
+       * Decoding stops when the input is exhausted, the buffer is full, or the end of the body
+       * has been reached. The input and the buffer may overlap as long as the buffer does not
+       * start after the input.
+       */
+      size_t decode(const char* in, const size_t in_length, size_t& used, char* out,
+                    const size_t out_length) {
+        size_t pos = 0;
+        size_t written = 0;
+        while(pos < in_length && _state != state::DONE) {
+          if(_state == state::DATA) {
+            if(written == out_length) {
+              break;
+            }
+            size_t count = in_length - pos;
+            if(count > _chunk) {
+              count = static_cast<size_t>(_chunk);
+            }
+            if(count > out_length - written) {
+              count = out_length - written;
+            }
+            if(out != nullptr) {
+              memmove(out + written, in + pos, count);
+            }
+            pos += count;
+            written += count;
+            _chunk -= count;
+            if(_chunk == 0) {
+              _state = state::DATA_END;
+            }
+            continue;
+          }
+          step(in[pos++]);
+        }
+        used = pos;
+        return written;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether the end of the body has been reached.
+       */
+      bool done() const {
+        return _state == state::DONE;
+      }
+
+    private:
+      /**
+       * @brief Decoding states.
+       */
+      enum class state {
+        SIZE,         ///< Reading the hexadecimal size of a chunk.
+        EXTENSION,    ///< Skipping a chunk extension.
+        SIZE_END,     ///< Expecting the LF that ends the size line.
+        DATA,         ///< Copying chunk data.
+        DATA_END,     ///< Expecting the CRLF that follows chunk data.
+        DATA_END_LF,  ///< Expecting the LF that follows chunk data.
+        TRAILER,      ///< At the start of a trailer line, or of the final blank line.
+        TRAILER_LINE, ///< Skipping a trailer line.
+        TRAILER_END,  ///< Expecting the LF of the final blank line.
+        DONE          ///< The body has ended.
+      };
+
+      /**
+       * @brief Longest size line or trailer line that is accepted.
+       */
+      static const size_t max_line = 4096;
+
+      /**
+       * @brief Handles one byte of framing.
+       */
+      void step(const char c) {
+        if(++_line > max_line) {
+          throw request_parser::error(400, "Chunk framing line is too long");
+        }
+        switch(_state) {
+          case state::SIZE:
+            if(hex(c) >= 0) {
+              if(_chunk > (std::numeric_limits<unsigned long long>::max() >> 4)) {
+                throw request_parser::error(413, "Request body is too large");
+              }
+              _chunk = (_chunk << 4) | static_cast<unsigned long long>(hex(c));
+              ++_digits;
+            }
+            else if(_digits == 0) {
+              throw request_parser::error(400, "Invalid chunk size");
+            }
+            else if(c == ';' || c == ' ' || c == '\t') {
+              _state = state::EXTENSION;
+            }
+            else if(c == '\r') {
+              _state = state::SIZE_END;
+            }
+            else if(c == '\n') {
+              start_chunk();
+            }
+            else {
+              throw request_parser::error(400, "Invalid chunk size");
+            }
+            break;
+          case state::EXTENSION:
+            if(c == '\r') {
+              _state = state::SIZE_END;
+            }
+            else if(c == '\n') {
+              start_chunk();
+            }
+            break;
+          case state::SIZE_END:
+            expect(c, '\n');
+            start_chunk();
+            break;
+          case state::DATA_END:
+            if(c == '\n') {
+              next_line(state::SIZE);
+            }
+            else {
+              expect(c, '\r');
+              _state = state::DATA_END_LF;
+            }
+            break;
+          case state::DATA_END_LF:
+            expect(c, '\n');
+            next_line(state::SIZE);
+            break;
+          case state::TRAILER:
+            if(c == '\r') {
+              _state = state::TRAILER_END;
+            }
+            else if(c == '\n') {
+              _state = state::DONE;
+            }
+            else {
+              _state = state::TRAILER_LINE;
+            }
+            break;
+          case state::TRAILER_LINE:
+            if(c == '\n') {
+              next_line(state::TRAILER);
+            }
+            break;
+          case state::TRAILER_END:
+            expect(c, '\n');
+            _state = state::DONE;
+            break;
+          case state::DATA:
+          case state::DONE:
+            break;
+        }
+      }
+
+      /**
+       * @brief Starts the chunk whose size line has just ended.
+       */
+      void start_chunk() {
+        if(_chunk == 0) {
+          next_line(state::TRAILER);
+          return;
+        }
+        if(_max_size != 0 && (_chunk > _max_size || _total + _chunk > _max_size)) {
+          throw request_parser::error(413, "Request body is too large");
+        }
+        _total += _chunk;
+        next_line(state::DATA);
+      }
+
+      /**
+       * @brief Moves to the start of the next line.
+       */
+      void next_line(const state next) {
+        _state = next;
+        _chunk = next == state::DATA ? _chunk : 0;
+        _digits = 0;
+        _line = 0;
+      }
+
+      /**
+       * @brief Checks a byte of framing.
+       * @throws request_parser::error if the byte is not @p expected.
+       */
+      static void expect(const char c, const char expected) {
+        if(c != expected) {
+          throw request_parser::error(400, "Invalid chunk framing");
+        }
+      }
+
+      /**
+       * @brief Gets the value of a hexadecimal digit, or `-1`.
+       */
+      static int hex(const char c) {
+        if(c >= '0' && c <= '9') {
+          return c - '0';
+        }
+        if(c >= 'a' && c <= 'f') {
+          return c - 'a' + 10;
+        }
+        if(c >= 'A' && c <= 'F') {
+          return c - 'A' + 10;
+        }
+        return -1;
+      }
+
+      /**
+       * @brief Maximum size of the decoded body, or `0`.
+       */
+      size_t _max_size;
+
+      /**
+       * @brief Current decoding state.
+       */
+      state _state;
+
+      /**
+       * @brief Size of the current chunk, or the part of it that has not been decoded.
+       */
+      unsigned long long _chunk;
+
+      /**
+       * @brief Number of digits in the current size line.
+       */
+      size_t _digits;
+
+      /**
+       * @brief Number of bytes in the current framing line.
+       */
+      size_t _line;
+
+      /**
+       * @brief Size of the chunks that have been started.
+       */
+      unsigned long long _total;
+  };
+
+  /**
+   * @brief Reads the body of a request.
+   *
+   * A body with a `Content-Length` is read up to that length, and a chunked body is decoded as it
+   * is read, so a handler never reads into the request that follows. If the client is waiting
+   * for `100 Continue` it is sent when the body is first read.
+   */
+  class body_reader {
+    public:
+      /**
+       * @brief Constructs a reader for the body of the current request on a connection.
+       * @param[in] connection The connection. The request line and headers must already have
+       *                       been parsed.
+       */
+      explicit body_reader(webby::connection& connection)
+          : _connection(connection), _chunked(connection.parser().chunked()),
+            _remaining(connection.parser().content_length()),
+            _decoder(connection.parser().max_body_size()) { }
+
+      /**
+       * @brief Reads a block of the body.
+       * @param[in] buffer Buffer that receives the data.
+       * @param[in] length Length of the buffer.
+       * @param[in] peek `true` to read the data without removing it from the body.
+       * @returns The number of bytes read, or `0` once the whole body has been read.
+       * @throws request_parser::error if the body is invalid or too large, or if the connection
+       *         was closed before the end of the body.
+       */
+      size_t read(char* buffer, const size_t length, const bool peek) {
+        if(done() || length == 0) {
+          return 0;
+        }
+        _connection.send_continue();
+        if(!_chunked) {
+          const size_t count = _connection.read(buffer, length < _remaining ? length : _remaining,
+                                                peek);
+          if(count == 0) {
+            throw request_parser::error(400, "Connection closed before the end of the body");
+          }
+          if(!peek) {
+            _remaining -= count;
+          }
+          return count;
+        }
+
+        // A peek decodes with a copy of the decoder, and leaves the input where it was.
+        chunked_decoder decoder = _decoder;
+        size_t offset = 0;
+        size_t written = 0;
+        while(written == 0 && !decoder.done()) {
+          const slice input = _connection.unread();
+          if(offset == input.length()) {
+            if(!_connection.fill_body()) {
+              throw request_parser::error(400, "Connection closed before the end of the body");
+            }
+            continue;
+          }
+          size_t used = 0;
+          written = decoder.decode(input.data() + offset, input.length() - offset, used, buffer,
+                                   length);
+          if(peek) {
+            offset += used;
+          }
+          else {
+            _connection.skip(used);
+          }
+        }
+        if(!peek) {
+          _decoder = decoder;
+        }
+        return written;
+      }
+
+      /**
+       * @brief Reads and discards the rest of the body.
+       */
+      void discard() {
+        char buffer[4096];
+        while(read(buffer, sizeof(buffer), false) > 0) {
+        }
+      }
+
+      /**
+       * @brief Gets a value that indicates whether the whole body has been read.
+       */
+      bool done() const {
+        return _chunked ? _decoder.done() : _remaining == 0;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether the body is chunked.
+       */
+      bool chunked() const {
+        return _chunked;
+      }
+
+    private:
+      /**
+       * @brief Connection the body is read from.
+       */
+      webby::connection& _connection;
+
+      /**
+       * @brief `true` if the body is chunked.
+       */
+      const bool _chunked;
+
+      /**
+       * @brief Number of bytes of a body with a `Content-Length` that have not been read.
+       */
+      size_t _remaining;
+
+      /**
+       * @brief Decoder for a chunked body.
+       */
+      chunked_decoder _decoder;
+  };
+}
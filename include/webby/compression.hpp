@@ -0,0 +1,183 @@
+/**
+ * @file compression.hpp
+ */
+#pragma once
+
+#include <stdlib.h>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#ifdef WEBBY_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include <webby/slice.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Determines whether the parameters of an item in an `Accept-Encoding` header leave it
+   *        acceptable.
+   * @param[in] params Everything after the name of the coding.
+   * @returns `false` if the quality value is zero, which means "not acceptable".
+   */
+  bool nonzero_quality(const slice& params) {
+    for(size_t q = 0; q + 2 < params.length(); ++q) {
+      if((params[q] == 'q' || params[q] == 'Q') && params[q + 1] == '=') {
+        std::string value = params.substr(q + 2).str();
+        return strtod(value.c_str(), nullptr) > 0.0;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * @brief Determines whether an `Accept-Encoding` header allows a content coding.
+   * @param[in] header Value of the `Accept-Encoding` header.
+   * @param[in] coding Name of the content coding, e.g. @c gzip
+   * @returns `true` if the coding is listed with a non-zero quality value, or if it is not listed
+   *          and `*` is.
+   */
+  bool accepts_encoding(const slice& header, const slice& coding) {
+    // The coding itself overrides `*`, so the whole list is scanned.
+    bool wildcard = false;
+    size_t pos = 0;
+    while(pos < header.length()) {
+      size_t end = pos;
+      while(end < header.length() && header[end] != ',') {
+        ++end;
+      }
+      slice item = header.substr(pos, end - pos);
+      pos = end + 1;
+
+      // Separates the name of the coding from its parameters.
+      size_t first = 0;
+      while(first < item.length() && (item[first] == ' ' || item[first] == '\t')) {
+        ++first;
+      }
+      size_t last = first;
+      while(last < item.length() && item[last] != ';' && item[last] != ' ' &&
+            item[last] != '\t') {
+        ++last;
+      }
+      slice name = item.substr(first, last - first);
+      if(name.equals_nocase(coding)) {
+        return nonzero_quality(item.substr(last));
+      }
+      if(name == "*") {
+        wildcard = nonzero_quality(item.substr(last));
+      }
+    }
+    return wildcard;
+  }
+
+#ifdef WEBBY_HAVE_ZLIB
+  /**
+   * @brief Incremental gzip compressor.
+   *
+   * Input is compressed as it is written, and the compressed bytes are handed to a sink whenever
+   * the output buffer fills up, so the memory used does not depend on the size of the body.
+   */
+  class gzip_stream {
+    public:
+      /**
+       * @brief Receives blocks of compressed data.
+       */
+      typedef std::function<void(const unsigned char*, size_t)> sink_t;
+
+      /**
+       * @brief Constructs the compressor.
+       * @param[in] level zlib compression level from 1 to 9, or `Z_DEFAULT_COMPRESSION`.
+       * @param[in] sink Receives the compressed data.
+       * @throws std::runtime_error if zlib cannot be initialized.
+       */
+      gzip_stream(const int level, sink_t sink) : _sink(sink) {
+        _stream.zalloc = Z_NULL;
+        _stream.zfree = Z_NULL;
+        _stream.opaque = Z_NULL;
+        // A window of 15 bits plus 16 selects the gzip wrapper rather than zlib's own.
+        if(deflateInit2(&_stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+          throw std::runtime_error("deflateInit2");
+        }
+      }
+
+      /**
+       * @brief Releases the compressor.
+       */
+      ~gzip_stream() {
+        deflateEnd(&_stream);
+      }
+
+      gzip_stream(const gzip_stream&) = delete;
+      gzip_stream& operator=(const gzip_stream&) = delete;
+
+      /**
+       * @brief Compresses a block of data.
+       */
+      void write(const unsigned char* data, const size_t length) {
+        _stream.next_in = const_cast<unsigned char*>(data);
+        _stream.avail_in = static_cast<uInt>(length);
+        deflate_all(Z_NO_FLUSH);
+      }
+
+      /**
+       * @brief Compresses everything that is still buffered, so that the client can decompress
+       *        all of the data written so far.
+       */
+      void flush() {
+        _stream.next_in = Z_NULL;
+        _stream.avail_in = 0;
+        deflate_all(Z_SYNC_FLUSH);
+      }
+
+      /**
+       * @brief Compresses everything that is still buffered and writes the gzip trailer.
+       */
+      void finish() {
+        _stream.next_in = Z_NULL;
+        _stream.avail_in = 0;
+        deflate_all(Z_FINISH);
+      }
+
+    private:
+      /**
+       * @brief Runs the compressor until it has consumed all of its input.
+       */
+      void deflate_all(const int flush) {
+        int result;
+        do {
+          _stream.next_out = _buffer;
+          _stream.avail_out = sizeof(_buffer);
+          result = deflate(&_stream, flush);
+          if(result == Z_STREAM_ERROR) {
+            throw std::runtime_error("deflate");
+          }
+          size_t count = sizeof(_buffer) - _stream.avail_out;
+          if(count > 0) {
+            _sink(_buffer, count);
+          }
+        } while(_stream.avail_out == 0 || (flush == Z_FINISH && result != Z_STREAM_END));
+      }
+
+      /**
+       * @brief Receives the compressed data.
+       */
+      sink_t _sink;
+
+      /**
+       * @brief zlib state.
+       */
+      z_stream _stream;
+
+      /**
+       * @brief Output buffer.
+       */
+      unsigned char _buffer[16384];
+  };
+#endif
+}
@@ -4,13 +4,26 @@
 #pragma once
 
 #include <qlog.hpp>
+#include <webby/log.hpp>
+#include <webby/metrics.hpp>
+#include <chrono>
+#include <cstddef>
 #include <memory>
 #include <string>
+#include <vector>
 
 /**
  * @namespace
  */
 namespace webby {
+  /**
+   * @brief Selects how the server waits for and services connections.
+   */
+  enum class engine {
+    BLOCKING, ///< Blocking sockets, optionally handed to a pool of worker threads.
+    EPOLL     ///< Non-blocking sockets multiplexed by Linux epoll event loops.
+  };
+
   /**
    * Defines all of the configuration options for the embedded server.
    */
@@ -62,6 +75,469 @@ namespace webby {
         return *this;
       }
 
+      /**
+       * @brief Gets the engine that services connections.
+       * @returns the current engine.
+       */
+      webby::engine engine() const {
+        return this->_engine;
+      }
+
+      /**
+       * @brief Sets the engine that services connections.
+       * @param[in] engine The new engine.
+       * @returns a reference to this `webby::config` instance to allow for chaining.
+       */
+      config& set_engine(const webby::engine engine) {
+        this->_engine = engine;
+        return *this;
+      }
+
+      /**
+       * @brief Gets the number of worker threads that process connections.
+       * @returns the current number of worker threads.
+       */
+      unsigned worker_threads() const {
+        return this->_worker_threads;
+      }
+
+      /**
+       * @brief Sets the number of worker threads that process connections.
+       * @param[in] count Number of worker threads. `0` processes each connection on the thread
+       *                  that accepted it.
+       * @returns a reference to this `webby::config` instance to allow for chaining.
+       *
+       * With `webby::engine::EPOLL` this is the number of event loops, each on its own thread.
+       */
+      config& set_worker_threads(const unsigned count) {
+        this->_worker_threads = count;
+        return *this;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether each worker thread has its own listening socket.
+       * @returns `true` if `SO_REUSEPORT` listeners are used.
+       */
+      bool reuse_port() const {
+        return this->_reuse_port;
+      }
+
+      /**
+       * @brief Gives each worker thread its own listening socket.
+       * @param[in] enabled `true` to open one listening socket per worker thread on the same
+       *                    address and port with `SO_REUSEPORT`.
+       * @returns a reference to this `webby::config` instance to allow for chaining.
+       *
+       * The kernel spreads incoming connections between the sockets, so each thread accepts,
+       * parses and dispatches its own connections without sharing a queue or a listening socket
+       * with the others. This scales best with `webby::engine::EPOLL`: a blocking worker serves one
+       * connection at a time, and connections that the kernel assigns to a busy worker wait for it
+       * even if other workers are idle.
+       */
+      config& set_reuse_port(const bool enabled) {
+        this->_reuse_port = enabled;
+        return *this;
+      }
+
+      /**
+       * @brief Gets the CPUs that the worker threads are pinned to.
+       * @returns the CPU numbers, or an empty list if the threads are not pinned.
+       */
+      const std::vector<unsigned>& cpu_affinity() const {
+        return this->_cpu_affinity;
+      }
+
+      /**
+       * @brief Pins the worker threads to CPUs.
+       * @param[in] cpus CPU numbers. Worker thread `i` is pinned to `cpus[i % cpus.size()]`. An
+       *                 empty list lets the threads run on any CPU.
+       * @returns a reference to this `webby::config` instance to allow for chaining.
+       *
+       * Combined with webby::config::set_reuse_port(), each CPU then runs its own pipeline from
+       * `accept()` to the handler, and keeps the connections it accepted in its own caches.
+       */
+      config& set_cpu_affinity(const std::vector<unsigned>& cpus) {
+        this->_cpu_affinity = cpus;
+        return *this;
+      }
+
+      /**
+       * @brief Gets the capacity of the queue that hands accepted connections to the workers.
+       * @returns the current queue capacity.
+       */
+      std::size_t queue_capacity() const {
+        return this->_queue_capacity;
+      }
+
+      /**
+       * @brief Sets the capacity of the queue that hands accepted connections to the workers.
+       * @param[in] capacity Maximum number of accepted connections waiting for a worker.
+       * @returns a reference to this `webby::config` instance to allow for chaining.
+       *
+       * When the queue is full the server stops accepting connections until a worker frees a
+       * slot, leaving further clients in the listen backlog of the operating system.
+       */
+      config& set_queue_capacity(const std::size_t capacity) {
+        this->_queue_capacity = capacity;
+        return *this;
+      }
+
+      /**
+       * @brief Gets how long an idle persistent connection is kept open.
+       * @returns the current idle timeout.
+       */
+      std::chrono::milliseconds idle_timeout() const {
+        return this->_idle_timeout;
+      }
+
+      /**
+       * @brief Sets how long an idle persistent connection is kept open.
+       * @param[in] timeout Time to wait for the first request on a connection and for each
+       *                    request after it, or zero for no limit.
+       * @returns a reference to this `webby::config` instance to allow for chaining.
+       */
+      config& set_idle_timeout(const std::chrono::milliseconds timeout) {
+        this->_idle_timeout = timeout;
+        return *this;
+      }
+
+      /**
+       * @brief Gets how long a client has to send the request line and headers.
+       * @returns the current header timeout.
+       */
+      std::chrono::milliseconds header_timeout() const {
+        return this->_header_timeout;
+      }
+
+      /**
+       * @brief Sets how long a client has to send the request line and headers.
+       * @param[in] timeout Time from the first byte of a request until its headers are complete,
+       *                    or zero for no limit.
+       * @returns a reference to this `webby::config` instance to allow for chaining.
+       *
+       * The limit applies to the whole of the headers rather than to each read, so a client
+       * cannot hold a connection open by trickling them in a byte at a time.
+       */
+      config& set_header_timeout(const std::chrono::milliseconds timeout) {
+        this->_header_timeout = timeout;
+        return *this;
+      }
+
+      /**
+       * @brief Gets how long the server waits for the next part of a request body.
+       * @returns the current body timeout.
+       */
+      std::chrono::milliseconds body_timeout() const {
+        return this->_body_timeout;
+      }
+
+      /**
+       * @brief Sets how long the server waits for the next part of a request body.
+       * @param[in] timeout Longest time without receiving any of the body, or zero for no limit.
+       * @returns a reference to this `webby::config` instance to allow for chaining.
+       */
+      config& set_body_timeout(const std::chrono::milliseconds timeout) {
+        this->_body_timeout = timeout;
+        return *this;
+      }
+
+      /**
+       * @brief Gets how long the server waits for a client to accept more of a response.
+       * @returns the current write timeout.
+       */
+      std::chrono::milliseconds write_timeout() const {
+        return this->_write_timeout;
+      }
+
+      /**
+       * @brief Sets how long the server waits for a client to accept more of a response.
+       * @param[in] timeout Longest time without being able to send any of the response, or zero
+       *                    for no limit.
+       * @returns a reference to this `webby::config` instance to allow for chaining.
+       */
+      config& set_write_timeout(const std::chrono::milliseconds timeout) {
+        this->_write_timeout = timeout;
+        return *this;
+      }
+
+      /**
+       * @brief Gets the slowest rate at which a client may send a body or receive a response.
+       * @returns the current minimum rate in bytes per second, or zero if there is none.
+       */
+      std::size_t min_data_rate() const {
+        return this->_min_data_rate;
+      }
+
+      /**
+       * @brief Gets how long a transfer may run before webby::config::min_data_rate() applies.
+       * @returns the current grace period.
+       */
+      std::chrono::milliseconds min_data_rate_grace() const {
+        return this->_min_data_rate_grace;
+      }
+
+      /**
+       * @brief Sets the slowest rate at which a client may send a body or receive a response.
+       * @param[in] bytes_per_second Minimum rate, or zero for no minimum.
+       * @param[in] grace Time the transfer may take regardless of its rate.
+       * @returns a reference to this `webby::config` instance to allow for chaining.
+       *
+       * The rate is measured over the time the server spends waiting for the client, so a handler
+       * that streams its response slowly is not held against the client. A connection whose
+       * transfer falls behind the rate once the grace period is over is closed.
+       */
+      config& set_min_data_rate(const std::size_t bytes_per_second,
+                                const std::chrono::milliseconds grace =
+                                    std::chrono::milliseconds(5000)) {
+        this->_min_data_rate = bytes_per_second;
+        this->_min_data_rate_grace = grace;
+        return *this;
+      }
+
+      /**
+       * @brief Gets how long a deferred response may take to be completed.
+       * @returns the current deferred timeout.
+       */
+      std::chrono::milliseconds deferred_timeout() const {
+        return this->_deferred_timeout;
+      }
+
+      /**
+       * @brief Sets how long a deferred response may take to be completed.
+       * @param[in] timeout Longest time between webby::response::defer() and
+       *                    webby::deferred::complete(), or zero for no limit.
+       * @returns a reference to this `webby::config` instance to allow for chaining.
+       *
+       * A response that is not completed in time is answered with `504 Gateway Timeout`, and the
+       * connection is closed. Completing it later has no effect.
+       */
+      config& set_deferred_timeout(const std::chrono::milliseconds timeout) {
+        this->_deferred_timeout = timeout;
+        return *this;
+      }
+
+      /**
+       * @brief Gets how long a stopping server waits for requests in progress to finish.
+       * @returns the current drain timeout.
+       */
+      std::chrono::milliseconds drain_timeout() const {
+        return this->_drain_timeout;
+      }
+
+      /**
+       * @brief Sets how long a stopping server waits for requests in progress to finish.
+       * @param[in] timeout Time between webby::server::stop() and the forced closing of the
+       *                    connections that are still busy.
+       * @returns a reference to this `webby::config` instance to allow for chaining.
+       */
+      config& set_drain_timeout(const std::chrono::milliseconds timeout) {
+        this->_drain_timeout = timeout;
+        return *this;
+      }
+
+      /**
+       * @brief Gets the path of the Unix socket used to hand the listening sockets to a new
+       *        process.
+       * @returns the current path, or an empty string if handoff is disabled.
+       */
+      const std::string& handoff_path() const {
+        return this->_handoff_path;
+      }
+
+      /**
+       * @brief Enables zero-downtime upgrades through a Unix socket.
+       * @param[in] path Path of the socket.
+       * @returns a reference to this `webby::config` instance to allow for chaining.
+       *
+       * When the server starts it first asks the process bound to @p path, if there is one, for
+       * its listening sockets, and accepts from those instead of opening new ones. It then binds
+       * @p path itself. When the next process asks, the server hands its listening sockets over
+       * and stops as if webby::server::stop() had been called. Start the new process with the same
+       * address, port and listener settings as the old one.
+       */
+      config& set_handoff_path(const std::string& path) {
+        this->_handoff_path = path;
+        return *this;
+      }
+
+      /**
+       * @brief Gets the maximum number of requests served over a single connection.
+       * @returns the current maximum.
+       */
+      unsigned max_requests_per_connection() const {
+        return this->_max_requests_per_connection;
+      }
+
+      /**
+       * @brief Sets the maximum number of requests served over a single connection.
+       * @param[in] count Maximum number of requests. `1` disables persistent connections, and `0`
+       *                  removes the limit.
+       * @returns a reference to this `webby::config` instance to allow for chaining.
+       */
+      config& set_max_requests_per_connection(const unsigned count) {
+        this->_max_requests_per_connection = count;
+        return *this;
+      }
+
+      /**
+       * @brief Gets the maximum number of headers accepted in a request.
+       * @returns the current maximum.
+       */
+      std::size_t max_header_count() const {
+        return this->_max_header_count;
+      }
+
+      /**
+       * @brief Sets the maximum number of headers accepted in a request.
+       * @param[in] count Maximum number of headers. Requests with more headers are answered with
+       *                  `431 Request Header Fields Too Large`.
+       * @returns a reference to this `webby::config` instance to allow for chaining.
+       */
+      config& set_max_header_count(const std::size_t count) {
+        this->_max_header_count = count;
+        return *this;
+      }
+
+      /**
+       * @brief Gets the maximum size of the request line and headers.
+       * @returns the current maximum, in bytes.
+       */
+      std::size_t max_header_size() const {
+        return this->_max_header_size;
+      }
+
+      /**
+       * @brief Sets the maximum size of the request line and headers.
+       * @param[in] size Maximum size in bytes. Larger requests are answered with
+       *                 `431 Request Header Fields Too Large`.
+       * @returns a reference to this `webby::config` instance to allow for chaining.
+       */
+      config& set_max_header_size(const std::size_t size) {
+        this->_max_header_size = size;
+        return *this;
+      }
+
+      /**
+       * @brief Gets the maximum size of a request body.
+       * @returns the current maximum, in bytes, or `0` if there is no limit.
+       */
+      std::size_t max_body_size() const {
+        return this->_max_body_size;
+      }
+
+      /**
+       * @brief Sets the maximum size of a request body.
+       * @param[in] size Maximum size in bytes, or `0` for no limit. Larger bodies are answered with
+       *                 `413 Request Entity Too Large` and the connection is closed.
+       * @returns a reference to this `webby::config` instance to allow for chaining.
+       *
+       * With `webby::engine::BLOCKING` the body is read as the handler asks for it. With
+       * `webby::engine::EPOLL` the whole body is buffered before the handler runs, so each
+       * connection may hold up to this many bytes, and there must be a limit; the server refuses
+       * to start with `0`.
+       */
+      config& set_max_body_size(const std::size_t size) {
+        this->_max_body_size = size;
+        return *this;
+      }
+
+      /**
+       * @brief Gets the amount of response output that is buffered before it is sent.
+       * @returns the current size, in bytes.
+       */
+      std::size_t response_buffer_size() const {
+        return this->_response_buffer_size;
+      }
+
+      /**
+       * @brief Sets the amount of response output that is buffered before it is sent.
+       * @param[in] size Size in bytes. The headers and small body blocks are gathered until this
+       *                 much output is pending or the response is finished, so that a small
+       *                 response is sent with a single system call.
+       * @returns a reference to this `webby::config` instance to allow for chaining.
+       */
+      config& set_response_buffer_size(const std::size_t size) {
+        this->_response_buffer_size = size;
+        return *this;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether dynamic responses are compressed.
+       * @returns `true` if compression is enabled.
+       */
+      bool compression() const {
+        return this->_compression;
+      }
+
+      /**
+       * @brief Enables or disables gzip compression of dynamic responses.
+       * @param[in] enabled `true` to compress responses for clients that accept gzip.
+       * @returns a reference to this `webby::config` instance to allow for chaining.
+       *
+       * Compression is only available when webby is built with zlib (`WEBBY_HAVE_ZLIB`). Bodies
+       * sent with webby::response::send_file() are never compressed.
+       */
+      config& set_compression(const bool enabled) {
+        this->_compression = enabled;
+        return *this;
+      }
+
+      /**
+       * @brief Gets the zlib compression level.
+       * @returns the current compression level.
+       */
+      int compression_level() const {
+        return this->_compression_level;
+      }
+
+      /**
+       * @brief Sets the zlib compression level.
+       * @param[in] level Level from `1` (fastest) to `9` (smallest), or `-1` for zlib's default.
+       * @returns a reference to this `webby::config` instance to allow for chaining.
+       */
+      config& set_compression_level(const int level) {
+        this->_compression_level = level;
+        return *this;
+      }
+
+      /**
+       * @brief Gets the smallest `Content-Length` that is compressed.
+       * @returns the current minimum size, in bytes.
+       */
+      std::size_t compression_min_size() const {
+        return this->_compression_min_size;
+      }
+
+      /**
+       * @brief Sets the smallest `Content-Length` that is compressed.
+       * @param[in] size Minimum size in bytes. Streamed responses of unknown length are always
+       *                 compressed.
+       * @returns a reference to this `webby::config` instance to allow for chaining.
+       */
+      config& set_compression_min_size(const std::size_t size) {
+        this->_compression_min_size = size;
+        return *this;
+      }
+
+      /**
+       * @brief Gets the media types that are compressed.
+       * @returns the current list of media types.
+       */
+      const std::vector<std::string>& compression_types() const {
+        return this->_compression_types;
+      }
+
+      /**
+       * @brief Sets the media types that are compressed.
+       * @param[in] types Media types, e.g. `application/json`, compared with the `Content-Type`
+       *                  of the response without its parameters.
+       * @returns a reference to this `webby::config` instance to allow for chaining.
+       */
+      config& set_compression_types(const std::vector<std::string>& types) {
+        this->_compression_types = types;
+        return *this;
+      }
+
       /**
        * @brief Gets the access log.
        * @returns a reference to the access log.
@@ -80,6 +556,72 @@ namespace webby {
         return *this;
       }
 
+      /**
+       * @brief Gets a value that indicates whether an access log has been set.
+       * @returns `true` if requests are written to the access log.
+       */
+      bool has_access_log() const {
+        return this->_access_log != nullptr;
+      }
+
+      /**
+       * @brief Gets the number of access log records that can wait to be written.
+       * @returns the current capacity.
+       */
+      std::size_t access_log_capacity() const {
+        return this->_access_log_capacity;
+      }
+
+      /**
+       * @brief Sets the number of access log records that can wait to be written.
+       * @param[in] capacity Number of records, rounded up to a power of two. Records that arrive
+       *                     while the buffer is full are dropped and counted.
+       * @returns a reference to this `webby::config` instance to allow for chaining.
+       */
+      config& set_access_log_capacity(const std::size_t capacity) {
+        this->_access_log_capacity = capacity;
+        return *this;
+      }
+
+      /**
+       * @brief Gets how often buffered access log records are written.
+       * @returns the current flush interval.
+       */
+      std::chrono::milliseconds access_log_flush_interval() const {
+        return this->_access_log_flush_interval;
+      }
+
+      /**
+       * @brief Sets how often buffered access log records are written.
+       * @param[in] interval Time between batches.
+       * @returns a reference to this `webby::config` instance to allow for chaining.
+       */
+      config& set_access_log_flush_interval(const std::chrono::milliseconds interval) {
+        this->_access_log_flush_interval = interval;
+        return *this;
+      }
+
+      /**
+       * @brief Gets the lowest severity written to the error log.
+       * @returns the current log level.
+       */
+      webby::log_level log_level() const {
+        return this->_log_level;
+      }
+
+      /**
+       * @brief Sets the lowest severity written to the error log.
+       * @param[in] level The new log level.
+       * @returns a reference to this `webby::config` instance to allow for chaining.
+       *
+       * Statements below this level cost a single comparison. Statements below the
+       * `WEBBY_LOG_LEVEL` compile-time level are removed entirely, regardless of this setting.
+       */
+      config& set_log_level(const webby::log_level level) {
+        this->_log_level = level;
+        return *this;
+      }
+
       /**
        * @brief Gets the error log.
        * @returns a reference to the error log.
@@ -98,6 +640,26 @@ namespace webby {
         return *this;
       }
 
+      /**
+       * @brief Gets the statistics that the server records.
+       * @returns the statistics, or `nullptr` if none are recorded.
+       */
+      webby::metrics* metrics() const {
+        return this->_metrics;
+      }
+
+      /**
+       * @brief Sets where the server records its statistics.
+       * @param[in] metrics The statistics. They must outlive the server.
+       * @returns a reference to this `webby::config` instance to allow for chaining.
+       *
+       * Mount a webby::metrics_handler on the same instance to publish them.
+       */
+      config& set_metrics(webby::metrics& metrics) {
+        this->_metrics = &metrics;
+        return *this;
+      }
+
     private:
       /// Hostname or IPv4 address the server listens on. Defaults to `localhost`.
       std::string _address;
@@ -105,10 +667,94 @@ namespace webby {
       /// Port the server listens on. Defaults to `80`.
       unsigned short _port;
 
+      /// Engine that services connections. Defaults to `webby::engine::BLOCKING`.
+      webby::engine _engine = webby::engine::BLOCKING;
+
+      /// Number of worker threads. Defaults to `0`, which handles connections on the accept thread.
+      unsigned _worker_threads = 0;
+
+      /// `true` to give each worker thread its own `SO_REUSEPORT` listener. Defaults to `false`.
+      bool _reuse_port = false;
+
+      /// CPUs that the worker threads are pinned to. Defaults to none.
+      std::vector<unsigned> _cpu_affinity;
+
+      /// Capacity of the accepted connection queue. Defaults to `64`.
+      std::size_t _queue_capacity = 64;
+
+      /// Time to wait for the next request on a persistent connection. Defaults to 5 seconds.
+      std::chrono::milliseconds _idle_timeout = std::chrono::milliseconds(5000);
+
+      /// Time allowed for the request line and headers. Defaults to 10 seconds.
+      std::chrono::milliseconds _header_timeout = std::chrono::milliseconds(10000);
+
+      /// Longest wait for the next part of a request body. Defaults to 30 seconds.
+      std::chrono::milliseconds _body_timeout = std::chrono::milliseconds(30000);
+
+      /// Longest wait for a client to accept more of a response. Defaults to 30 seconds.
+      std::chrono::milliseconds _write_timeout = std::chrono::milliseconds(30000);
+
+      /// Slowest transfer rate in bytes per second. Defaults to `240`.
+      std::size_t _min_data_rate = 240;
+
+      /// Time a transfer may take before the minimum rate applies. Defaults to 5 seconds.
+      std::chrono::milliseconds _min_data_rate_grace = std::chrono::milliseconds(5000);
+
+      /// Time allowed to complete a deferred response. Defaults to 30 seconds.
+      std::chrono::milliseconds _deferred_timeout = std::chrono::milliseconds(30000);
+
+      /// Time a stopping server waits for requests in progress. Defaults to 30 seconds.
+      std::chrono::milliseconds _drain_timeout = std::chrono::milliseconds(30000);
+
+      /// Unix socket used to hand over the listening sockets. Defaults to none.
+      std::string _handoff_path;
+
+      /// Maximum number of requests served over a single connection. Defaults to `100`.
+      unsigned _max_requests_per_connection = 100;
+
+      /// Maximum number of headers in a request. Defaults to `100`.
+      std::size_t _max_header_count = 100;
+
+      /// Maximum size of the request line and headers. Defaults to 8 KiB.
+      std::size_t _max_header_size = 8192;
+
+      /// Maximum size of a request body. Defaults to 1 MiB.
+      std::size_t _max_body_size = 1048576;
+
+      /// Response output buffered before it is sent. Defaults to 16 KiB.
+      std::size_t _response_buffer_size = 16384;
+
+      /// `true` to compress dynamic responses. Defaults to `false`.
+      bool _compression = false;
+
+      /// zlib compression level. Defaults to `-1`, zlib's default level.
+      int _compression_level = -1;
+
+      /// Smallest `Content-Length` that is compressed. Defaults to 1 KiB.
+      std::size_t _compression_min_size = 1024;
+
+      /// Media types that are compressed. Defaults to common text formats.
+      std::vector<std::string> _compression_types = {
+        "text/html", "text/plain", "text/css", "text/csv", "application/json",
+        "application/javascript", "application/xml", "image/svg+xml"
+      };
+
       /// Access log location.
       std::unique_ptr<qlog::logger> _access_log;
 
+      /// Number of access log records that can wait to be written. Defaults to `4096`.
+      std::size_t _access_log_capacity = 4096;
+
+      /// Time between access log batches. Defaults to 1 second.
+      std::chrono::milliseconds _access_log_flush_interval = std::chrono::milliseconds(1000);
+
+      /// Lowest severity written to the error log. Defaults to `webby::log_level::INFO`.
+      webby::log_level _log_level = webby::log_level::INFO;
+
       /// Error log location.
       std::unique_ptr<qlog::logger> _error_log;
+
+      /// Statistics recorded by the server. Defaults to `nullptr`, which records none.
+      webby::metrics* _metrics = nullptr;
   };
 }
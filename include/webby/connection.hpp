@@ -0,0 +1,816 @@
+/**
+ * @file connection.hpp
+ */
+#pragma once
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <webby/arena.hpp>
+#include <webby/config.hpp>
+#include <webby/parser.hpp>
+#include <webby/slice.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Byte stream between the server and a connected host.
+   *
+   * webby::request and webby::response only talk to the connected host through this interface so
+   * that they can be driven either by a blocking socket or by one of the buffered non-blocking
+   * connections owned by an event loop.
+   *
+   * Input is read into a buffer that belongs to the connection and lives as long as it does. The
+   * request line and headers are parsed in place by a webby::request_parser, and the bytes of a
+   * pipelined request that follow the current one stay in the buffer until it is finished.
+   *
+   * Each connection also owns a webby::arena for the short-lived allocations made while serving a
+   * request, which is reset when the request is finished.
+   */
+  class connection {
+    public:
+      /**
+       * @brief Constructs the connection.
+       * @param[in] config Server configuration.
+       */
+      explicit connection(const webby::config& config)
+          : _parser(config.max_header_count(), config.max_header_size(), config.max_body_size()),
+            _size(0), _capacity(0), _read_pos(0), _continue_sent(false), _error_status(0) { }
+
+      /**
+       * @brief Destructor.
+       */
+      virtual ~connection() { }
+
+      connection(const connection&) = delete;
+      connection& operator=(const connection&) = delete;
+
+      /**
+       * @brief Parses as much of the next request as has been buffered.
+       * @returns `true` once the request line and headers are complete.
+       * @throws request_parser::error if the request is invalid. The error is repeated by every
+       *         later call until the connection is closed.
+       */
+      bool parse() {
+        if(_error_status != 0) {
+          throw request_parser::error(_error_status, _error_message);
+        }
+        if(_parser.complete()) {
+          return true;
+        }
+        try {
+          if(_parser.parse(_data.get(), _size)) {
+            _read_pos = _parser.head_length();
+            return true;
+          }
+        }
+        catch(const request_parser::error& e) {
+          _error_status = e.status_code();
+          _error_message = e.what();
+          throw;
+        }
+        return false;
+      }
+
+      /**
+       * @brief Gets the parser that holds the current request.
+       */
+      const request_parser& parser() const {
+        return _parser;
+      }
+
+      /**
+       * @brief Gets the start of the input buffer that the parser's tokens refer to.
+       */
+      const char* input() const {
+        return _data.get();
+      }
+
+      /**
+       * @brief Discards the current request, leaving any pipelined bytes that follow it buffered.
+       */
+      void next() {
+        if(_read_pos > 0) {
+          memmove(_data.get(), _data.get() + _read_pos, _size - _read_pos);
+        }
+        _size -= _read_pos;
+        _read_pos = 0;
+        _parser.reset();
+        _arena.reset();
+        _retired.clear();
+        _continue_sent = false;
+      }
+
+      /**
+       * @brief Gets the arena that backs the current request and response.
+       *
+       * Everything allocated from it is released once the request is finished.
+       */
+      webby::arena& arena() {
+        return _arena;
+      }
+
+      /**
+       * @brief Reads a block of data that follows the request headers.
+       * @param[in] buffer Buffer that receives the data.
+       * @param[in] length Length of the buffer.
+       * @param[in] peek   @c false to perform a normal read, @c true to read the data without
+       *                   removing it from the input queue.
+       * @returns The number of bytes actually read.
+       */
+      unsigned read(char* buffer, const size_t length, const bool peek) {
+        // Bytes that were buffered along with the headers are returned first.
+        if(_read_pos < _size) {
+          size_t count = std::min(length, _size - _read_pos);
+          memcpy(buffer, _data.get() + _read_pos, count);
+          if(!peek) {
+            _read_pos += count;
+          }
+          return static_cast<unsigned>(count);
+        }
+        return receive(buffer, length, peek);
+      }
+
+      /**
+       * @brief Gets the buffered input that has not been read yet.
+       */
+      slice unread() const {
+        return slice(_data.get() + _read_pos, _size - _read_pos);
+      }
+
+      /**
+       * @brief Marks part of the buffered input as read.
+       * @param[in] length Number of bytes, which must not exceed the length of
+       *                   connection::unread().
+       */
+      void skip(const size_t length) {
+        _read_pos += length;
+      }
+
+      /**
+       * @brief Reads more of the request body into the buffer.
+       * @returns `false` if the connected host closed the connection.
+       *
+       * Once all of the buffered body has been read its space is reused, so the buffer does not
+       * grow with the size of the body.
+       */
+      bool fill_body() {
+        if(_read_pos == _size) {
+          _size = _read_pos = _parser.head_length();
+        }
+        const size_t size = _size;
+        return fill() && _size > size;
+      }
+
+      /**
+       * @brief Sends `100 Continue` if the client is waiting for it before it sends the body.
+       *
+       * Nothing is sent if part of the body has already arrived, or if the response has already
+       * been sent once for this request.
+       */
+      void send_continue() {
+        if(!_continue_sent && _read_pos == _size && _parser.expects_continue() &&
+           _parser.version().resolve(_data.get()) == "1.1") {
+          write("HTTP/1.1 100 Continue\r\n\r\n", 25);
+        }
+        _continue_sent = true;
+      }
+
+      /**
+       * @brief Reads more input into the buffer.
+       * @returns `false` if no more input is available.
+       */
+      virtual bool fill() = 0;
+
+      /**
+       * @brief Writes a block of data.
+       * @param[in] data Data to write.
+       * @param[in] length Length of the data.
+       */
+      virtual void write(const void* data, const size_t length) = 0;
+
+      /**
+       * @brief Writes several blocks of data, in order.
+       * @param[in,out] iov Blocks to write. The entries are updated as they are written.
+       * @param[in] count Number of blocks.
+       * @param[in] more `true` if the caller is about to write more, so that the connection may
+       *                 hold back a partially filled packet.
+       *
+       * The default implementation passes each block to connection::write(). Connections backed
+       * by a socket override it to gather the blocks into a single system call.
+       */
+      virtual void writev(struct iovec* iov, const int count, const bool more) {
+        (void)more;
+        for(int i = 0; i < count; ++i) {
+          write(iov[i].iov_base, iov[i].iov_len);
+        }
+      }
+
+      /**
+       * @brief Writes a range of a file.
+       * @param[in] fd Descriptor of the file. It remains owned by the caller, and is not used
+       *               once this function returns.
+       * @param[in] offset Offset of the first byte to send.
+       * @param[in] length Number of bytes to send.
+       *
+       * The default implementation reads the file into a buffer and passes it to
+       * connection::write(). Connections backed by a socket override it to let the kernel copy
+       * the file straight into the socket.
+       */
+      virtual void send_file(const int fd, off_t offset, size_t length) {
+        char buffer[16384];
+        while(length > 0) {
+          ssize_t count = ::pread(fd, buffer, std::min(length, sizeof(buffer)), offset);
+          if(count < 0) {
+            if(errno == EINTR) {
+              continue;
+            }
+            throw std::system_error(errno, std::system_category(), "pread");
+          }
+          if(count == 0) {
+            throw std::system_error(EIO, std::system_category(), "File is shorter than expected");
+          }
+          write(buffer, static_cast<size_t>(count));
+          offset += count;
+          length -= static_cast<size_t>(count);
+        }
+      }
+
+      /**
+       * @brief Gets the IP address of the connected host.
+       */
+      virtual const std::string& client_ip() const = 0;
+
+      /**
+       * @brief Parks the connection while the response to the current request is deferred.
+       * @param[in] resume Called on the thread that owns the connection, with `true` once the
+       *                   response is complete or webby::config::deferred_timeout() has run out,
+       *                   or with `false` if the connection is closed first. In the first case it
+       *                   finishes the response, and returns `true` if the connection can be used
+       *                   for another request.
+       * @returns Function that any thread calls once the response is complete, or an empty
+       *          function if the connection cannot be parked. The caller then waits for the
+       *          response itself, and @p resume is never called.
+       *
+       * Only connections owned by an event loop can be parked; see webby::deferred.
+       */
+      virtual std::function<void()> park(std::function<bool(bool)> resume) {
+        (void)resume;
+        return std::function<void()>();
+      }
+
+    protected:
+      /**
+       * @brief Reads directly from the connected host once the buffered input has been consumed.
+       * @param[in] buffer Buffer that receives the data.
+       * @param[in] length Length of the buffer.
+       * @param[in] peek `true` to leave the data in the input queue.
+       * @returns The number of bytes actually read.
+       */
+      virtual unsigned receive(char* buffer, const size_t length, const bool peek) = 0;
+
+      /**
+       * @brief Makes room at the end of the input buffer.
+       * @param[in] length Number of bytes that are about to be received.
+       * @returns Pointer to the free space.
+       *
+       * Once the request line and headers have been parsed, the handler may hold slices of them,
+       * so a buffer that is outgrown while the body is read is kept until the request is
+       * finished rather than freed.
+       */
+      char* prepare(const size_t length) {
+        if(_capacity - _size < length) {
+          size_t capacity = std::max(_capacity * 2, _size + length);
+          std::unique_ptr<char[]> data(new char[capacity]);
+          if(_size > 0) {
+            memcpy(data.get(), _data.get(), _size);
+          }
+          if(_parser.complete()) {
+            _retired.push_back(std::move(_data));
+          }
+          _data = std::move(data);
+          _capacity = capacity;
+        }
+        return _data.get() + _size;
+      }
+
+      /**
+       * @brief Adds bytes that were received into the space returned by connection::prepare().
+       * @param[in] length Number of bytes received.
+       */
+      void commit(const size_t length) {
+        _size += length;
+      }
+
+      /**
+       * @brief Records an error in the current request, which connection::parse() reports from
+       *        then on.
+       */
+      void fail(const request_parser::error& e) {
+        _error_status = e.status_code();
+        _error_message = e.what();
+      }
+
+      /**
+       * @brief Gets the number of buffered bytes.
+       */
+      size_t buffered() const {
+        return _size;
+      }
+
+    private:
+      /**
+       * @brief Parser for the current request.
+       */
+      request_parser _parser;
+
+      /**
+       * @brief Input buffer.
+       */
+      std::unique_ptr<char[]> _data;
+
+      /**
+       * @brief Input buffers that were outgrown while the current request was being read, and
+       *        that slices of its head may still point into.
+       */
+      std::vector<std::unique_ptr<char[]>> _retired;
+
+      /**
+       * @brief Number of bytes in the input buffer.
+       */
+      size_t _size;
+
+      /**
+       * @brief Capacity of the input buffer.
+       */
+      size_t _capacity;
+
+      /**
+       * @brief Offset of the next byte returned by connection::read().
+       */
+      size_t _read_pos;
+
+      /**
+       * @brief `true` once connection::send_continue() has been called for the current request.
+       */
+      bool _continue_sent;
+
+      /**
+       * @brief Memory for the current request and response.
+       */
+      webby::arena _arena;
+
+      /**
+       * @brief Status code of the response to a request that could not be parsed, or `0`.
+       */
+      unsigned short _error_status;
+
+      /**
+       * @brief Reason that the request could not be parsed.
+       */
+      std::string _error_message;
+  };
+
+  /**
+   * @brief Connection that blocks the calling thread until each read or write is done.
+   *
+   * The socket itself is non-blocking, and the connection waits for it with `poll()` only when it
+   * is not ready, so that each wait can be limited by the time the client has left:
+   * webby::config::header_timeout() for the request line and headers,
+   * webby::config::body_timeout() and webby::config::min_data_rate() for the body, and
+   * webby::config::write_timeout() and webby::config::min_data_rate() for the response. A read
+   * that runs out of time throws a `request_parser::error` with status `408`, and a write throws
+   * a `std::system_error` with `ETIMEDOUT`.
+   */
+  class socket_connection : public connection {
+    public:
+      /**
+       * @brief Constructs the connection.
+       * @param[in] config Server configuration.
+       * @param[in] fd Non-blocking socket descriptor. The connection takes ownership of it.
+       * @param[in] client_ip IP address of the connected host.
+       */
+      socket_connection(const webby::config& config, int fd, const std::string& client_ip)
+          : connection(config), _config(config), _fd(fd), _client_ip(client_ip),
+            _request_start(clock::now()), _read_bytes(0), _read_waited(0), _write_bytes(0),
+            _write_waited(0) { }
+
+      /**
+       * @brief Closes the socket.
+       */
+      ~socket_connection() {
+        ::close(_fd);
+      }
+
+      /**
+       * @brief Blocks until more input has been read into the buffer.
+       * @returns `false` if the connected host closed the connection.
+       */
+      bool fill() override {
+        char* buffer = prepare(4096);
+        const unsigned count = receive(buffer, 4096, false);
+        commit(count);
+        return count > 0;
+      }
+
+      void write(const void* data, const size_t length) override {
+        const char* first = static_cast<const char*>(data);
+        const char* last = first + length;
+        while(first < last) {
+          ssize_t count = ::send(_fd, first, static_cast<size_t>(last - first), MSG_NOSIGNAL);
+          if(count < 0) {
+            if(errno == EINTR) {
+              continue;
+            }
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+              await(POLLOUT);
+              continue;
+            }
+            throw std::system_error(errno, std::system_category(), "send");
+          }
+          first += count;
+          _write_bytes += static_cast<size_t>(count);
+        }
+      }
+
+      /**
+       * @brief Sends all of the blocks with as few calls to `sendmsg(2)` as possible.
+       *
+       * If @p more is set, the data is sent with `MSG_MORE` so that a short header block and the
+       * body that follows it can share a packet.
+       */
+      void writev(struct iovec* iov, int count, const bool more) override {
+        const int flags = MSG_NOSIGNAL | (more ? MSG_MORE : 0);
+        while(count > 0) {
+          struct msghdr message;
+          memset(&message, 0, sizeof(message));
+          message.msg_iov = iov;
+          message.msg_iovlen = static_cast<decltype(message.msg_iovlen)>(count);
+          ssize_t sent = ::sendmsg(_fd, &message, flags);
+          if(sent < 0) {
+            if(errno == EINTR) {
+              continue;
+            }
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+              await(POLLOUT);
+              continue;
+            }
+            throw std::system_error(errno, std::system_category(), "sendmsg");
+          }
+          _write_bytes += static_cast<size_t>(sent);
+
+          // Skips the blocks that were sent completely, and the sent part of the next one.
+          size_t remaining = static_cast<size_t>(sent);
+          while(count > 0 && remaining >= iov->iov_len) {
+            remaining -= iov->iov_len;
+            ++iov;
+            --count;
+          }
+          if(count > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + remaining;
+            iov->iov_len -= remaining;
+          }
+        }
+      }
+
+      /**
+       * @brief Sends a range of a file with `sendfile(2)`, which copies it from the page cache to
+       *        the socket without passing through user space.
+       *
+       * Falls back to connection::send_file() for files that `sendfile(2)` does not support.
+       */
+      void send_file(const int fd, off_t offset, size_t length) override {
+        while(length > 0) {
+          ssize_t count = ::sendfile(_fd, fd, &offset, length);
+          if(count < 0) {
+            if(errno == EINTR) {
+              continue;
+            }
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+              await(POLLOUT);
+              continue;
+            }
+            if(errno == EINVAL || errno == ENOSYS) {
+              connection::send_file(fd, offset, length);
+              return;
+            }
+            throw std::system_error(errno, std::system_category(), "sendfile");
+          }
+          if(count == 0) {
+            throw std::system_error(EIO, std::system_category(), "File is shorter than expected");
+          }
+          length -= static_cast<size_t>(count);
+          _write_bytes += static_cast<size_t>(count);
+        }
+      }
+
+      const std::string& client_ip() const override {
+        return _client_ip;
+      }
+
+      /**
+       * @brief Waits for the connected host to send the next request.
+       *
+       * The time allowed for the request's headers starts once this returns `true`.
+       * @param[in] timeout Maximum time to wait, or zero for no limit.
+       * @param[in] wake_fd Descriptor that ends the wait early when it becomes readable, or `-1`.
+       * @returns `true` if data is available; `false` if the timeout expired, @p wake_fd became
+       *          readable while no data was available, or the connected host closed the
+       *          connection.
+       */
+      bool wait(const std::chrono::milliseconds timeout, const int wake_fd = -1) {
+        if(buffered() > 0) {
+          start_request();
+          return true;
+        }
+        struct pollfd pfd[2];
+        pfd[0].fd = _fd;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = wake_fd;
+        pfd[1].events = POLLIN;
+        pfd[0].revents = pfd[1].revents = 0;
+        int result;
+        do {
+          result = ::poll(pfd, wake_fd < 0 ? 1 : 2,
+                          timeout.count() > 0 ? static_cast<int>(timeout.count()) : -1);
+        } while(result < 0 && errno == EINTR);
+        if(result <= 0 || pfd[0].revents == 0) {
+          return false;
+        }
+        start_request();
+        return fill();
+      }
+
+      /**
+       * @brief Shuts the socket down, so that a thread blocked reading from or writing to it
+       *        returns. The descriptor stays open until the connection is destroyed.
+       */
+      void shutdown() {
+        ::shutdown(_fd, SHUT_RDWR);
+      }
+
+    protected:
+      unsigned receive(char* buffer, const size_t length, const bool peek) override {
+        while(1) {
+          ssize_t count = ::recv(_fd, buffer, length, peek ? MSG_PEEK : 0);
+          if(count >= 0) {
+            if(!peek && parser().complete()) {
+              _read_bytes += static_cast<size_t>(count);
+            }
+            return static_cast<unsigned>(count);
+          }
+          if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            await(POLLIN);
+          }
+          else if(errno != EINTR) {
+            throw std::system_error(errno, std::system_category(), "recv");
+          }
+        }
+      }
+
+    private:
+      /**
+       * @brief Clock that the timeouts are measured with.
+       */
+      typedef std::chrono::steady_clock clock;
+
+      /**
+       * @brief Starts the clocks of a new request and its response.
+       */
+      void start_request() {
+        _request_start = clock::now();
+        _read_bytes = _write_bytes = 0;
+        _read_waited = _write_waited = clock::duration(0);
+      }
+
+      /**
+       * @brief Waits until the socket is ready for a read or a write, for no longer than the
+       *        client has left.
+       * @param[in] events `POLLIN` or `POLLOUT`.
+       * @throws request_parser::error with status `408` if a read runs out of time.
+       * @throws std::system_error with `ETIMEDOUT` if a write runs out of time.
+       */
+      void await(const short events) {
+        const bool reading = events == POLLIN;
+        const auto start = clock::now();
+        clock::duration limit = clock::duration::max();
+        if(reading && !parser().complete()) {
+          if(_config.header_timeout().count() > 0) {
+            limit = _request_start + _config.header_timeout() - start;
+          }
+        }
+        else {
+          const std::chrono::milliseconds timeout = reading ? _config.body_timeout() :
+                                                    _config.write_timeout();
+          if(timeout.count() > 0) {
+            limit = timeout;
+          }
+          if(_config.min_data_rate() > 0) {
+            // Time that the bytes transferred so far have earned, less the time already spent
+            // waiting for them.
+            const std::chrono::milliseconds earned(static_cast<std::chrono::milliseconds::rep>(
+                (reading ? _read_bytes : _write_bytes) * 1000 / _config.min_data_rate()));
+            limit = std::min(limit, std::max<clock::duration>(_config.min_data_rate_grace(),
+                                                              earned) -
+                                    (reading ? _read_waited : _write_waited));
+          }
+        }
+
+        int result = 0;
+        if(limit > clock::duration(0)) {
+          struct pollfd pfd;
+          pfd.fd = _fd;
+          pfd.events = events;
+          pfd.revents = 0;
+          const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(limit).count();
+          const int timeout = limit == clock::duration::max() ? -1 :
+              static_cast<int>(std::min<decltype(ms)>(ms + 1, std::numeric_limits<int>::max()));
+          do {
+            result = ::poll(&pfd, 1, timeout);
+          } while(result < 0 && errno == EINTR);
+          (reading ? _read_waited : _write_waited) += clock::now() - start;
+        }
+        if(result != 0) {
+          return;
+        }
+
+        if(_config.metrics() != nullptr) {
+          _config.metrics()->connection_timed_out();
+        }
+        if(reading) {
+          throw request_parser::error(408, "Timed out reading the request from " + _client_ip);
+        }
+        throw std::system_error(ETIMEDOUT, std::system_category(),
+                                "Timed out sending the response to " + _client_ip);
+      }
+
+      /**
+       * @brief Server configuration.
+       */
+      const webby::config& _config;
+
+      /**
+       * @brief Socket descriptor.
+       */
+      const int _fd;
+
+      /**
+       * @brief IP address of the connected host.
+       */
+      const std::string _client_ip;
+
+      /**
+       * @brief Time at which the current request started to arrive.
+       */
+      clock::time_point _request_start;
+
+      /**
+       * @brief Number of bytes of the current request's body received from the socket.
+       */
+      size_t _read_bytes;
+
+      /**
+       * @brief Time spent waiting for the current request's body.
+       */
+      clock::duration _read_waited;
+
+      /**
+       * @brief Number of bytes of the current response sent.
+       */
+      size_t _write_bytes;
+
+      /**
+       * @brief Time spent waiting for the client to accept the current response.
+       */
+      clock::duration _write_waited;
+  };
+
+  /**
+   * @brief Connection to an in-memory host.
+   *
+   * Input is queued with memory_connection::feed() and output is collected in a string, so a
+   * webby::request and webby::response can be driven through the parser, router and handlers
+   * without a socket, e.g. by tests and microbenchmarks.
+   *
+   *     webby::memory_connection conn(config);
+   *     conn.feed("GET / HTTP/1.1\r\nHost: localhost\r\n\r\n");
+   *     while(!conn.parse() && conn.fill()) { }
+   *     {
+   *       webby::request req(config, conn);
+   *       webby::response res(config, conn);
+   *       router.dispatch(req, res);
+   *     }
+   *     conn.next();
+   */
+  class memory_connection : public connection {
+    public:
+      /**
+       * @brief Constructs the connection.
+       * @param[in] config Server configuration.
+       * @param[in] client_ip IP address reported for the connected host.
+       */
+      explicit memory_connection(const webby::config& config,
+                                 const std::string& client_ip = "127.0.0.1")
+          : connection(config), _client_ip(client_ip), _input_pos(0) { }
+
+      /**
+       * @brief Queues input from the connected host.
+       * @param[in] data Data to queue.
+       */
+      void feed(const slice& data) {
+        if(_input_pos == _input.length()) {
+          _input.clear();
+          _input_pos = 0;
+        }
+        _input.append(data.data(), data.length());
+      }
+
+      /**
+       * @brief Moves all of the queued input into the buffer.
+       * @returns `false` if no input was queued.
+       */
+      bool fill() override {
+        const size_t length = _input.length() - _input_pos;
+        if(length == 0) {
+          return false;
+        }
+        memcpy(prepare(length), _input.data() + _input_pos, length);
+        commit(length);
+        _input_pos += length;
+        return true;
+      }
+
+      void write(const void* data, const size_t length) override {
+        _output.append(static_cast<const char*>(data), length);
+      }
+
+      const std::string& client_ip() const override {
+        return _client_ip;
+      }
+
+      /**
+       * @brief Gets everything that has been written to the connected host.
+       */
+      const std::string& output() const {
+        return _output;
+      }
+
+      /**
+       * @brief Discards the output that has been collected so far.
+       */
+      void clear_output() {
+        _output.clear();
+      }
+
+    protected:
+      unsigned receive(char* buffer, const size_t length, const bool peek) override {
+        const size_t count = std::min(length, _input.length() - _input_pos);
+        if(count > 0) {
+          memcpy(buffer, _input.data() + _input_pos, count);
+        }
+        if(!peek) {
+          _input_pos += count;
+        }
+        return static_cast<unsigned>(count);
+      }
+
+    private:
+      /**
+       * @brief IP address reported for the connected host.
+       */
+      const std::string _client_ip;
+
+      /**
+       * @brief Input that has not been moved into the buffer yet.
+       */
+      std::string _input;
+
+      /**
+       * @brief Offset of the first byte of webby::memory_connection::_input that is still queued.
+       */
+      size_t _input_pos;
+
+      /**
+       * @brief Output written to the connected host.
+       */
+      std::string _output;
+  };
+}
@@ -0,0 +1,104 @@
+/**
+ * @file date_cache.hpp
+ */
+#pragma once
+
+#include <time.h>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief The current time formatted as an HTTP date, shared by all threads.
+   *
+   * The date only changes once per second, so it is formatted by whichever thread first notices
+   * that the second has changed, and every other response copies the formatted bytes. Each new
+   * date is written to the next of several slots before it is published, so a reader never sees a
+   * slot while it is being rewritten unless it stalls for longer than the number of slots in
+   * seconds.
+   */
+  class date_cache {
+    public:
+      /**
+       * @brief Length of a formatted date, e.g. "Sun, 06 Nov 1994 08:49:37 GMT".
+       */
+      static const std::size_t length = 29;
+
+      /**
+       * @brief Gets the current date.
+       * @returns The formatted date, webby::date_cache::length characters long. It remains valid
+       *          for at least a few seconds.
+       */
+      static const char* now() {
+        static date_cache cache;
+        return cache.get();
+      }
+
+      date_cache(const date_cache&) = delete;
+      date_cache& operator=(const date_cache&) = delete;
+
+    private:
+      /**
+       * @brief Number of dates kept.
+       */
+      static const unsigned slots = 16;
+
+      /**
+       * @brief Formats the current date.
+       */
+      date_cache() : _second(0), _slot(0) {
+        refresh(time(nullptr));
+      }
+
+      /**
+       * @brief Gets the current date, formatting it first if the second has changed.
+       */
+      const char* get() {
+        const time_t t = time(nullptr);
+        if(t != _second.load(std::memory_order_acquire)) {
+          // Only one thread formats the new date; the others carry on with the previous one.
+          std::unique_lock<std::mutex> lock(_mutex, std::try_to_lock);
+          if(lock.owns_lock() && t != _second.load(std::memory_order_relaxed)) {
+            refresh(t);
+          }
+        }
+        return _dates[_slot.load(std::memory_order_acquire)];
+      }
+
+      /**
+       * @brief Formats a date into the next slot and publishes it. The lock must be held.
+       */
+      void refresh(const time_t t) {
+        const unsigned next = (_slot.load(std::memory_order_relaxed) + 1) % slots;
+        struct tm tm;
+        gmtime_r(&t, &tm);
+        strftime(_dates[next], sizeof(_dates[next]), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        _slot.store(next, std::memory_order_release);
+        _second.store(t, std::memory_order_release);
+      }
+
+      /**
+       * @brief Second that the current date was formatted for.
+       */
+      std::atomic<time_t> _second;
+
+      /**
+       * @brief Slot that holds the current date.
+       */
+      std::atomic<unsigned> _slot;
+
+      /**
+       * @brief Formatted dates.
+       */
+      char _dates[slots][length + 1];
+
+      /**
+       * @brief Held while a new date is formatted.
+       */
+      std::mutex _mutex;
+  };
+}
@@ -0,0 +1,220 @@
+/**
+ * @file deferred.hpp
+ */
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  // Forward references.
+  class response;
+  class server;
+
+  /**
+   * @brief Handle to a response that a handler finishes after it has returned.
+   *
+   * A handler that has to wait for a database or another service calls response::defer(), hands
+   * the returned object to whatever does the waiting, and returns straight away:
+   *
+   *     void operator()(const webby::request& req, webby::response& res) {
+   *       webby::deferred done = res.defer();
+   *       const std::string id = req.param("id").str();
+   *       lookup(id, [done](const std::string& item) {
+   *         done.complete([item](webby::response& res) {
+   *           res.set_header("Content-Length", std::to_string(item.length()));
+   *           res.write_block(reinterpret_cast<const unsigned char*>(item.data()), item.length());
+   *         });
+   *       });
+   *     }
+   *
+   * The function passed to deferred::complete() fills in the response. It runs on the thread
+   * that owns the connection, so it never races with the server, and the response is sent as
+   * soon as it returns. The webby::request is gone by then, so the handler copies whatever it
+   * needs from it before it returns.
+   *
+   * With `webby::engine::EPOLL` the connection is parked until the response is complete, and the
+   * event loop goes on serving other connections. With `webby::engine::BLOCKING` the thread
+   * that serves the connection waits for it.
+   *
+   * The handle may be copied and completed from any thread; only the first completion counts. If
+   * every copy is destroyed without completing the response, the client is sent
+   * `500 Internal Server Error`. If the response is not completed within
+   * webby::config::deferred_timeout(), the client is sent `504 Gateway Timeout`.
+   */
+  class deferred {
+    public:
+      /**
+       * @brief Signature of the function that fills in the response.
+       */
+      typedef std::function<void(webby::response&)> fill_t;
+
+      /**
+       * @brief Completes the response.
+       * @param[in] fill Function that fills in the response on the thread that owns the
+       *                 connection. If it is empty, the response is sent as the handler left it.
+       */
+      void complete(fill_t fill = fill_t()) const {
+        _owner->shared->complete(std::move(fill), false);
+      }
+
+    private:
+      /**
+       * @brief State shared by the handles and the server.
+       */
+      class state {
+        public:
+          /**
+           * @brief Constructs the state of a response that is not complete yet.
+           */
+          state() : _completed(false), _dropped(false) { }
+
+          /**
+           * @brief Completes the response, unless it was completed already.
+           * @param[in] fill Function that fills in the response.
+           * @param[in] dropped `true` if every handle was destroyed first.
+           */
+          void complete(fill_t fill, const bool dropped) {
+            std::function<void()> notify;
+            {
+              std::lock_guard<std::mutex> lock(_mutex);
+              if(_completed) {
+                return;
+              }
+              _completed = true;
+              _dropped = dropped;
+              _fill = std::move(fill);
+              notify = _notify;
+            }
+            _ready.notify_all();
+            if(notify) {
+              notify();
+            }
+          }
+
+          /**
+           * @brief Sets the function that tells the owner of the connection that the response is
+           *        complete. It is called straight away if it already is.
+           */
+          void on_complete(std::function<void()> notify) {
+            {
+              std::lock_guard<std::mutex> lock(_mutex);
+              if(!_completed) {
+                _notify = std::move(notify);
+                return;
+              }
+            }
+            notify();
+          }
+
+          /**
+           * @brief Gives up on the response, unless it has been completed already.
+           * @returns `true` if the response had not been completed, in which case any later
+           *          completion is ignored.
+           */
+          bool expire() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if(_completed) {
+              return false;
+            }
+            _completed = true;
+            return true;
+          }
+
+          /**
+           * @brief Waits for the response to be completed.
+           * @returns `false` if the time ran out first.
+           */
+          bool wait_for(const std::chrono::milliseconds timeout) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            return _ready.wait_for(lock, timeout, [this] { return _completed; });
+          }
+
+          /**
+           * @brief Gets the function that fills in the completed response.
+           * @param[out] dropped Set to `true` if every handle was destroyed without completing
+           *                     the response.
+           */
+          fill_t take(bool& dropped) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            dropped = _dropped;
+            return std::move(_fill);
+          }
+
+        private:
+          /**
+           * @brief Guards the fields below.
+           */
+          std::mutex _mutex;
+
+          /**
+           * @brief Signalled when the response is completed.
+           */
+          std::condition_variable _ready;
+
+          /**
+           * @brief Function that fills in the response.
+           */
+          fill_t _fill;
+
+          /**
+           * @brief Tells the owner of the connection that the response is complete.
+           */
+          std::function<void()> _notify;
+
+          /**
+           * @brief `true` once the response has been completed.
+           */
+          bool _completed;
+
+          /**
+           * @brief `true` if every handle was destroyed without completing the response.
+           */
+          bool _dropped;
+      };
+
+      /**
+       * @brief Shared by the copies of a handle, and completes the response when the last of
+       *        them is destroyed.
+       */
+      struct owner {
+        ~owner() {
+          shared->complete(fill_t(), true);
+        }
+
+        /**
+         * @brief The state.
+         */
+        std::shared_ptr<state> shared;
+      };
+
+      /**
+       * @brief Constructs a handle.
+       */
+      explicit deferred(std::shared_ptr<state> shared) : _owner(std::make_shared<owner>()) {
+        _owner->shared = std::move(shared);
+      }
+
+      /**
+       * @brief Shared by the copies of this handle.
+       */
+      std::shared_ptr<owner> _owner;
+
+      /**
+       * @brief Necessary so that webby::response can create the handle.
+       */
+      friend class webby::response;
+
+      /**
+       * @brief Necessary so that webby::server can wait for the response.
+       */
+      friend class webby::server;
+  };
+}
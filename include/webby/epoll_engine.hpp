@@ -0,0 +1,1212 @@
+/**
+ * @file epoll_engine.hpp
+ */
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <webby/affinity.hpp>
+#include <webby/body_reader.hpp>
+#include <webby/config.hpp>
+#include <webby/connection.hpp>
+#include <webby/socket.hpp>
+#include <webby/timer_wheel.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Parked connections of an event loop whose deferred responses have been completed.
+   *
+   * Any thread may post to the queue. The loop waits for its `eventfd` along with its sockets,
+   * and takes everything that has been posted at once. The `eventfd` is only written when the
+   * queue stops being empty, so a burst of completions wakes the loop once.
+   */
+  class completion_queue {
+    public:
+      /**
+       * @brief Identifies a connection by its descriptor and by a number that its loop never
+       *        reuses, so that a completion that arrives after the connection has been closed is
+       *        not applied to another connection with the same descriptor.
+       */
+      typedef std::pair<int, uint64_t> entry;
+
+      /**
+       * @brief Constructs an empty queue.
+       */
+      completion_queue() : _fd(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) {
+        if(_fd < 0) {
+          throw std::system_error(errno, std::system_category(), "eventfd");
+        }
+      }
+
+      /**
+       * @brief Closes the `eventfd`.
+       */
+      ~completion_queue() {
+        ::close(_fd);
+      }
+
+      completion_queue(const completion_queue&) = delete;
+      completion_queue& operator=(const completion_queue&) = delete;
+
+      /**
+       * @brief Gets the `eventfd` that becomes readable when something has been posted.
+       */
+      int fd() const {
+        return _fd;
+      }
+
+      /**
+       * @brief Posts a connection whose deferred response has been completed.
+       * @param[in] fd Descriptor of the connection.
+       * @param[in] id Number of the connection.
+       */
+      void post(const int fd, const uint64_t id) {
+        bool wake;
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          wake = _entries.empty();
+          _entries.push_back(entry(fd, id));
+        }
+        if(wake) {
+          const uint64_t one = 1;
+          ssize_t result = ::write(_fd, &one, sizeof(one));
+          (void)result;
+        }
+      }
+
+      /**
+       * @brief Takes everything that has been posted.
+       * @param[out] entries Receives the posted connections. It must be empty.
+       */
+      void take(std::vector<entry>& entries) {
+        uint64_t count;
+        ssize_t result = ::read(_fd, &count, sizeof(count));
+        (void)result;
+        std::lock_guard<std::mutex> lock(_mutex);
+        entries.swap(_entries);
+      }
+
+    private:
+      /**
+       * @brief The `eventfd`.
+       */
+      const int _fd;
+
+      /**
+       * @brief Guards completion_queue::_entries.
+       */
+      std::mutex _mutex;
+
+      /**
+       * @brief Connections posted since the loop last took them.
+       */
+      std::vector<entry> _entries;
+  };
+
+  /**
+   * @brief Connection owned by an event loop.
+   *
+   * Incoming bytes are buffered until a complete request is available, so request parsing never
+   * blocks. Outgoing bytes are buffered and flushed as the socket becomes writable. Ranges of
+   * files are queued in order with the buffered bytes, and are sent with `sendfile(2)` once
+   * everything ahead of them has been written.
+   *
+   * The connection is also the timer that closes it when the client takes too long; see
+   * buffered_connection::deadline().
+   *
+   * While the response to a request is deferred the connection is parked: it neither reads nor
+   * times out until the response is completed and its loop resumes it.
+   */
+  class buffered_connection : public connection, public timer_wheel::timer {
+    public:
+      /**
+       * @brief Constructs the connection.
+       * @param[in] config Server configuration.
+       * @param[in] fd Non-blocking socket descriptor. The connection takes ownership of it.
+       * @param[in] client_ip IP address of the connected host.
+       * @param[in] completions Queue of the loop that owns the connection, through which its
+       *                        deferred responses are completed.
+       * @param[in] id Number that identifies the connection in @p completions.
+       */
+      buffered_connection(const webby::config& config, int fd, const std::string& client_ip,
+                          std::shared_ptr<completion_queue> completions, const uint64_t id)
+          : connection(config), _config(config), _fd(fd), _client_ip(client_ip),
+            _completions(std::move(completions)), _id(id), _probe(config.max_body_size()),
+            _probe_pos(0), _closing(false), _eof(false), _requests(0), _events(0),
+            _last_active(std::chrono::steady_clock::now()), _phase(phase::IDLE),
+            _phase_bytes(0), _received(0), _sent(0) { }
+
+      /**
+       * @brief Abandons a deferred response, and closes the socket.
+       */
+      ~buffered_connection() {
+        if(_resume) {
+          _resume(false);
+        }
+        ::close(_fd);
+      }
+
+      /**
+       * @brief Reads everything the socket has available without blocking.
+       * @returns `false` if an error occurred.
+       *
+       * Requests that were buffered before the connected host stopped sending are still
+       * processed; see buffered_connection::eof().
+       */
+      bool fill() override {
+        while(1) {
+          char* buffer = prepare(16384);
+          ssize_t count = ::recv(_fd, buffer, 16384, 0);
+          if(count > 0) {
+            commit(static_cast<size_t>(count));
+            _received += static_cast<size_t>(count);
+          }
+          else if(count == 0) {
+            _eof = true;
+            return true;
+          }
+          else if(errno == EINTR) {
+            continue;
+          }
+          else {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+          }
+        }
+      }
+
+      /**
+       * @brief Buffers a block of data to be sent once the handler returns.
+       *
+       * Once a streamed response has buffered a fair amount of output, as much of it as the
+       * socket accepts is sent straight away so that the buffer does not grow with the whole
+       * body.
+       */
+      void write(const void* data, const size_t length) override {
+        if(_output.empty() || _output.back().fd >= 0) {
+          _output.push_back(segment());
+        }
+        std::string& bytes = _output.back().bytes;
+        bytes.append(static_cast<const char*>(data), length);
+        if(bytes.length() - static_cast<size_t>(_output.back().offset) >= 65536 && !flush()) {
+          throw std::system_error(errno, std::system_category(), "send");
+        }
+      }
+
+      /**
+       * @brief Queues a range of a file to be sent once the output ahead of it has been written.
+       *
+       * The descriptor is duplicated, so the caller may close its own copy straight away.
+       */
+      void send_file(const int fd, off_t offset, size_t length) override {
+        if(length == 0) {
+          return;
+        }
+        segment file;
+        file.fd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if(file.fd < 0) {
+          throw std::system_error(errno, std::system_category(), "fcntl");
+        }
+        file.offset = offset;
+        file.length = length;
+        _output.push_back(std::move(file));
+      }
+
+      const std::string& client_ip() const override {
+        return _client_ip;
+      }
+
+      /**
+       * @brief Parks the connection until its loop takes it from the completion_queue.
+       */
+      std::function<void()> park(std::function<bool(bool)> resume) override {
+        _resume = std::move(resume);
+        std::shared_ptr<completion_queue> completions = _completions;
+        const int fd = _fd;
+        const uint64_t id = _id;
+        return [completions, fd, id] {
+          completions->post(fd, id);
+        };
+      }
+
+      /**
+       * @brief Gets a value that indicates whether the connection is waiting for a deferred
+       *        response.
+       */
+      bool parked() const {
+        return static_cast<bool>(_resume);
+      }
+
+      /**
+       * @brief Finishes the deferred response once it has been completed.
+       * @returns `true` if the connection can be used for another request.
+       *
+       * The connection is parked again if the response is deferred once more.
+       */
+      bool resume() {
+        std::function<bool(bool)> resume;
+        resume.swap(_resume);
+        return resume(true);
+      }
+
+      /**
+       * @brief Gets the socket descriptor.
+       */
+      int fd() const {
+        return _fd;
+      }
+
+      /**
+       * @brief Gets the number that identifies the connection in its loop's completion_queue.
+       */
+      uint64_t id() const {
+        return _id;
+      }
+
+      /**
+       * @brief Writes as much of the pending output as the socket accepts without blocking.
+       * @returns `false` if an error occurred.
+       */
+      bool flush() {
+        while(!_output.empty()) {
+          segment& front = _output.front();
+          ssize_t count;
+          if(front.fd < 0) {
+            // Headers that are followed by a file are held back so that they share a packet with
+            // the start of the file.
+            const int more = _output.size() > 1 && _output[1].fd >= 0 ? MSG_MORE : 0;
+            count = ::send(_fd, front.bytes.data() + front.offset,
+                           front.bytes.length() - static_cast<size_t>(front.offset),
+                           MSG_NOSIGNAL | more);
+          }
+          else {
+            count = ::sendfile(_fd, front.fd, &front.offset, front.length);
+            if(count < 0 && (errno == EINVAL || errno == ENOSYS)) {
+              count = copy_file(front);
+            }
+          }
+
+          if(count < 0) {
+            if(errno == EINTR) {
+              continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+          }
+          if(front.fd < 0) {
+            _sent += static_cast<size_t>(count);
+            front.offset += count;
+            if(static_cast<size_t>(front.offset) < front.bytes.length()) {
+              continue;
+            }
+          }
+          else if(count == 0) {
+            errno = EIO;
+            return false;
+          }
+          else {
+            _sent += static_cast<size_t>(count);
+            front.length -= static_cast<size_t>(count);
+            if(front.length > 0) {
+              continue;
+            }
+          }
+          _output.pop_front();
+        }
+        return true;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether output is waiting to be written.
+       */
+      bool pending_output() const {
+        return !_output.empty();
+      }
+
+      /**
+       * @brief Determines whether a complete request has been buffered.
+       * @returns `true` if the request line, headers, and body are all available, or if the
+       *          request is invalid and an error response should be sent.
+       */
+      bool request_ready() {
+        try {
+          if(!parse()) {
+            return false;
+          }
+          if(body_ready()) {
+            return true;
+          }
+        }
+        catch(const request_parser::error& e) {
+          fail(e);
+          return true;
+        }
+
+        // A client that waits for permission to send the body would otherwise wait in vain.
+        send_continue();
+        if(!flush()) {
+          set_closing();
+        }
+        return false;
+      }
+
+      /**
+       * @brief Discards the request last reported by buffered_connection::request_ready().
+       *
+       * Any pipelined bytes that follow the request remain buffered.
+       */
+      void consume() {
+        next();
+        ++_requests;
+        _probe = chunked_decoder(parser().max_body_size());
+        _probe_pos = 0;
+        _phase = phase::IDLE;
+      }
+
+      /**
+       * @brief Gets the number of requests that have been served over the connection.
+       */
+      unsigned requests() const {
+        return _requests;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether the connected host has stopped sending.
+       */
+      bool eof() const {
+        return _eof;
+      }
+
+      /**
+       * @brief Gets the epoll events the connection is registered for.
+       */
+      uint32_t events() const {
+        return _events;
+      }
+
+      /**
+       * @brief Records the epoll events the connection is registered for.
+       */
+      void set_events(const uint32_t events) {
+        _events = events;
+      }
+
+      /**
+       * @brief Records that the connection was just read from or written to.
+       * @param[in] now Current time.
+       */
+      void touch(const std::chrono::steady_clock::time_point now) {
+        _last_active = now;
+      }
+
+      /**
+       * @brief Gets the time by which the client must make progress, or the connection is closed.
+       * @param[in] now Current time, which starts the clock if the connection has just moved on
+       *                to another part of the exchange.
+       * @returns The deadline, or `time_point::max()` if there is none.
+       *
+       * The limit depends on what the connection is waiting for: webby::config::idle_timeout()
+       * for the next request, webby::config::header_timeout() for the rest of its headers,
+       * webby::config::body_timeout() for more of its body, and webby::config::write_timeout()
+       * for the client to accept more of the response. Bodies and responses must also keep up
+       * with webby::config::min_data_rate(). A deferred response must be completed within
+       * webby::config::deferred_timeout().
+       */
+      std::chrono::steady_clock::time_point deadline(
+          const std::chrono::steady_clock::time_point now) {
+        phase current;
+        if(_resume && _output.empty()) {
+          current = phase::DEFERRED;
+        }
+        else if(!_output.empty()) {
+          current = phase::WRITE;
+        }
+        else if(buffered() == 0) {
+          current = phase::IDLE;
+        }
+        else {
+          current = parser().complete() ? phase::BODY : phase::HEAD;
+        }
+        const size_t transferred = current == phase::WRITE ? _sent : _received;
+        if(current != _phase) {
+          _phase = current;
+          _phase_start = now;
+          _phase_bytes = transferred;
+        }
+
+        switch(current) {
+          case phase::IDLE:
+            return after(_last_active, _config.idle_timeout());
+          case phase::HEAD:
+            return after(_phase_start, _config.header_timeout());
+          case phase::BODY:
+            return std::min(after(_last_active, _config.body_timeout()),
+                            rate_deadline(transferred));
+          case phase::DEFERRED:
+            return after(_phase_start, _config.deferred_timeout());
+          default:
+            return std::min(after(_last_active, _config.write_timeout()),
+                            rate_deadline(transferred));
+        }
+      }
+
+      /**
+       * @brief Gets a value that indicates whether the connection is between requests, with no
+       *        part of a request buffered and no output waiting to be written.
+       */
+      bool idle() const {
+        return buffered() == 0 && _output.empty();
+      }
+
+      /**
+       * @brief Gets a value that indicates whether the connection closes once output is flushed.
+       */
+      bool closing() const {
+        return _closing;
+      }
+
+      /**
+       * @brief Closes the connection once all of the output has been flushed.
+       */
+      void set_closing() {
+        _closing = true;
+      }
+
+    protected:
+      /**
+       * @brief The whole body is buffered before the request is processed, so there is never
+       *        anything more to read.
+       */
+      unsigned receive(char*, const size_t, const bool) override {
+        return 0;
+      }
+
+    private:
+      /**
+       * @brief What the connection is waiting for.
+       */
+      enum class phase {
+        IDLE,
+        HEAD,
+        BODY,
+        WRITE,
+        DEFERRED
+      };
+
+      /**
+       * @brief Adds a timeout to a time.
+       * @returns The deadline, or `time_point::max()` if @p timeout is zero.
+       */
+      static std::chrono::steady_clock::time_point after(
+          const std::chrono::steady_clock::time_point start,
+          const std::chrono::milliseconds timeout) {
+        return timeout.count() > 0 ? start + timeout :
+               std::chrono::steady_clock::time_point::max();
+      }
+
+      /**
+       * @brief Gets the time by which the current transfer falls behind the minimum data rate,
+       *        unless more bytes are transferred.
+       * @param[in] transferred Number of bytes received or sent since the connection was opened.
+       */
+      std::chrono::steady_clock::time_point rate_deadline(const size_t transferred) const {
+        if(_config.min_data_rate() == 0) {
+          return std::chrono::steady_clock::time_point::max();
+        }
+        const std::chrono::milliseconds earned(static_cast<std::chrono::milliseconds::rep>(
+            (transferred - _phase_bytes) * 1000 / _config.min_data_rate()));
+        return _phase_start + std::max(_config.min_data_rate_grace(), earned);
+      }
+
+      /**
+       * @brief Determines whether the whole body of the parsed request has been buffered.
+       * @throws request_parser::error if a chunked body is invalid or too large.
+       *
+       * The framing of a chunked body is scanned as it arrives, without decoding it, so each byte
+       * is examined once however many reads it takes to arrive.
+       */
+      bool body_ready() {
+        if(!parser().chunked()) {
+          return buffered() - parser().head_length() >= parser().content_length();
+        }
+        if(_probe_pos == 0) {
+          _probe_pos = parser().head_length();
+        }
+        size_t used = 0;
+        _probe.decode(input() + _probe_pos, buffered() - _probe_pos, used, nullptr,
+                      std::numeric_limits<size_t>::max());
+        _probe_pos += used;
+        return _probe.done();
+      }
+
+      /**
+       * @brief Part of the output, either buffered bytes or a range of a file.
+       */
+      struct segment {
+        /**
+         * @brief Constructs an empty segment of buffered bytes.
+         */
+        segment() : fd(-1), offset(0), length(0) { }
+
+        /**
+         * @brief Takes ownership of the file descriptor of @p other.
+         */
+        segment(segment&& other)
+            : bytes(std::move(other.bytes)), fd(other.fd), offset(other.offset),
+              length(other.length) {
+          other.fd = -1;
+        }
+
+        /**
+         * @brief Closes the file, if this segment has one.
+         */
+        ~segment() {
+          if(fd >= 0) {
+            ::close(fd);
+          }
+        }
+
+        segment(const segment&) = delete;
+        segment& operator=(const segment&) = delete;
+
+        /**
+         * @brief Buffered bytes, when segment::fd is `-1`.
+         */
+        std::string bytes;
+
+        /**
+         * @brief Descriptor of the file, or `-1`.
+         */
+        int fd;
+
+        /**
+         * @brief Offset of the next byte to send, in segment::bytes or in the file.
+         */
+        off_t offset;
+
+        /**
+         * @brief Number of bytes of the file left to send.
+         */
+        size_t length;
+      };
+
+      /**
+       * @brief Sends part of a file that `sendfile(2)` does not support by reading it first.
+       * @param[in,out] file The file segment.
+       * @returns The number of bytes sent, or `-1` with `errno` set.
+       *
+       * Bytes that were read but not accepted by the socket are read again on the next attempt.
+       */
+      ssize_t copy_file(segment& file) {
+        char buffer[16384];
+        ssize_t count = ::pread(file.fd, buffer, std::min(file.length, sizeof(buffer)),
+                                file.offset);
+        if(count <= 0) {
+          return count;
+        }
+        count = ::send(_fd, buffer, static_cast<size_t>(count), MSG_NOSIGNAL);
+        if(count > 0) {
+          file.offset += count;
+        }
+        return count;
+      }
+
+      /**
+       * @brief Server configuration.
+       */
+      const webby::config& _config;
+
+      /**
+       * @brief Socket descriptor.
+       */
+      const int _fd;
+
+      /**
+       * @brief IP address of the connected host.
+       */
+      const std::string _client_ip;
+
+      /**
+       * @brief Queue of the loop that owns the connection.
+       */
+      const std::shared_ptr<completion_queue> _completions;
+
+      /**
+       * @brief Number that identifies the connection in buffered_connection::_completions.
+       */
+      const uint64_t _id;
+
+      /**
+       * @brief Finishes the deferred response, while the connection is parked.
+       */
+      std::function<bool(bool)> _resume;
+
+      /**
+       * @brief Output waiting to be sent, in order.
+       */
+      std::deque<segment> _output;
+
+      /**
+       * @brief Finds the end of a chunked body that is still arriving.
+       */
+      chunked_decoder _probe;
+
+      /**
+       * @brief Offset of the next byte for buffered_connection::_probe, or `0` before the body has
+       *        been reached.
+       */
+      size_t _probe_pos;
+
+      /**
+       * @brief `true` if the connection closes once its output has been flushed.
+       */
+      bool _closing;
+
+      /**
+       * @brief `true` once the connected host has stopped sending.
+       */
+      bool _eof;
+
+      /**
+       * @brief Number of requests served over the connection.
+       */
+      unsigned _requests;
+
+      /**
+       * @brief Epoll events the connection is registered for.
+       */
+      uint32_t _events;
+
+      /**
+       * @brief Time of the last read or write on the connection.
+       */
+      std::chrono::steady_clock::time_point _last_active;
+
+      /**
+       * @brief What the connection was waiting for when buffered_connection::deadline() was last
+       *        called.
+       */
+      phase _phase;
+
+      /**
+       * @brief Time at which the connection started waiting for buffered_connection::_phase.
+       */
+      std::chrono::steady_clock::time_point _phase_start;
+
+      /**
+       * @brief Bytes received or sent before buffered_connection::_phase started.
+       */
+      size_t _phase_bytes;
+
+      /**
+       * @brief Number of bytes received over the connection.
+       */
+      size_t _received;
+
+      /**
+       * @brief Number of bytes sent over the connection.
+       */
+      size_t _sent;
+  };
+
+  /**
+   * @brief Server engine that multiplexes non-blocking connections with Linux epoll.
+   *
+   * Each event loop runs on its own thread and waits for readiness events on the shared listening
+   * socket and on the connections it accepted. Requests are only parsed once they have been
+   * completely buffered, and responses are buffered and written as the socket drains, so a slow
+   * client never blocks the loop. Pipelined requests are processed in order, and the loop stops
+   * reading from a connection while it still has output waiting to be sent.
+   *
+   * Each loop keeps the deadlines of its connections in a webby::timer_wheel, and closes the
+   * connections of clients that stall or trickle their requests or stop reading their responses.
+   *
+   * A connection whose response is deferred is parked, and the loop goes on serving the others.
+   * Completed responses are posted to the loop's webby::completion_queue, and are finished on the
+   * loop's own thread.
+   */
+  class epoll_engine {
+    public:
+      /**
+       * @brief Signature of the function that processes a complete request.
+       *
+       * The second argument is `true` if this is the last request allowed on the connection. The
+       * function returns `true` if the connection can be used for another request.
+       */
+      typedef std::function<bool(connection&, bool)> handler_t;
+
+      /**
+       * @brief Constructs the engine.
+       * @param[in] config Server configuration.
+       * @param[in] handler Function that processes each buffered request.
+       * @param[in] listeners Non-blocking listening sockets: one shared by all of the event
+       *                      loops, or one for each loop.
+       * @param[in] wake_fd Descriptor that becomes readable when the engine should stop.
+       */
+      epoll_engine(const webby::config& config, handler_t handler,
+                   std::vector<std::unique_ptr<listener>> listeners, const int wake_fd)
+          : _config(config), _handler(handler), _listeners(std::move(listeners)),
+            _wake_fd(wake_fd) { }
+
+      /**
+       * @brief Runs the event loops until the engine is stopped and its connections are drained.
+       *
+       * `webby::config::worker_threads()` loops are started, with a minimum of one. The first loop
+       * runs on the calling thread.
+       *
+       * When @p wake_fd becomes readable each loop stops accepting, closes its idle connections,
+       * and answers the requests that are already buffered with `Connection: close`. The loop
+       * ends once all of its connections are closed, or when `webby::config::drain_timeout()`
+       * expires, at which point the remaining connections are closed as they are.
+       */
+      void run() {
+        std::vector<std::thread> threads;
+        for(unsigned i = 1; i < loop_count(); ++i) {
+          threads.push_back(std::thread([this, i] { loop(i); }));
+        }
+        loop(0);
+        for(auto& thread : threads) {
+          thread.join();
+        }
+      }
+
+    private:
+      /**
+       * @brief Connections owned by a single event loop, indexed by descriptor.
+       */
+      typedef std::unordered_map<int, std::unique_ptr<buffered_connection>> connection_map;
+
+      /**
+       * @brief Maximum number of events returned by a single `epoll_wait()`.
+       */
+      static const int max_events = 256;
+
+      /**
+       * @brief Length in milliseconds of a tick of the timers that close slow connections.
+       */
+      static const int timer_resolution = 100;
+
+      /**
+       * @brief Number of slots in the timer wheel, which covers about 100 seconds in one turn.
+       */
+      static const std::size_t timer_slots = 1024;
+
+      /**
+       * @brief Gets the number of event loops.
+       */
+      unsigned loop_count() const {
+        return _config.worker_threads() > 0 ? _config.worker_threads() : 1;
+      }
+
+      /**
+       * @brief Runs a single event loop.
+       * @param[in] index Index of the loop.
+       */
+      void loop(const unsigned index) {
+        pin_thread(_config, index);
+        int epoll = ::epoll_create1(EPOLL_CLOEXEC);
+        if(epoll < 0) {
+          throw std::system_error(errno, std::system_category(), "epoll_create1");
+        }
+
+        const listener& l = *_listeners[_listeners.size() > 1 ? index : 0];
+        watch(epoll, l);
+
+        // The wake descriptor is identified by the engine's address, and the completion queue by
+        // its own.
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = this;
+        ::epoll_ctl(epoll, EPOLL_CTL_ADD, _wake_fd, &ev);
+        std::shared_ptr<completion_queue> completions = std::make_shared<completion_queue>();
+        ev.data.ptr = completions.get();
+        ::epoll_ctl(epoll, EPOLL_CTL_ADD, completions->fd(), &ev);
+        uint64_t next_id = 0;
+
+        connection_map connections;
+        struct epoll_event events[max_events];
+        auto now = std::chrono::steady_clock::now();
+        timer_wheel timers(std::chrono::milliseconds(static_cast<int>(timer_resolution)),
+                           timer_slots, now);
+        bool draining = false;
+        std::chrono::steady_clock::time_point deadline;
+
+        // Puts the listening socket back after accepting has failed.
+        timer_wheel::timer backoff;
+
+        while(!draining || !connections.empty()) {
+          // Wakes up for the next tick of the timers while there are connections or the listening
+          // socket is backing off, and often enough while draining to notice the deadline.
+          int timeout = connections.empty() && !backoff.scheduled() ? -1 :
+                        static_cast<int>(timers.until_next_tick(now).count());
+          if(draining && (timeout < 0 || timeout > timer_resolution)) {
+            timeout = timer_resolution;
+          }
+          int count = ::epoll_wait(epoll, events, max_events, timeout);
+          if(count < 0) {
+            if(errno == EINTR) {
+              continue;
+            }
+            ::close(epoll);
+            throw std::system_error(errno, std::system_category(), "epoll_wait");
+          }
+          now = std::chrono::steady_clock::now();
+
+          // Connections are only closed in the batch while handling their own events, since a
+          // connection that is closed for another reason may still have an event further on.
+          bool stopped = false;
+          bool completed = false;
+          for(int i = 0; i < count; ++i) {
+            if(events[i].data.ptr == nullptr) {
+              accept(epoll, l, connections, timers, backoff, completions, next_id, now);
+              continue;
+            }
+            if(events[i].data.ptr == completions.get()) {
+              completed = true;
+              continue;
+            }
+            if(events[i].data.ptr == this) {
+              // Stops accepting. The wake descriptor stays readable, so it is removed too.
+              ::epoll_ctl(epoll, EPOLL_CTL_DEL, l.fd(), nullptr);
+              ::epoll_ctl(epoll, EPOLL_CTL_DEL, _wake_fd, nullptr);
+              draining = true;
+              stopped = true;
+              deadline = now + _config.drain_timeout();
+              continue;
+            }
+
+            buffered_connection& conn = *static_cast<buffered_connection*>(events[i].data.ptr);
+            bool open = true;
+            if(events[i].events & (EPOLLERR | EPOLLHUP)) {
+              open = false;
+            }
+            if(open && (events[i].events & EPOLLOUT)) {
+              open = conn.flush();
+            }
+            if(open && (events[i].events & EPOLLIN) && !conn.parked()) {
+              open = conn.fill();
+            }
+            if(open) {
+              conn.touch(now);
+              open = process(conn, draining) && update(epoll, conn) &&
+                     !(draining && conn.idle());
+            }
+            if(open) {
+              timers.schedule(conn, conn.deadline(now));
+            }
+            else {
+              close(epoll, connections, conn);
+            }
+          }
+
+          if(completed) {
+            resume(epoll, connections, timers, *completions, draining, now);
+          }
+          if(stopped) {
+            close_idle(epoll, connections);
+          }
+
+          timers.advance(now, [&](timer_wheel::timer& t) {
+            if(&t == &backoff) {
+              if(!draining) {
+                watch(epoll, l);
+              }
+              return;
+            }
+
+            // Idle persistent connections are closed routinely; the others belong to clients that
+            // were too slow.
+            buffered_connection& conn = static_cast<buffered_connection&>(t);
+            if(conn.parked() && !conn.pending_output()) {
+              // The deferred response was not completed in time, and is answered with an error.
+              resume(epoll, connections, timers, conn, draining, now);
+              return;
+            }
+            if(!conn.idle()) {
+              WEBBY_DEBUG(_config) << "Closing a connection from " << conn.client_ip()
+                                   << " that timed out" << std::endl;
+              if(_config.metrics() != nullptr) {
+                _config.metrics()->connection_timed_out();
+              }
+            }
+            close(epoll, connections, conn);
+          });
+
+          if(draining && now >= deadline) {
+            WEBBY_INFO(_config) << "Closing " << connections.size()
+                                << " connections at the drain deadline" << std::endl;
+            while(!connections.empty()) {
+              close(epoll, connections, *connections.begin()->second);
+            }
+          }
+        }
+        ::close(epoll);
+      }
+
+      /**
+       * @brief Adds a listening socket to a loop's epoll instance.
+       * @param[in] epoll Descriptor of the loop's epoll instance.
+       * @param[in] l The loop's listening socket.
+       *
+       * A shared listening socket is added with EPOLLEXCLUSIVE, which wakes only one of the loops
+       * for each incoming connection.
+       */
+      void watch(int epoll, const listener& l) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        if(_listeners.size() == 1) {
+          ev.events |= EPOLLEXCLUSIVE;
+        }
+        ev.data.ptr = nullptr;
+        ::epoll_ctl(epoll, EPOLL_CTL_ADD, l.fd(), &ev);
+      }
+
+      /**
+       * @brief Accepts all of the pending connections on a listening socket.
+       * @param[in] epoll Descriptor of the loop's epoll instance.
+       * @param[in] l The loop's listening socket.
+       * @param[in,out] connections Connections owned by the loop.
+       * @param[in,out] timers Deadlines of the loop's connections.
+       * @param[in,out] backoff Timer that puts the listening socket back if accepting fails.
+       * @param[in] completions The loop's completion queue.
+       * @param[in,out] next_id Number of the next connection.
+       * @param[in] now Current time.
+       */
+      void accept(int epoll, const listener& l, connection_map& connections, timer_wheel& timers,
+                  timer_wheel::timer& backoff,
+                  const std::shared_ptr<completion_queue>& completions, uint64_t& next_id,
+                  const std::chrono::steady_clock::time_point now) {
+        while(1) {
+          std::string client_ip;
+          int fd;
+          try {
+            fd = l.accept(client_ip);
+          }
+          catch(const std::exception& e) {
+            // Backs off, as the cause, such as running out of descriptors, may take a while to
+            // go away, and the level-triggered listening socket would otherwise be reported again
+            // straight away.
+            WEBBY_ERROR(_config) << e.what() << std::endl;
+            ::epoll_ctl(epoll, EPOLL_CTL_DEL, l.fd(), nullptr);
+            timers.schedule(backoff, now);
+            return;
+          }
+          if(fd < 0) {
+            return;
+          }
+
+          WEBBY_DEBUG(_config) << "Accepted connection" << std::endl;
+          if(_config.metrics() != nullptr) {
+            _config.metrics()->connection_opened();
+          }
+          std::unique_ptr<buffered_connection> conn(
+              new buffered_connection(_config, fd, client_ip, completions, next_id++));
+          struct epoll_event ev;
+          ev.events = EPOLLIN;
+          ev.data.ptr = conn.get();
+          conn->set_events(ev.events);
+          ::epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &ev);
+          conn->touch(now);
+          timers.schedule(*conn, conn->deadline(now));
+          connections[fd] = std::move(conn);
+        }
+      }
+
+      /**
+       * @brief Processes every complete request that has been buffered on a connection.
+       * @param[in] conn The connection.
+       * @param[in] draining `true` if the engine is stopping, so that the next request is the
+       *                     last one on the connection.
+       * @returns `false` if the connection should be closed.
+       *
+       * Processing stops while output is pending, so that a client that pipelines requests but
+       * does not read the responses cannot make the server buffer without limit. It also stops
+       * while the connection is parked, since the responses must be sent in order.
+       */
+      bool process(buffered_connection& conn, const bool draining) {
+        const unsigned max = _config.max_requests_per_connection();
+        while(!conn.closing() && !conn.parked() && !conn.pending_output() &&
+              conn.request_ready()) {
+          finish(conn, _handler(conn, draining || (max != 0 && conn.requests() + 1 >= max)));
+          if(!conn.flush()) {
+            return false;
+          }
+        }
+        return true;
+      }
+
+      /**
+       * @brief Finishes the deferred responses that have been completed.
+       * @param[in] epoll Descriptor of the loop's epoll instance.
+       * @param[in,out] connections Connections owned by the loop.
+       * @param[in,out] timers Deadlines of the loop's connections.
+       * @param[in] completions The loop's completion queue.
+       * @param[in] draining `true` if the engine is stopping.
+       * @param[in] now Current time.
+       *
+       * Connections that were closed since their responses were completed are skipped.
+       */
+      void resume(int epoll, connection_map& connections, timer_wheel& timers,
+                  completion_queue& completions, const bool draining,
+                  const std::chrono::steady_clock::time_point now) {
+        std::vector<completion_queue::entry> completed;
+        completions.take(completed);
+        for(auto& entry : completed) {
+          auto itr = connections.find(entry.first);
+          if(itr == connections.end() || itr->second->id() != entry.second ||
+             !itr->second->parked()) {
+            continue;
+          }
+          resume(epoll, connections, timers, *itr->second, draining, now);
+        }
+      }
+
+      /**
+       * @brief Finishes the deferred response of a parked connection, and carries on with the
+       *        requests that follow it.
+       * @param[in] epoll Descriptor of the loop's epoll instance.
+       * @param[in,out] connections Connections owned by the loop.
+       * @param[in,out] timers Deadlines of the loop's connections.
+       * @param[in] conn The connection.
+       * @param[in] draining `true` if the engine is stopping.
+       * @param[in] now Current time.
+       */
+      void resume(int epoll, connection_map& connections, timer_wheel& timers,
+                  buffered_connection& conn, const bool draining,
+                  const std::chrono::steady_clock::time_point now) {
+        conn.touch(now);
+        finish(conn, conn.resume());
+        const bool open = conn.flush() && process(conn, draining) && update(epoll, conn) &&
+                          !(draining && conn.idle());
+        if(open) {
+          timers.schedule(conn, conn.deadline(now));
+        }
+        else {
+          close(epoll, connections, conn);
+        }
+      }
+
+      /**
+       * @brief Moves on to the next request once the response to the current one is complete.
+       * @param[in] conn The connection.
+       * @param[in] keep_alive `true` if the connection can be used for another request.
+       *
+       * Nothing happens while the connection is parked; the request is kept until the deferred
+       * response has been sent.
+       */
+      void finish(buffered_connection& conn, const bool keep_alive) {
+        if(conn.parked()) {
+          return;
+        }
+        if(!keep_alive) {
+          conn.set_closing();
+        }
+        conn.consume();
+      }
+
+      /**
+       * @brief Updates the events a connection waits for after it has been serviced.
+       * @param[in] epoll Descriptor of the loop's epoll instance.
+       * @param[in] conn The connection.
+       * @returns `false` if the connection should be closed.
+       */
+      bool update(int epoll, buffered_connection& conn) {
+        uint32_t events;
+        if(conn.pending_output()) {
+          events = EPOLLOUT;
+        }
+        else if(conn.parked()) {
+          events = 0;
+        }
+        else if(conn.closing() || conn.eof()) {
+          return false;
+        }
+        else {
+          events = EPOLLIN;
+        }
+        if(events != conn.events()) {
+          struct epoll_event ev;
+          ev.events = events;
+          ev.data.ptr = &conn;
+          ::epoll_ctl(epoll, EPOLL_CTL_MOD, conn.fd(), &ev);
+          conn.set_events(events);
+        }
+        return true;
+      }
+
+      /**
+       * @brief Closes the connections that are between requests.
+       * @param[in] epoll Descriptor of the loop's epoll instance.
+       * @param[in,out] connections Connections owned by the loop.
+       */
+      void close_idle(int epoll, connection_map& connections) {
+        std::vector<buffered_connection*> idle;
+        for(auto& entry : connections) {
+          if(entry.second->idle()) {
+            idle.push_back(entry.second.get());
+          }
+        }
+        for(auto conn : idle) {
+          close(epoll, connections, *conn);
+        }
+      }
+
+      /**
+       * @brief Closes a connection.
+       * @param[in] epoll Descriptor of the loop's epoll instance.
+       * @param[in,out] connections Connections owned by the loop.
+       * @param[in] conn The connection to close.
+       */
+      void close(int epoll, connection_map& connections, buffered_connection& conn) {
+        ::epoll_ctl(epoll, EPOLL_CTL_DEL, conn.fd(), nullptr);
+        connections.erase(conn.fd());
+        if(_config.metrics() != nullptr) {
+          _config.metrics()->connection_closed();
+        }
+      }
+
+      /**
+       * @brief Server configuration.
+       */
+      const webby::config& _config;
+
+      /**
+       * @brief Processes each buffered request.
+       */
+      handler_t _handler;
+
+      /**
+       * @brief Non-blocking listening sockets: one shared by all of the event loops, or one for
+       *        each loop.
+       */
+      std::vector<std::unique_ptr<listener>> _listeners;
+
+      /**
+       * @brief Descriptor that becomes readable when the engine should stop.
+       */
+      const int _wake_fd;
+  };
+}
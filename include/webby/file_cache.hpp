@@ -0,0 +1,327 @@
+/**
+ * @file file_cache.hpp
+ */
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief An open file and its metadata, shared by the requests that are sending it.
+   *
+   * The descriptor is closed when the last reference is released, so a file that is evicted from
+   * the webby::file_cache while a response is still sending it remains valid.
+   */
+  class cached_file {
+    public:
+      /**
+       * @brief Takes ownership of an open file.
+       * @param[in] path Path of the file.
+       * @param[in] fd Descriptor of the file.
+       * @param[in] st Status of the file.
+       */
+      cached_file(const std::string& path, const int fd, const struct stat& st)
+          : _path(path), _fd(fd), _stat(st) { }
+
+      /**
+       * @brief Closes the file.
+       */
+      ~cached_file() {
+        ::close(_fd);
+      }
+
+      cached_file(const cached_file&) = delete;
+      cached_file& operator=(const cached_file&) = delete;
+
+      /**
+       * @brief Gets the path of the file, which ends with "index.html" if a directory was
+       *        requested.
+       */
+      const std::string& path() const {
+        return _path;
+      }
+
+      /**
+       * @brief Gets the descriptor of the file.
+       */
+      int fd() const {
+        return _fd;
+      }
+
+      /**
+       * @brief Gets the size of the file in bytes.
+       */
+      unsigned long size() const {
+        return static_cast<unsigned long>(_stat.st_size);
+      }
+
+      /**
+       * @brief Gets the time the file was last modified.
+       */
+      time_t mtime() const {
+        return _stat.st_mtime;
+      }
+
+      /**
+       * @brief Gets the inode number of the file.
+       */
+      ino_t inode() const {
+        return _stat.st_ino;
+      }
+
+      /**
+       * @brief Gets the status of the file when it was opened.
+       */
+      const struct stat& status() const {
+        return _stat;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether @p st describes the same version of the file.
+       */
+      bool matches(const struct stat& st) const {
+        return st.st_ino == _stat.st_ino && st.st_dev == _stat.st_dev &&
+               st.st_size == _stat.st_size && st.st_mtime == _stat.st_mtime;
+      }
+
+    private:
+      /**
+       * @brief Path of the file.
+       */
+      const std::string _path;
+
+      /**
+       * @brief Descriptor of the file.
+       */
+      const int _fd;
+
+      /**
+       * @brief Status of the file when it was opened.
+       */
+      const struct stat _stat;
+  };
+
+  /**
+   * @brief Bounded, thread-safe cache of open files.
+   *
+   * Files are cached by the path they were requested with, along with their metadata, so a hot
+   * file is served without opening or examining it again. An entry is checked against the file
+   * system with a single `stat(2)` once it is older than the time to live, and is reopened if the
+   * file has been replaced or modified. Paths that do not exist are remembered for the same time,
+   * so probing for optional files, such as precompressed variants, is also cheap. The least
+   * recently used entries are closed when either the number of entries or the total size of the
+   * cached files exceeds its limit. Files larger than the size limit are never cached.
+   */
+  class file_cache {
+    public:
+      /**
+       * @brief Constructs an empty cache.
+       * @param[in] max_entries Maximum number of open files.
+       * @param[in] max_bytes Maximum total size of the open files, in bytes.
+       * @param[in] ttl Time before a cached file is checked for changes.
+       */
+      file_cache(const std::size_t max_entries, const unsigned long max_bytes,
+                 const std::chrono::milliseconds ttl)
+          : _max_entries(max_entries), _max_bytes(max_bytes), _ttl(ttl), _bytes(0) { }
+
+      file_cache(const file_cache&) = delete;
+      file_cache& operator=(const file_cache&) = delete;
+
+      /**
+       * @brief Gets an open file.
+       * @param[in] path Path of the file. If it is a directory, the "index.html" file inside it
+       *                 is opened instead.
+       * @returns The open file, or `nullptr` with `errno` set if it could not be opened.
+       */
+      std::shared_ptr<const cached_file> open(const std::string& path) {
+        const auto now = std::chrono::steady_clock::now();
+        std::shared_ptr<const cached_file> file;
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          auto itr = _entries.find(path);
+          if(itr != _entries.end()) {
+            // Moves the entry to the front of the LRU list.
+            _lru.splice(_lru.begin(), _lru, itr->second);
+            if(now - itr->second->validated < _ttl) {
+              if(!itr->second->file) {
+                errno = itr->second->error;
+              }
+              return itr->second->file;
+            }
+            file = itr->second->file;
+          }
+        }
+
+        // The file system is examined without holding the lock.
+        struct stat st;
+        if(file && ::stat(file->path().c_str(), &st) == 0 && file->matches(st)) {
+          std::lock_guard<std::mutex> lock(_mutex);
+          auto itr = _entries.find(path);
+          if(itr != _entries.end() && itr->second->file == file) {
+            itr->second->validated = now;
+          }
+          return file;
+        }
+
+        file = open_file(path);
+        const int error = errno;
+        std::lock_guard<std::mutex> lock(_mutex);
+        remove(path);
+        if(_max_entries > 0 && (file ? file->size() <= _max_bytes : missing(error))) {
+          _lru.push_front(entry{path, file, error, now});
+          _entries[path] = _lru.begin();
+          _bytes += file ? file->size() : 0;
+          while(_entries.size() > _max_entries || _bytes > _max_bytes) {
+            remove(_lru.back().path);
+          }
+        }
+        errno = error;
+        return file;
+      }
+
+    private:
+      /**
+       * @brief Cache entry.
+       */
+      struct entry {
+        /**
+         * @brief Path the file was requested with.
+         */
+        std::string path;
+
+        /**
+         * @brief The open file, or `nullptr` if it does not exist.
+         */
+        std::shared_ptr<const cached_file> file;
+
+        /**
+         * @brief Reason the file could not be opened, when entry::file is `nullptr`.
+         */
+        int error;
+
+        /**
+         * @brief Time the entry was last checked against the file system.
+         */
+        std::chrono::steady_clock::time_point validated;
+      };
+
+      /**
+       * @brief Entries, most recently used first.
+       */
+      typedef std::list<entry> lru_list;
+
+      /**
+       * @brief Opens a file, or the "index.html" file inside it if the path is a directory.
+       * @param[in] path Path of the file.
+       * @returns The open file, or `nullptr` with `errno` set. Anything other than a regular file
+       *          is reported as `ENOENT`.
+       */
+      static std::shared_ptr<const cached_file> open_file(std::string path) {
+        struct stat st;
+        int fd = stat_open(path, st);
+        if(fd >= 0 && S_ISDIR(st.st_mode)) {
+          ::close(fd);
+          if(path[path.length() - 1] != '/') {
+            path += "/";
+          }
+          path += "index.html";
+          fd = stat_open(path, st);
+        }
+        if(fd < 0) {
+          return nullptr;
+        }
+        if(!S_ISREG(st.st_mode)) {
+          ::close(fd);
+          errno = ENOENT;
+          return nullptr;
+        }
+        return std::make_shared<const cached_file>(path, fd, st);
+      }
+
+      /**
+       * @brief Opens a file and gets its status.
+       * @param[in] path Path of the file.
+       * @param[out] st Receives the status of the file.
+       * @return Descriptor of the file, or `-1` with `errno` set.
+       */
+      static int stat_open(const std::string& path, struct stat& st) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd >= 0 && ::fstat(fd, &st) < 0) {
+          int error = errno;
+          ::close(fd);
+          errno = error;
+          return -1;
+        }
+        return fd;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether @p error means that a file does not exist.
+       */
+      static bool missing(const int error) {
+        return error == ENOENT || error == ENOTDIR;
+      }
+
+      /**
+       * @brief Removes an entry, if it exists. The lock must be held.
+       */
+      void remove(const std::string& path) {
+        auto itr = _entries.find(path);
+        if(itr != _entries.end()) {
+          _bytes -= itr->second->file ? itr->second->file->size() : 0;
+          _lru.erase(itr->second);
+          _entries.erase(itr);
+        }
+      }
+
+      /**
+       * @brief Maximum number of entries.
+       */
+      const std::size_t _max_entries;
+
+      /**
+       * @brief Maximum total size of the cached files.
+       */
+      const unsigned long _max_bytes;
+
+      /**
+       * @brief Time before an entry is checked against the file system.
+       */
+      const std::chrono::milliseconds _ttl;
+
+      /**
+       * @brief Total size of the cached files.
+       */
+      unsigned long _bytes;
+
+      /**
+       * @brief Entries, most recently used first.
+       */
+      lru_list _lru;
+
+      /**
+       * @brief Entries indexed by path.
+       */
+      std::unordered_map<std::string, lru_list::iterator> _entries;
+
+      /**
+       * @brief Guards all of the fields above.
+       */
+      std::mutex _mutex;
+  };
+}
@@ -0,0 +1,218 @@
+/**
+ * @file handoff.hpp
+ */
+#pragma once
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Unix domain socket over which a running server hands its listening sockets to the
+   *        process that replaces it.
+   *
+   * The new process connects to the socket and receives the descriptors with `SCM_RIGHTS`, so it
+   * accepts from the very same kernel sockets and no connection waiting in their backlog is lost.
+   * The old process then stops accepting and drains its connections, while the new process binds
+   * the handoff socket again for the next upgrade.
+   */
+  class handoff_socket {
+    public:
+      /**
+       * @brief Maximum number of listening sockets that can be handed over.
+       */
+      static const size_t max_descriptors = 64;
+
+      /**
+       * @brief Binds the handoff socket, replacing any socket file left at @p path.
+       * @param[in] path Path of the socket.
+       * @throws std::system_error if the socket could not be bound.
+       */
+      explicit handoff_socket(const std::string& path) : _path(path), _fd(-1), _inode(0) {
+        struct sockaddr_un addr = address(path);
+        _fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(_fd < 0) {
+          throw std::system_error(errno, std::system_category(), "socket");
+        }
+        ::unlink(path.c_str());
+        struct stat st;
+        if(::bind(_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 ||
+           ::listen(_fd, 1) != 0 || ::stat(path.c_str(), &st) != 0) {
+          const int error = errno;
+          ::close(_fd);
+          throw std::system_error(error, std::system_category(), "bind " + path);
+        }
+        _inode = st.st_ino;
+      }
+
+      /**
+       * @brief Closes the socket, and removes its file unless another process has replaced it.
+       */
+      ~handoff_socket() {
+        ::close(_fd);
+        struct stat st;
+        if(::stat(_path.c_str(), &st) == 0 && st.st_ino == _inode) {
+          ::unlink(_path.c_str());
+        }
+      }
+
+      handoff_socket(const handoff_socket&) = delete;
+      handoff_socket& operator=(const handoff_socket&) = delete;
+
+      /**
+       * @brief Gets the socket descriptor, which becomes readable when a process connects.
+       */
+      int fd() const {
+        return _fd;
+      }
+
+      /**
+       * @brief Accepts a connection from the new process and sends it the listening sockets.
+       * @param[in] fds Descriptors of the listening sockets.
+       * @throws std::system_error if the descriptors could not be sent.
+       */
+      void send(const std::vector<int>& fds) const {
+        int peer = ::accept4(_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if(peer < 0) {
+          throw std::system_error(errno, std::system_category(), "accept4");
+        }
+        const size_t count = fds.size() < max_descriptors ? fds.size() : max_descriptors;
+        char data = 'L';
+        struct iovec iov;
+        iov.iov_base = &data;
+        iov.iov_len = 1;
+        char control[CMSG_SPACE(sizeof(int) * max_descriptors)];
+        memset(control, 0, sizeof(control));
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+        struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        memcpy(CMSG_DATA(header), fds.data(), sizeof(int) * count);
+
+        ssize_t result;
+        do {
+          result = ::sendmsg(peer, &message, MSG_NOSIGNAL);
+        } while(result < 0 && errno == EINTR);
+        const int error = errno;
+        ::close(peer);
+        if(result < 0) {
+          throw std::system_error(error, std::system_category(), "sendmsg");
+        }
+      }
+
+      /**
+       * @brief Asks the process bound to a handoff socket for its listening sockets.
+       * @param[in] path Path of the socket.
+       * @param[out] fds Receives the descriptors, which are owned by the caller.
+       * @returns `true` if the descriptors were received; `false` if no process is bound to the
+       *          socket.
+       * @throws std::system_error if a process is bound to the socket but the descriptors could
+       *         not be received from it.
+       */
+      static bool receive(const std::string& path, std::vector<int>& fds) {
+        struct sockaddr_un addr = address(path);
+        int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(fd < 0) {
+          throw std::system_error(errno, std::system_category(), "socket");
+        }
+        if(::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+          const int error = errno;
+          ::close(fd);
+          if(error == ENOENT || error == ECONNREFUSED) {
+            return false;
+          }
+          throw std::system_error(error, std::system_category(), "connect " + path);
+        }
+
+        // The old process answers straight away, unless it is hung.
+        struct timeval timeout;
+        timeout.tv_sec = 5;
+        timeout.tv_usec = 0;
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        char data;
+        struct iovec iov;
+        iov.iov_base = &data;
+        iov.iov_len = 1;
+        char control[CMSG_SPACE(sizeof(int) * max_descriptors)];
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        ssize_t result;
+        do {
+          result = ::recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+        } while(result < 0 && errno == EINTR);
+        const int error = errno;
+        ::close(fd);
+        if(result <= 0) {
+          throw std::system_error(result < 0 ? error : ECONNRESET, std::system_category(),
+                                  "recvmsg " + path);
+        }
+
+        fds.clear();
+        for(struct cmsghdr* header = CMSG_FIRSTHDR(&message); header != nullptr;
+            header = CMSG_NXTHDR(&message, header)) {
+          if(header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+            const size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const size_t start = fds.size();
+            fds.resize(start + count);
+            memcpy(fds.data() + start, CMSG_DATA(header), sizeof(int) * count);
+          }
+        }
+        return true;
+      }
+
+    private:
+      /**
+       * @brief Builds the address of a socket.
+       * @throws std::invalid_argument if the path is too long.
+       */
+      static struct sockaddr_un address(const std::string& path) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if(path.empty() || path.length() >= sizeof(addr.sun_path)) {
+          throw std::invalid_argument("Invalid handoff socket path: " + path);
+        }
+        memcpy(addr.sun_path, path.data(), path.length());
+        return addr;
+      }
+
+      /**
+       * @brief Path of the socket.
+       */
+      const std::string _path;
+
+      /**
+       * @brief Socket descriptor.
+       */
+      int _fd;
+
+      /**
+       * @brief Inode of the socket file, used to tell whether another process has replaced it.
+       */
+      ino_t _inode;
+  };
+}
@@ -0,0 +1,265 @@
+/**
+ * @file header.hpp
+ */
+#pragma once
+
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+#include <cstddef>
+#include <vector>
+
+#include <webby/arena.hpp>
+#include <webby/slice.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Well-known headers.
+   *
+   * Header names are resolved to one of these once, when a request is parsed or a response header
+   * is set, so that looking up a well-known header is an index into a table rather than a search.
+   */
+  enum class header_id : unsigned char {
+    UNKNOWN,             ///< Any other header.
+    ACCEPT,              ///< Accept
+    ACCEPT_ENCODING,     ///< Accept-Encoding
+    ACCEPT_LANGUAGE,     ///< Accept-Language
+    ACCEPT_RANGES,       ///< Accept-Ranges
+    AGE,                 ///< Age
+    ALLOW,               ///< Allow
+    AUTHORIZATION,       ///< Authorization
+    CACHE_CONTROL,       ///< Cache-Control
+    CONNECTION,          ///< Connection
+    CONTENT_ENCODING,    ///< Content-Encoding
+    CONTENT_LENGTH,      ///< Content-Length
+    CONTENT_RANGE,       ///< Content-Range
+    CONTENT_TYPE,        ///< Content-Type
+    COOKIE,              ///< Cookie
+    DATE,                ///< Date
+    ETAG,                ///< ETag
+    EXPECT,              ///< Expect
+    EXPIRES,             ///< Expires
+    HOST,                ///< Host
+    IF_MATCH,            ///< If-Match
+    IF_MODIFIED_SINCE,   ///< If-Modified-Since
+    IF_NONE_MATCH,       ///< If-None-Match
+    IF_RANGE,            ///< If-Range
+    IF_UNMODIFIED_SINCE, ///< If-Unmodified-Since
+    LAST_MODIFIED,       ///< Last-Modified
+    LOCATION,            ///< Location
+    ORIGIN,              ///< Origin
+    RANGE,               ///< Range
+    REFERER,             ///< Referer
+    SERVER,              ///< Server
+    SET_COOKIE,          ///< Set-Cookie
+    TRANSFER_ENCODING,   ///< Transfer-Encoding
+    UPGRADE,             ///< Upgrade
+    USER_AGENT,          ///< User-Agent
+    VARY,                ///< Vary
+    X_FORWARDED_FOR,     ///< X-Forwarded-For
+    COUNT                ///< Number of header IDs, not a header.
+  };
+
+  /**
+   * @brief Gets the canonical name of a well-known header.
+   * @returns The name, or an empty string for webby::header_id::UNKNOWN.
+   */
+  const char* header_name(const header_id id) {
+    static const char* const names[] = {
+      "", "Accept", "Accept-Encoding", "Accept-Language", "Accept-Ranges", "Age", "Allow",
+      "Authorization", "Cache-Control", "Connection", "Content-Encoding", "Content-Length",
+      "Content-Range", "Content-Type", "Cookie", "Date", "ETag", "Expect", "Expires", "Host",
+      "If-Match", "If-Modified-Since", "If-None-Match", "If-Range", "If-Unmodified-Since",
+      "Last-Modified", "Location", "Origin", "Range", "Referer", "Server", "Set-Cookie",
+      "Transfer-Encoding", "Upgrade", "User-Agent", "Vary", "X-Forwarded-For"
+    };
+    return names[static_cast<size_t>(id)];
+  }
+
+  /**
+   * @brief Resolves a header name to a well-known header.
+   * @param[in] name Name of the header, which is not case sensitive.
+   * @returns The header, or webby::header_id::UNKNOWN.
+   *
+   * The length and the first and last characters of the name are hashed into a table in which
+   * the well-known names do not collide, so at most one name is compared.
+   */
+  header_id find_header_id(const slice& name) {
+    struct table {
+      table() {
+        memset(ids, 0, sizeof(ids));
+        for(size_t i = 1; i < static_cast<size_t>(header_id::COUNT); ++i) {
+          const header_id id = static_cast<header_id>(i);
+          ids[hash(header_name(id), strlen(header_name(id)))] = id;
+        }
+      }
+
+      static size_t hash(const char* name, const size_t length) {
+        return (length + 7 * static_cast<size_t>(tolower(name[0])) +
+                23 * static_cast<size_t>(tolower(name[length - 1]))) & 127;
+      }
+
+      header_id ids[128];
+    };
+    static const table lookup;
+
+    if(name.empty()) {
+      return header_id::UNKNOWN;
+    }
+    const header_id id = lookup.ids[table::hash(name.data(), name.length())];
+    const char* candidate = header_name(id);
+    if(strlen(candidate) == name.length() &&
+       strncasecmp(candidate, name.data(), name.length()) == 0) {
+      return id;
+    }
+    return header_id::UNKNOWN;
+  }
+
+  /**
+   * @brief Headers of a response, kept in the order they were set.
+   *
+   * The headers are stored in a flat array allocated from the connection's webby::arena, and the
+   * position of each well-known header is recorded in a table indexed by its webby::header_id.
+   */
+  class header_list {
+    public:
+      /**
+       * @brief A header.
+       */
+      struct entry {
+        /**
+         * @brief The header, or webby::header_id::UNKNOWN.
+         */
+        header_id id;
+
+        /**
+         * @brief Name of the header.
+         */
+        arena_string name;
+
+        /**
+         * @brief Value of the header.
+         */
+        arena_string value;
+      };
+
+      /**
+       * @brief Flat array of headers.
+       */
+      typedef std::vector<entry, arena_allocator<entry>> entry_list;
+
+      /**
+       * @brief Constructs an empty list.
+       * @param[in] a Arena that the headers are allocated from.
+       */
+      explicit header_list(webby::arena& a) : _entries(entry_list::allocator_type(a)) {
+        memset(_index, 0, sizeof(_index));
+      }
+
+      /**
+       * @brief Finds a well-known header.
+       * @returns The value of the header, or `nullptr` if it has not been set.
+       */
+      const arena_string* find(const header_id id) const {
+        const unsigned index = _index[static_cast<size_t>(id)];
+        return index == 0 ? nullptr : &_entries[index - 1].value;
+      }
+
+      /**
+       * @brief Finds a header by name.
+       * @param[in] name Name of the header, which is not case sensitive.
+       * @returns The value of the header, or `nullptr` if it has not been set.
+       */
+      const arena_string* find(const slice& name) const {
+        const header_id id = find_header_id(name);
+        if(id != header_id::UNKNOWN) {
+          return find(id);
+        }
+        for(auto& header : _entries) {
+          if(header.id == header_id::UNKNOWN &&
+             slice(header.name.data(), header.name.length()).equals_nocase(name)) {
+            return &header.value;
+          }
+        }
+        return nullptr;
+      }
+
+      /**
+       * @brief Adds a header, or replaces its value.
+       * @param[in] name Name of the header.
+       * @param[in] value Value of the header.
+       */
+      void set(const slice& name, const slice& value) {
+        set(find_header_id(name), name, value);
+      }
+
+      /**
+       * @brief Adds a well-known header with its canonical name, or replaces its value.
+       */
+      void set(const header_id id, const slice& value) {
+        set(id, header_name(id), value);
+      }
+
+      /**
+       * @brief Removes a well-known header, if it has been set.
+       */
+      void erase(const header_id id) {
+        const unsigned index = _index[static_cast<size_t>(id)];
+        if(index == 0) {
+          return;
+        }
+        _entries.erase(_entries.begin() + (index - 1));
+        _index[static_cast<size_t>(id)] = 0;
+        for(unsigned& other : _index) {
+          if(other > index) {
+            --other;
+          }
+        }
+      }
+
+      /**
+       * @brief Gets the first header.
+       */
+      entry_list::const_iterator begin() const {
+        return _entries.cbegin();
+      }
+
+      /**
+       * @brief Gets the end of the headers.
+       */
+      entry_list::const_iterator end() const {
+        return _entries.cend();
+      }
+
+    private:
+      /**
+       * @brief Adds a header whose name has already been resolved, or replaces its value.
+       */
+      void set(const header_id id, const slice& name, const slice& value) {
+        const arena_string* existing = id != header_id::UNKNOWN ? find(id) : find(name);
+        if(existing != nullptr) {
+          const_cast<arena_string*>(existing)->assign(value.data(), value.length());
+          return;
+        }
+        const entry_list::allocator_type allocator = _entries.get_allocator();
+        _entries.push_back(entry{id, arena_string(name.data(), name.length(), allocator),
+                                 arena_string(value.data(), value.length(), allocator)});
+        if(id != header_id::UNKNOWN) {
+          _index[static_cast<size_t>(id)] = static_cast<unsigned>(_entries.size());
+        }
+      }
+
+      /**
+       * @brief Headers, in the order they were set.
+       */
+      entry_list _entries;
+
+      /**
+       * @brief Position of each well-known header in header_list::_entries plus one, or `0`.
+       */
+      unsigned _index[static_cast<size_t>(header_id::COUNT)];
+  };
+}
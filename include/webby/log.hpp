@@ -0,0 +1,72 @@
+/**
+ * @file log.hpp
+ *
+ * Logging macros used throughout webby.
+ *
+ * Each macro expands to a statement that streams into `webby::config::error_log()` only when the
+ * level is enabled. The check happens before any of the streamed expressions are evaluated, so a
+ * disabled statement never formats text or flushes the log.
+ *
+ * Levels below `WEBBY_LOG_LEVEL` are removed at compile time. It defaults to
+ * `WEBBY_LOG_LEVEL_INFO` when `NDEBUG` is defined and to `WEBBY_LOG_LEVEL_DEBUG` otherwise, and can
+ * be set with the `WEBBY_LOG_LEVEL` CMake option. Levels that are compiled in are then filtered at
+ * run time by `webby::config::log_level()` with a single comparison.
+ *
+ *     WEBBY_DEBUG(_config) << "request::path()" << std::endl;
+ */
+#pragma once
+
+#define WEBBY_LOG_LEVEL_DEBUG 0
+#define WEBBY_LOG_LEVEL_INFO  1
+#define WEBBY_LOG_LEVEL_ERROR 2
+#define WEBBY_LOG_LEVEL_NONE  3
+
+#ifndef WEBBY_LOG_LEVEL
+#  ifdef NDEBUG
+#    define WEBBY_LOG_LEVEL WEBBY_LOG_LEVEL_INFO
+#  else
+#    define WEBBY_LOG_LEVEL WEBBY_LOG_LEVEL_DEBUG
+#  endif
+#endif
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Severity of a log statement.
+   */
+  enum class log_level {
+    DEBUG = WEBBY_LOG_LEVEL_DEBUG, ///< Tracing of the server internals.
+    INFO  = WEBBY_LOG_LEVEL_INFO,  ///< Significant events such as the server starting.
+    ERROR = WEBBY_LOG_LEVEL_ERROR, ///< Errors.
+    NONE  = WEBBY_LOG_LEVEL_NONE   ///< Disables logging.
+  };
+}
+
+/**
+ * @brief Evaluates to `true` if @p level is enabled at compile time and at run time.
+ * @param config `webby::config` that owns the error log.
+ * @param level One of `DEBUG`, `INFO`, or `ERROR`.
+ */
+#define WEBBY_LOG_ENABLED(config, level)                                                        \
+  (WEBBY_LOG_LEVEL_##level >= WEBBY_LOG_LEVEL && (config).log_level() <= webby::log_level::level)
+
+/**
+ * @brief Streams into the error log if @p level is enabled.
+ * @param config `webby::config` that owns the error log.
+ * @param level One of `DEBUG`, `INFO`, or `ERROR`.
+ * @param severity The matching `qlog` severity manipulator.
+ */
+#define WEBBY_LOG(config, level, severity)                                                      \
+  if(!WEBBY_LOG_ENABLED(config, level)) { }                                                     \
+  else (config).error_log() << qlog::severity
+
+/// Streams a debug statement into the error log of @p config.
+#define WEBBY_DEBUG(config) WEBBY_LOG(config, DEBUG, debug)
+
+/// Streams an informational statement into the error log of @p config.
+#define WEBBY_INFO(config) WEBBY_LOG(config, INFO, info)
+
+/// Streams an error statement into the error log of @p config.
+#define WEBBY_ERROR(config) WEBBY_LOG(config, ERROR, error)
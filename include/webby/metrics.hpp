@@ -0,0 +1,418 @@
+/**
+ * @file metrics.hpp
+ */
+#pragma once
+
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Runtime statistics of a server.
+   *
+   * Each thread that records a statistic gets its own block of counters, padded so that it does
+   * not share a cache line with another thread's block. A counter is only ever written by the
+   * thread that owns it, so recording is a plain load and store without a lock or an atomic
+   * read-modify-write. The blocks are only added up when the statistics are read.
+   *
+   * Latencies are recorded in a log-linear histogram: values below 16 microseconds have a bucket
+   * each, and every power of two above that is split into 8 buckets, so percentiles are accurate
+   * to within about 12% from microseconds to over an hour.
+   *
+   * To collect statistics pass an instance to webby::config::set_metrics(), and mount a
+   * webby::metrics_handler to publish them.
+   */
+  class metrics {
+    public:
+      /**
+       * @brief Status codes are counted individually below this value.
+       */
+      static const std::size_t max_status = 600;
+
+      /**
+       * @brief Number of buckets in the latency histogram.
+       */
+      static const std::size_t histogram_buckets = 240;
+
+      /**
+       * @brief Statistics added up over all of the threads.
+       */
+      struct snapshot {
+        /**
+         * @brief Number of responses sent, indexed by status code.
+         */
+        std::vector<std::uint64_t> status;
+
+        /**
+         * @brief Number of body bytes sent.
+         */
+        std::uint64_t bytes_sent;
+
+        /**
+         * @brief Number of connections accepted.
+         */
+        std::uint64_t connections_opened;
+
+        /**
+         * @brief Number of connections closed.
+         */
+        std::uint64_t connections_closed;
+
+        /**
+         * @brief Number of connections closed because the client was too slow.
+         */
+        std::uint64_t connections_timed_out;
+
+        /**
+         * @brief Number of requests in each bucket of the latency histogram.
+         */
+        std::vector<std::uint64_t> latency;
+
+        /**
+         * @brief Sum of all of the latencies in microseconds.
+         */
+        std::uint64_t latency_sum;
+
+        /**
+         * @brief Gets the number of requests answered.
+         */
+        std::uint64_t requests() const {
+          std::uint64_t total = 0;
+          for(auto count : status) {
+            total += count;
+          }
+          return total;
+        }
+
+        /**
+         * @brief Gets the number of connections that are open.
+         */
+        std::uint64_t active_connections() const {
+          return connections_opened > connections_closed ?
+                 connections_opened - connections_closed : 0;
+        }
+
+        /**
+         * @brief Gets a latency percentile.
+         * @param[in] q The percentile as a fraction, e.g. `0.99`.
+         * @returns The upper bound in microseconds of the bucket that holds the percentile, or
+         *          `0` if no request has been recorded.
+         */
+        std::uint64_t percentile(const double q) const {
+          std::uint64_t total = 0;
+          for(auto count : latency) {
+            total += count;
+          }
+          if(total == 0) {
+            return 0;
+          }
+          std::uint64_t rank = static_cast<std::uint64_t>(q * static_cast<double>(total) + 0.5);
+          rank = rank == 0 ? 1 : rank;
+          std::uint64_t seen = 0;
+          for(std::size_t i = 0; i < latency.size(); ++i) {
+            seen += latency[i];
+            if(seen >= rank) {
+              return bucket_upper_bound(i);
+            }
+          }
+          return bucket_upper_bound(latency.size() - 1);
+        }
+      };
+
+      /**
+       * @brief Constructs an empty set of statistics.
+       */
+      metrics() : _id(next_id()) { }
+
+      metrics(const metrics&) = delete;
+      metrics& operator=(const metrics&) = delete;
+
+      /**
+       * @brief Records a response.
+       * @param[in] status_code Status code of the response.
+       * @param[in] bytes_sent Number of body bytes sent.
+       * @param[in] latency Time taken to process the request.
+       */
+      void record_request(const unsigned short status_code, const unsigned long bytes_sent,
+                          const std::chrono::microseconds latency) {
+        block& b = local();
+        b.status[status_code < max_status ? status_code : 0].add(1);
+        b.bytes_sent.add(bytes_sent);
+        const std::uint64_t us = latency.count() > 0 ?
+                                 static_cast<std::uint64_t>(latency.count()) : 0;
+        b.latency[bucket(us)].add(1);
+        b.latency_sum.add(us);
+      }
+
+      /**
+       * @brief Records that a connection has been accepted.
+       */
+      void connection_opened() {
+        local().connections_opened.add(1);
+      }
+
+      /**
+       * @brief Records that a connection has been closed.
+       */
+      void connection_closed() {
+        local().connections_closed.add(1);
+      }
+
+      /**
+       * @brief Records that a connection has been closed because the client was too slow. The
+       *        connection is also counted by metrics::connection_closed().
+       */
+      void connection_timed_out() {
+        local().connections_timed_out.add(1);
+      }
+
+      /**
+       * @brief Adds up the statistics of every thread.
+       *
+       * The counters are read while other threads may be updating them, so the result is a
+       * consistent view of each counter but not of all of them at a single instant.
+       */
+      snapshot read() const {
+        snapshot s;
+        s.status.assign(max_status, 0);
+        s.latency.assign(histogram_buckets, 0);
+        s.bytes_sent = s.connections_opened = s.connections_closed = s.latency_sum = 0;
+        s.connections_timed_out = 0;
+        std::lock_guard<std::mutex> lock(_mutex);
+        for(auto& b : _blocks) {
+          for(std::size_t i = 0; i < max_status; ++i) {
+            s.status[i] += b->status[i].get();
+          }
+          for(std::size_t i = 0; i < histogram_buckets; ++i) {
+            s.latency[i] += b->latency[i].get();
+          }
+          s.bytes_sent += b->bytes_sent.get();
+          s.connections_opened += b->connections_opened.get();
+          s.connections_closed += b->connections_closed.get();
+          s.connections_timed_out += b->connections_timed_out.get();
+          s.latency_sum += b->latency_sum.get();
+        }
+        return s;
+      }
+
+      /**
+       * @brief Formats the statistics in the Prometheus text exposition format.
+       */
+      std::string prometheus() const {
+        const snapshot s = read();
+        std::string out;
+        char line[128];
+
+        out += "# HELP webby_requests_total Responses sent, by status code.\n"
+               "# TYPE webby_requests_total counter\n";
+        for(std::size_t code = 0; code < max_status; ++code) {
+          if(s.status[code] != 0) {
+            snprintf(line, sizeof(line), "webby_requests_total{code=\"%zu\"} %llu\n", code,
+                     static_cast<unsigned long long>(s.status[code]));
+            out += line;
+          }
+        }
+
+        append(out, "webby_response_bytes_total", "counter", "Body bytes sent.", s.bytes_sent);
+        append(out, "webby_connections_accepted_total", "counter", "Connections accepted.",
+               s.connections_opened);
+        append(out, "webby_connections_active", "gauge", "Connections open.",
+               s.active_connections());
+        append(out, "webby_connections_timed_out_total", "counter",
+               "Connections closed because the client was too slow.", s.connections_timed_out);
+
+        out += "# HELP webby_request_duration_seconds Time taken to process a request.\n"
+               "# TYPE webby_request_duration_seconds summary\n";
+        static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+        for(auto q : quantiles) {
+          snprintf(line, sizeof(line), "webby_request_duration_seconds{quantile=\"%g\"} %g\n", q,
+                   static_cast<double>(s.percentile(q)) / 1e6);
+          out += line;
+        }
+        snprintf(line, sizeof(line), "webby_request_duration_seconds_sum %g\n",
+                 static_cast<double>(s.latency_sum) / 1e6);
+        out += line;
+        snprintf(line, sizeof(line), "webby_request_duration_seconds_count %llu\n",
+                 static_cast<unsigned long long>(s.requests()));
+        out += line;
+        return out;
+      }
+
+      /**
+       * @brief Gets the histogram bucket that a latency is counted in.
+       * @param[in] us The latency in microseconds.
+       */
+      static std::size_t bucket(const std::uint64_t us) {
+        if(us < 16) {
+          return static_cast<std::size_t>(us);
+        }
+        unsigned msb = 63;
+        while((us >> msb) == 0) {
+          --msb;
+        }
+        const std::size_t index = (msb - 3) * 8 + static_cast<std::size_t>(us >> (msb - 3));
+        return index < histogram_buckets ? index : histogram_buckets - 1;
+      }
+
+      /**
+       * @brief Gets the largest latency in microseconds that is counted in a histogram bucket.
+       */
+      static std::uint64_t bucket_upper_bound(const std::size_t index) {
+        if(index < 16) {
+          return index;
+        }
+        const unsigned shift = static_cast<unsigned>(index / 8 - 1);
+        return ((static_cast<std::uint64_t>(index % 8 + 9)) << shift) - 1;
+      }
+
+    private:
+      /**
+       * @brief Counter that is only written by one thread, and may be read by any.
+       */
+      class counter {
+        public:
+          counter() : _value(0) { }
+
+          /**
+           * @brief Adds to the counter. Only the owning thread may call this.
+           */
+          void add(const std::uint64_t n) {
+            _value.store(_value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+          }
+
+          /**
+           * @brief Gets the value of the counter.
+           */
+          std::uint64_t get() const {
+            return _value.load(std::memory_order_relaxed);
+          }
+
+        private:
+          /**
+           * @brief The value.
+           */
+          std::atomic<std::uint64_t> _value;
+      };
+
+      /**
+       * @brief Counters owned by one thread.
+       */
+      struct block {
+        /**
+         * @brief Keeps the counters off the cache line of whatever was allocated before them.
+         */
+        char pad_front[64];
+
+        /**
+         * @brief Responses sent, by status code. Out of range codes are counted as `0`.
+         */
+        counter status[max_status];
+
+        /**
+         * @brief Body bytes sent.
+         */
+        counter bytes_sent;
+
+        /**
+         * @brief Connections accepted.
+         */
+        counter connections_opened;
+
+        /**
+         * @brief Connections closed.
+         */
+        counter connections_closed;
+
+        /**
+         * @brief Connections closed because the client was too slow.
+         */
+        counter connections_timed_out;
+
+        /**
+         * @brief Latency histogram.
+         */
+        counter latency[histogram_buckets];
+
+        /**
+         * @brief Sum of the latencies in microseconds.
+         */
+        counter latency_sum;
+
+        /**
+         * @brief Keeps the counters off the cache line of whatever is allocated after them.
+         */
+        char pad_back[64];
+      };
+
+      /**
+       * @brief Gets the calling thread's block of counters, creating it on first use.
+       *
+       * Each thread remembers its blocks by the ID of the webby::metrics instance they belong to,
+       * so only the first statistic that a thread records takes the lock.
+       */
+      block& local() {
+        static thread_local std::vector<std::pair<std::uint64_t, block*>> owned;
+        for(auto& entry : owned) {
+          if(entry.first == _id) {
+            return *entry.second;
+          }
+        }
+        std::unique_ptr<block> b(new block);
+        block* result = b.get();
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          _blocks.push_back(std::move(b));
+        }
+        owned.push_back(std::make_pair(_id, result));
+        return *result;
+      }
+
+      /**
+       * @brief Appends a single valued metric.
+       */
+      static void append(std::string& out, const char* name, const char* type, const char* help,
+                         const std::uint64_t value) {
+        char line[128];
+        snprintf(line, sizeof(line), "%llu\n", static_cast<unsigned long long>(value));
+        out.append("# HELP ").append(name).append(" ").append(help).append("\n# TYPE ")
+           .append(name).append(" ").append(type).append("\n").append(name).append(" ")
+           .append(line);
+      }
+
+      /**
+       * @brief Gets a unique ID for a new instance.
+       */
+      static std::uint64_t next_id() {
+        static std::atomic<std::uint64_t> id(0);
+        return ++id;
+      }
+
+      /**
+       * @brief ID that threads use to find their blocks of this instance's counters.
+       */
+      const std::uint64_t _id;
+
+      /**
+       * @brief Guards webby::metrics::_blocks.
+       */
+      mutable std::mutex _mutex;
+
+      /**
+       * @brief Blocks of counters, one for each thread that has recorded a statistic. They are
+       *        kept after the thread exits so that its counts are not lost.
+       */
+      std::vector<std::unique_ptr<block>> _blocks;
+  };
+}
@@ -0,0 +1,536 @@
+/**
+ * @file parser.hpp
+ */
+#pragma once
+
+#include <string.h>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <webby/header.hpp>
+#include <webby/method.hpp>
+#include <webby/slice.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Incremental parser for the request line and headers of an HTTP request.
+   *
+   * The parser works directly on a connection's input buffer. Each call to request_parser::parse()
+   * resumes where the previous one stopped, so every byte is scanned once no matter how the
+   * request is split across reads. Tokens are recorded as offsets into the buffer rather than
+   * copied, which keeps them valid if the buffer is reallocated while more data is read. The
+   * header table is reused between requests, so a connection reaches a steady state without any
+   * per-line allocation.
+   */
+  class request_parser {
+    public:
+      /**
+       * @brief Reports a request that cannot be parsed.
+       */
+      class error : public std::runtime_error {
+        public:
+          /**
+           * @brief Constructs the `request_parser::error` object.
+           * @param[in] status_code Status code of the response sent to the client.
+           * @param[in] what_arg Explanatory string.
+           */
+          error(const unsigned short status_code, const std::string& what_arg)
+              : runtime_error(what_arg), _status_code(status_code) { }
+
+          /**
+           * @brief Gets the status code of the response sent to the client.
+           */
+          unsigned short status_code() const {
+            return _status_code;
+          }
+
+        private:
+          /**
+           * @brief Status code of the response sent to the client.
+           */
+          unsigned short _status_code;
+      };
+
+      /**
+       * @brief Location of a token in the input buffer.
+       */
+      struct token {
+        /**
+         * @brief Offset of the first character.
+         */
+        size_t pos;
+
+        /**
+         * @brief Number of characters.
+         */
+        size_t length;
+
+        /**
+         * @brief Gets the token as a slice of the input buffer.
+         * @param[in] base Start of the input buffer.
+         */
+        slice resolve(const char* base) const {
+          return slice(base + pos, length);
+        }
+      };
+
+      /**
+       * @brief Location of a header in the input buffer.
+       */
+      struct field {
+        /**
+         * @brief Name of the header.
+         */
+        token name;
+
+        /**
+         * @brief Value of the header.
+         */
+        token value;
+
+        /**
+         * @brief The header, if it is well known.
+         */
+        header_id id;
+      };
+
+      /**
+       * @brief Constructs the parser.
+       * @param[in] max_header_count Maximum number of headers in a request.
+       * @param[in] max_header_size Maximum size of the request line and headers, in bytes.
+       * @param[in] max_body_size Maximum size of a request body, in bytes, or `0` for no limit.
+       */
+      request_parser(const size_t max_header_count, const size_t max_header_size,
+                     const size_t max_body_size)
+          : _max_header_count(max_header_count), _max_header_size(max_header_size),
+            _max_body_size(max_body_size) {
+        reset();
+      }
+
+      /**
+       * @brief Prepares the parser for the next request.
+       */
+      void reset() {
+        _state = state::REQUEST_LINE;
+        _line = 0;
+        _scan = 0;
+        _method = webby::method::GET;
+        _path = token{0, 0};
+        _version = token{0, 0};
+        _fields.clear();
+        memset(_index, 0, sizeof(_index));
+        _content_length = 0;
+        _has_content_length = false;
+        _chunked = false;
+        _expects_continue = false;
+      }
+
+      /**
+       * @brief Parses as much of the request as is available.
+       * @param[in,out] data Start of the input buffer. Folded header lines are joined in place.
+       * @param[in] length Number of bytes in the input buffer.
+       * @returns `true` once the blank line that ends the headers has been parsed.
+       * @throws request_parser::error if the request is malformed or exceeds the limits.
+       */
+      bool parse(char* data, const size_t length) {
+        while(_state != state::COMPLETE) {
+          const char* eol = _scan < length ? static_cast<const char*>(
+                                  memchr(data + _scan, '\n', length - _scan)) : nullptr;
+          if(eol == nullptr) {
+            _scan = length;
+            if(length > _max_header_size) {
+              throw error(431, "Request headers are too large");
+            }
+            return false;
+          }
+
+          size_t end = static_cast<size_t>(eol - data);
+          _scan = end + 1;
+          if(_scan > _max_header_size) {
+            throw error(431, "Request headers are too large");
+          }
+          if(end > _line && data[end - 1] == '\r') {
+            --end;
+          }
+
+          if(_state == state::REQUEST_LINE) {
+            // Blank lines before the request line are ignored.
+            if(end > _line) {
+              parse_request_line(data, _line, end);
+              _state = state::HEADERS;
+            }
+          }
+          else if(end == _line) {
+            // A request with both would be framed differently by servers that prefer one or the
+            // other, which is how requests are smuggled past proxies.
+            if(_chunked && _has_content_length) {
+              throw error(400, "Both Content-Length and Transfer-Encoding were sent");
+            }
+            _state = state::COMPLETE;
+          }
+          else {
+            parse_header_line(data, _line, end);
+          }
+          _line = _scan;
+        }
+        return true;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether the headers have been completely parsed.
+       */
+      bool complete() const {
+        return _state == state::COMPLETE;
+      }
+
+      /**
+       * @brief Gets the length of the request line and headers, including the blank line.
+       */
+      size_t head_length() const {
+        return _scan;
+      }
+
+      /**
+       * @brief Gets the request method.
+       */
+      webby::method method() const {
+        return _method;
+      }
+
+      /**
+       * @brief Gets the location of the request path.
+       */
+      const token& path() const {
+        return _path;
+      }
+
+      /**
+       * @brief Gets the location of the protocol version, e.g. @c 1.1
+       */
+      const token& version() const {
+        return _version;
+      }
+
+      /**
+       * @brief Gets the locations of the headers, in the order they were received.
+       */
+      const std::vector<field>& fields() const {
+        return _fields;
+      }
+
+      /**
+       * @brief Finds the first occurrence of a well-known header.
+       * @returns The header, or `nullptr` if it was not sent.
+       */
+      const field* find(const header_id id) const {
+        const unsigned index = _index[static_cast<size_t>(id)];
+        return index == 0 ? nullptr : &_fields[index - 1];
+      }
+
+      /**
+       * @brief Gets the value of the `Content-Length` header, or `0` if it was not sent.
+       */
+      size_t content_length() const {
+        return _content_length;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether a `Content-Length` header was sent.
+       */
+      bool has_content_length() const {
+        return _has_content_length;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether the body is sent with
+       *        `Transfer-Encoding: chunked`.
+       */
+      bool chunked() const {
+        return _chunked;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether the client sent `Expect: 100-continue` and
+       *        waits for an interim response before it sends the body.
+       */
+      bool expects_continue() const {
+        return _expects_continue;
+      }
+
+      /**
+       * @brief Gets the maximum size of a request body, or `0` if there is no limit.
+       */
+      size_t max_body_size() const {
+        return _max_body_size;
+      }
+
+    private:
+      /**
+       * @brief Parsing states.
+       */
+      enum class state {
+        REQUEST_LINE, ///< Waiting for the request line.
+        HEADERS,      ///< Parsing header lines.
+        COMPLETE      ///< The blank line that ends the headers has been parsed.
+      };
+
+      /**
+       * @brief Tokenizes the request line.
+       * @param[in] data Start of the input buffer.
+       * @param[in] first Offset of the start of the line.
+       * @param[in] last Offset of the end of the line, excluding its terminator.
+       *
+       * The request line has the format "method [scheme://host[:port]]path HTTP/1.[0|1]"
+       */
+      void parse_request_line(const char* data, const size_t first, const size_t last) {
+        // Finds the space that separates the method from the path.
+        size_t pos = first;
+        while(pos < last && data[pos] != ' ') {
+          ++pos;
+        }
+        if(pos == last) {
+          throw error(400, "Invalid request line: " + std::string(data + first, last - first));
+        }
+        _method = parse_method(data + first, pos - first);
+
+        // Finds the first "/" character in the path, skipping the scheme and host of an absolute
+        // URI.
+        while(pos < last && data[pos] != '/') {
+          ++pos;
+        }
+        const size_t path = pos;
+
+        // Finds the space that separates the path from the protocol.
+        while(pos < last && data[pos] != ' ') {
+          ++pos;
+        }
+        if(path == last || pos == last) {
+          throw error(400, "Invalid request line: " + std::string(data + first, last - first));
+        }
+        _path = token{path, pos - path};
+
+        // Saves the protocol version, e.g. "1.1" from "HTTP/1.1".
+        ++pos;
+        if(last - pos > 5 && strncmp(data + pos, "HTTP/", 5) == 0) {
+          _version = token{pos + 5, last - pos - 5};
+        }
+      }
+
+      /**
+       * @brief Tokenizes a header line.
+       * @param[in] data Start of the input buffer.
+       * @param[in] first Offset of the start of the line.
+       * @param[in] last Offset of the end of the line, excluding its terminator.
+       * @throws request_parser::error if the line is not a valid header.
+       *
+       * Lines that continue the previous header (obsolete line folding) and names that are not
+       * tokens, including names followed by whitespace before the colon, are rejected as
+       * RFC 7230 requires. Servers that accept them parse the framing headers differently from
+       * the proxies in front of them, which is how requests are smuggled.
+       */
+      void parse_header_line(const char* data, const size_t first, const size_t last) {
+        if(data[first] == ' ' || data[first] == '\t') {
+          throw error(400, "Folded header lines are not supported");
+        }
+
+        // Searches for the colon that separates the name from the value.
+        size_t name_last = first;
+        while(name_last < last && is_token_char(data[name_last])) {
+          ++name_last;
+        }
+        if(name_last == first || name_last == last || data[name_last] != ':') {
+          throw error(400, "Invalid header: " + std::string(data + first, last - first));
+        }
+        size_t value_first = name_last + 1;
+        while(value_first < last && (data[value_first] == ' ' || data[value_first] == '\t')) {
+          ++value_first;
+        }
+        size_t value_last = last;
+        while(value_last > value_first &&
+              (data[value_last - 1] == ' ' || data[value_last - 1] == '\t')) {
+          --value_last;
+        }
+
+        if(_fields.size() == _max_header_count) {
+          throw error(431, "Too many request headers");
+        }
+        const header_id id = find_header_id(slice(data + first, name_last - first));
+        _fields.push_back(field{token{first, name_last - first},
+                                token{value_first, value_last - value_first}, id});
+        if(id != header_id::UNKNOWN && _index[static_cast<size_t>(id)] == 0) {
+          _index[static_cast<size_t>(id)] = static_cast<unsigned>(_fields.size());
+        }
+
+        // The framing of the body is needed by the server itself, so it is interpreted here.
+        const slice value(data + value_first, value_last - value_first);
+        if(id == header_id::CONTENT_LENGTH) {
+          // Repeated headers that disagree would let an intermediary frame the body differently.
+          const size_t length = parse_content_length(value);
+          if(_has_content_length && length != _content_length) {
+            throw error(400, "Conflicting Content-Length headers");
+          }
+          if(_max_body_size != 0 && length > _max_body_size) {
+            throw error(413, "Request body is too large");
+          }
+          _content_length = length;
+          _has_content_length = true;
+        }
+        else if(id == header_id::TRANSFER_ENCODING) {
+          // Chunked must be the last coding applied; no other codings are supported.
+          if(!value.equals_nocase("chunked")) {
+            throw error(501, "Unsupported Transfer-Encoding: " + value.str());
+          }
+          _chunked = true;
+        }
+        else if(id == header_id::EXPECT) {
+          _expects_continue = value.equals_nocase("100-continue");
+        }
+      }
+
+      /**
+       * @brief Gets a value that indicates whether a character may be part of a token, such as
+       *        the name of a header.
+       */
+      static bool is_token_char(const char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+               (c != '\0' && strchr("!#$%&'*+-.^_`|~", c) != nullptr);
+      }
+
+      /**
+       * @brief Parses the value of a `Content-Length` header.
+       * @param[in] value The value, without surrounding whitespace.
+       * @returns The length.
+       * @throws request_parser::error if the value is not a number made only of digits, or if it
+       *         does not fit in a `size_t`.
+       */
+      static size_t parse_content_length(const slice& value) {
+        if(value.empty()) {
+          throw error(400, "Invalid Content-Length header");
+        }
+        size_t length = 0;
+        for(size_t i = 0; i < value.length(); ++i) {
+          const char c = value[i];
+          if(c < '0' || c > '9') {
+            throw error(400, "Invalid Content-Length header");
+          }
+          const size_t digit = static_cast<size_t>(c - '0');
+          if(length > (std::numeric_limits<size_t>::max() - digit) / 10) {
+            throw error(400, "Content-Length header is too large");
+          }
+          length = length * 10 + digit;
+        }
+        return length;
+      }
+
+      /**
+       * @brief Converts a method token into a webby::method.
+       * @param[in] data First character of the token.
+       * @param[in] length Length of the token.
+       */
+      static webby::method parse_method(const char* data, const size_t length) {
+        switch(length) {
+          case 3:
+            if(strncasecmp(data, "GET", 3) == 0) return webby::method::GET;
+            if(strncasecmp(data, "PUT", 3) == 0) return webby::method::PUT;
+            break;
+          case 4:
+            if(strncasecmp(data, "POST", 4) == 0) return webby::method::POST;
+            if(strncasecmp(data, "HEAD", 4) == 0) return webby::method::HEAD;
+            break;
+          case 5:
+            if(strncasecmp(data, "TRACE", 5) == 0) return webby::method::TRACE;
+            break;
+          case 6:
+            if(strncasecmp(data, "DELETE", 6) == 0) return webby::method::DELETE;
+            break;
+          case 7:
+            if(strncasecmp(data, "OPTIONS", 7) == 0) return webby::method::OPTIONS;
+            if(strncasecmp(data, "CONNECT", 7) == 0) return webby::method::CONNECT;
+            break;
+        }
+        throw error(501, "Unsupported request method: " + std::string(data, length));
+      }
+
+      /**
+       * @brief Maximum number of headers in a request.
+       */
+      const size_t _max_header_count;
+
+      /**
+       * @brief Maximum size of the request line and headers.
+       */
+      const size_t _max_header_size;
+
+      /**
+       * @brief Maximum size of a request body, or `0`.
+       */
+      const size_t _max_body_size;
+
+      /**
+       * @brief Current parsing state.
+       */
+      state _state;
+
+      /**
+       * @brief Offset of the start of the line being parsed.
+       */
+      size_t _line;
+
+      /**
+       * @brief Offset of the first byte that has not been scanned.
+       */
+      size_t _scan;
+
+      /**
+       * @brief Request method.
+       */
+      webby::method _method;
+
+      /**
+       * @brief Request path.
+       */
+      token _path;
+
+      /**
+       * @brief Protocol version.
+       */
+      token _version;
+
+      /**
+       * @brief Headers, in the order they were received.
+       */
+      std::vector<field> _fields;
+
+      /**
+       * @brief Position of the first occurrence of each well-known header in
+       *        request_parser::_fields plus one, or `0`.
+       */
+      unsigned _index[static_cast<size_t>(header_id::COUNT)];
+
+      /**
+       * @brief Value of the `Content-Length` header.
+       */
+      size_t _content_length;
+
+      /**
+       * @brief `true` if a `Content-Length` header was sent.
+       */
+      bool _has_content_length;
+
+      /**
+       * @brief `true` if the body is chunked.
+       */
+      bool _chunked;
+
+      /**
+       * @brief `true` if the client sent `Expect: 100-continue`.
+       */
+      bool _expects_continue;
+  };
+}
@@ -4,8 +4,17 @@
 
 #pragma once
 
-#include <map>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <webby/arena.hpp>
+#include <webby/body_reader.hpp>
 #include <webby/method.hpp>
+#include <webby/connection.hpp>
+#include <webby/parser.hpp>
+#include <webby/slice.hpp>
 #include <webby/utility.hpp>
 
 /**
@@ -17,6 +26,9 @@ namespace webby {
 
   /**
    * @brief Representation of an HTTP request.
+   *
+   * The path and headers are slices of the connection's input buffer, and are only valid for the
+   * lifetime of the request. Copy them with webby::slice::str() to keep them longer.
    */
   class request {
     public:
@@ -38,14 +50,57 @@ namespace webby {
           explicit error(const char* what_arg) : runtime_error(what_arg) { }
       };
 
+      /**
+       * @brief Names and values of the path parameters captured by the router.
+       */
+      typedef std::vector<std::pair<slice, slice>, arena_allocator<std::pair<slice, slice>>>
+          param_list;
+
+      /**
+       * @brief Constructs a new webby::request object from a @p connection.
+       * @param[in] config Server configuration.
+       * @param[in] connection Connection used to communicate with the connected host. The
+       *                       request line and headers must already have been parsed.
+       *
+       * The server constructs the request for each handler. It can also be constructed over a
+       * webby::memory_connection to drive handlers without a network.
+       */
+      request(const webby::config& config, webby::connection& connection) :
+            _config(config), _connection(connection),
+            _params(param_list::allocator_type(connection.arena())),
+            _body(connection) {
+        WEBBY_DEBUG(_config) << "request::request()" << std::endl;
+        if(WEBBY_LOG_ENABLED(_config, DEBUG)) {
+          const char* base = _connection.input();
+          WEBBY_DEBUG(_config) << "  Request Path: " << _connection.parser().path().resolve(base)
+                               << std::endl;
+          for(auto& field : _connection.parser().fields()) {
+            WEBBY_DEBUG(_config) << "  " << field.name.resolve(base) << ": "
+                                 << field.value.resolve(base) << std::endl;
+          }
+        }
+      }
+
       /**
        * @brief Gets a header value.
        * @param[in] name Name of the header.
        * @returns The value of the header.
+       * @throws std::out_of_range if the header does not exist.
        */
-      const std::string& header(const std::string& name) {
-        _config.error_log() << qlog::debug << "request::header()" << std::endl;
-        return _header.at(name);
+      slice header(const slice& name) const {
+        WEBBY_DEBUG(_config) << "request::header()" << std::endl;
+        return value(find(name));
+      }
+
+      /**
+       * @brief Gets the value of a well-known header.
+       * @param[in] id The header.
+       * @returns The value of the header.
+       * @throws std::out_of_range if the header does not exist.
+       */
+      slice header(const header_id id) const {
+        WEBBY_DEBUG(_config) << "request::header()" << std::endl;
+        return value(_connection.parser().find(id));
       }
 
       /**
@@ -53,17 +108,26 @@ namespace webby {
        * @param[in] name Name of the header to check.
        * @returns `true` if the header exists; otherwise `false`.
        */
-      bool has_header(const std::string& name) {
-        _config.error_log() << qlog::debug << "request::has_header()" << std::endl;
-        return _header.count(name) == 1;
+      bool has_header(const slice& name) const {
+        WEBBY_DEBUG(_config) << "request::has_header()" << std::endl;
+        return find(name) != nullptr;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether a well-known header is defined.
+       * @param[in] id The header.
+       * @returns `true` if the header exists; otherwise `false`.
+       */
+      bool has_header(const header_id id) const {
+        return _connection.parser().find(id) != nullptr;
       }
 
       /**
        * @brief Gets the request method, e.g. @c GET/POST/HEAD etc.
        */
       webby::method method() const {
-        _config.error_log() << qlog::debug << "request::method()" << std::endl;
-        return _method;
+        WEBBY_DEBUG(_config) << "request::method()" << std::endl;
+        return _connection.parser().method();
       }
 
       /**
@@ -71,9 +135,9 @@ namespace webby {
        *
        * This is in the form @c /path/of/request
        */
-      const std::string& path() const {
-        _config.error_log() << qlog::debug << "request::path()" << std::endl;
-        return _path;
+      slice path() const {
+        WEBBY_DEBUG(_config) << "request::path()" << std::endl;
+        return _connection.parser().path().resolve(_connection.input());
       }
 
       /**
@@ -82,197 +146,184 @@ namespace webby {
        * @param[in] length Length of the buffer,
        * @param[in] peek   @c false to perform a normal read, @c true to read the data from the
        *                   request without removing it from the input queue.
-       * @returns The number of bytes actually read from the request.
+       * @returns The number of bytes actually read from the request, or `0` once the whole body
+       *          has been read.
+       * @throws request_parser::error if the body is malformed or larger than
+       *         webby::config::max_body_size(). If the handler lets it propagate, the server
+       *         answers with its status code, e.g. `413 Request Entity Too Large`, if the response
+       *         has not been started, and closes the connection.
+       *
+       * The body ends after the number of bytes given by the `Content-Length` header, or, with
+       * `Transfer-Encoding: chunked`, at the last chunk. Chunked bodies are decoded as they are
+       * read. With `webby::engine::EPOLL` the whole body has been received before the handler
+       * runs, so the reads never wait for the client.
        */
       unsigned read_block(char* buffer, const size_t length, const bool peek = false) const {
-        _config.error_log() << qlog::debug << "request::read_block()" << std::endl;
-        return _worker.read(buffer, length, peek);
-      }
-
-      const std::string& route() const {
-        _config.error_log() << qlog::debug << "request::route()" << std::endl;
-        return _route;
+        WEBBY_DEBUG(_config) << "request::read_block()" << std::endl;
+        return static_cast<unsigned>(_body.read(buffer, length, peek));
       }
 
       /**
-       * @brief Sets the route that caused this request to be invoked.
-       * @param[in] route Route that caused this request to be invoked.
-       * @returns Reference to this webby::response object for chaining.
+       * @brief Reads the rest of the body of the request.
+       * @param[out] body Receives the body.
+       * @throws request_parser::error as request::read_block() does.
        */
-      request& set_route(const std::string& route) {
-        _route = route;
-        return *this;
+      void read_body(std::string& body) const {
+        char buffer[16384];
+        size_t count;
+        while((count = _body.read(buffer, sizeof(buffer), false)) > 0) {
+          body.append(buffer, count);
+        }
       }
 
-    protected:
-
       /**
-       * @brief Constructs a new webby::request object from a @p worker socket.
-       * @param[in] worker Worker socket used to communicate with the connected host.
+       * @brief Gets a value that indicates whether the request has a body.
        */
-      request(const webby::config& config, const net::worker& worker) :
-            _config(config), _worker(worker) {
-        _config.error_log() << qlog::debug << "request::request()" << std::endl;
-        process_request_line();
-        process_header_lines();
+      bool has_body() const {
+        return _body.chunked() || _connection.parser().content_length() > 0;
       }
 
       /**
-       * @brief Extracts the method and path from the first line of the request.
-       * @throws webby::request::error if the request line was not valid.
+       * @brief Gets the HTTP version of the request, e.g. @c 1.1
        *
-       * The first line of an HTTP request contains the method, path, and protocol in the following
-       * format: "method [host[:port]]path HTTP/1.[0|1]"
+       * Requests that do not specify a version are treated as HTTP/1.0.
        */
-      void process_request_line() {
-        _config.error_log() << qlog::debug << "request::process_request_line()" << std::endl;
-        std::string request_line = _worker.read_line();
-        std::string::const_iterator first = request_line.cbegin();
-        std::string::const_iterator last = request_line.cbegin();
-
-        // Finds the space that separates the method from the path.
-        while(last != request_line.cend() && *last != ' ') {
-          ++last;
-        }
-
-        // Throws an exception if the method could not be found.
-        if(last == request_line.cend()) {
-          std::ostringstream msg;
-          msg << "Invalid request line: " << request_line;
-          throw request::error(msg.str());
-        }
-
-        // Stores the method.
-        std::string m = lowercase(std::string(first, last));
-        first = last;
-
-        if(m == "connect") {
-          _method = method::CONNECT;
-        }
-        else if(m == "delete") {
-          _method = method::DELETE;
-        }
-        else if(m == "get") {
-          _method = method::GET;
-        }
-        else if(m == "head") {
-          _method = method::HEAD;
-        }
-        else if(m == "options") {
-          _method = method::OPTIONS;
-        }
-        else if(m == "post") {
-          _method = method::POST;
-        }
-        else if(m == "put") {
-          _method = method::PUT;
-        }
-        else if(m == "trace") {
-          _method = method::TRACE;
-        }
-
-        _config.error_log() << qlog::debug << "  Request Method: " << m << std::endl;
+      slice version() const {
+        slice version = _connection.parser().version().resolve(_connection.input());
+        return version.empty() ? slice("1.0") : version;
+      }
 
-        // Finds the first "/" character in the path.
-        while(first != request_line.cend() && *first != '/') {
-          ++first;
+      /**
+       * @brief Gets a value that indicates whether the client wants the connection kept open.
+       * @returns `true` if the request carries `Connection: keep-alive`, or if it is an HTTP/1.1
+       *          request that does not carry `Connection: close`; otherwise `false`.
+       */
+      bool keep_alive() const {
+        const request_parser::field* connection =
+            _connection.parser().find(header_id::CONNECTION);
+        if(connection != nullptr) {
+          slice value = connection->value.resolve(_connection.input());
+          if(value.contains_nocase("close")) {
+            return false;
+          }
+          if(value.contains_nocase("keep-alive")) {
+            return true;
+          }
         }
+        return version() == "1.1";
+      }
 
-        // Throws an exception if the beginning of the path could not be found.
-        if(first == request_line.cend()) {
-          std::ostringstream msg;
-          msg << "Invalid request line: " << request_line;
-          throw request::error(msg.str());
-        }
+      /**
+       * @brief Gets the route that caused this request to be invoked, e.g. @c /item/:id
+       */
+      slice route() const {
+        WEBBY_DEBUG(_config) << "request::route()" << std::endl;
+        return _route;
+      }
 
-        last = first;
+      /**
+       * @brief Sets the route that caused this request to be invoked.
+       * @param[in] route Route that caused this request to be invoked. It is not copied, and must
+       *                  outlive the request.
+       * @returns Reference to this webby::response object for chaining.
+       */
+      request& set_route(const slice& route) {
+        _route = route;
+        return *this;
+      }
 
-        // Finds the space that separates the path from the protocol.
-        while(last != request_line.cend() && *last != ' ') {
-          ++last;
+      /**
+       * @brief Gets the value of a path parameter.
+       * @param[in] name Name of the parameter, without the leading `:`.
+       * @returns The part of the path matched by the parameter.
+       * @throws std::out_of_range if the route has no such parameter.
+       *
+       * A request routed by `/item/:id` for the path `/item/42` has the parameter `id` set to
+       * `42`.
+       */
+      slice param(const slice& name) const {
+        WEBBY_DEBUG(_config) << "request::param()" << std::endl;
+        for(auto& param : _params) {
+          if(param.first == name) {
+            return param.second;
+          }
         }
+        throw std::out_of_range("request::param");
+      }
 
-        // Throws an exception if the path could not be found.
-        if(last == request_line.cend()) {
-          std::ostringstream msg;
-          msg << "Invalid request line: " << request_line;
-          throw request::error(msg.str());
+      /**
+       * @brief Gets a value that indicates whether a path parameter is defined.
+       * @param[in] name Name of the parameter, without the leading `:`.
+       * @returns `true` if the parameter exists; otherwise `false`.
+       */
+      bool has_param(const slice& name) const {
+        for(auto& param : _params) {
+          if(param.first == name) {
+            return true;
+          }
         }
+        return false;
+      }
 
-        // Saves the path.
-        _path = std::string(first, last);
-        _config.error_log() << qlog::debug << "  Request Path: " << _path << std::endl;
+      /**
+       * @brief Sets the path parameters captured by the router.
+       * @param[in] params Names and values of the parameters.
+       * @returns Reference to this webby::request object for chaining.
+       */
+      request& set_params(const param_list& params) {
+        _params = params;
+        return *this;
       }
 
       /**
-       * @brief Extracts headers from the request
+       * @brief Gets the arena that backs this request and its response.
        *
-       * Each header has the format, "header-name: value". The name is case insensitive. The line
-       * is terminated with a CRLF. It is possible to split a long value over multiple lines by
-       * terminating each line with a comma. For example, the following two headers are identical:
-       *
-       *     header1: value 1, value 2
-       *     HEADER1: value 1,
-       *              value 2
-       *
-       * The headers appear immediately after the HTTP request line, and are separated from the
-       * request body by a blank line that is terminated with a CRLF.
-       *
-       * NOTE: Invalid headers (those that could not be parsed properly) are ignored rather than
-       * throwing exceptions as this does not affect the server itself, only request handlers.
+       * Handlers may allocate scratch memory from it with webby::arena_allocator. The memory is
+       * released once the response has been sent.
        */
-      void process_header_lines() {
-        _config.error_log() << qlog::debug << "request::process_header_lines()" << std::endl;
-        std::string header_line = _worker.read_line();
-        std::string name;
-
-        // The request headers are separated from the request body by a blank line.
-        while(header_line.length() > 0) {
-          std::string::const_iterator itr = header_line.cbegin();
-
-          // Skips past whitespace at the beginning of the line.
-          while(itr != header_line.cend() && *itr == ' ') {
-            ++itr;
-          }
-
-          // Removes the whitespace.
-          header_line = std::string(itr, header_line.cend());
-          itr = header_line.cbegin();
+      webby::arena& arena() const {
+        return _connection.arena();
+      }
 
-          // If the value of the previous header ends in a comma, then this entire line is
-          // appended to that value.
-          if(name.length() > 0 && *(_header[name].crend()) == ',') {
-            _header[name] = _header[name] + std::string(" ") + header_line;
-          }
+    protected:
+      /**
+       * @brief Reads and discards the part of the body that the handler did not read.
+       *
+       * This leaves the connection positioned at the start of the next request.
+       */
+      void discard_body() {
+        _body.discard();
+      }
 
-          else {
-            // Search for the colon that separates the name from the value.
-            while(itr != header_line.cend() && *itr != ':') {
-              ++itr;
-            }
-
-            if(itr != header_line.cend()) {
-              // Saves the name of the header.
-              name = std::string(header_line.cbegin(), itr);
-
-              // Finds the value.
-              ++itr;
-              while(itr != header_line.cend() && *itr == ' ') {
-                ++itr;
-              }
-
-              // Saves the key and the value in the map
-              _header[name] = std::string(itr, header_line.cend());
-            }
+    private:
+      /**
+       * @brief Finds a header.
+       * @param[in] name Name of the header, which is not case sensitive.
+       * @returns The header, or `nullptr` if it does not exist.
+       */
+      const request_parser::field* find(const slice& name) const {
+        const header_id id = find_header_id(name);
+        if(id != header_id::UNKNOWN) {
+          return _connection.parser().find(id);
+        }
+        const char* base = _connection.input();
+        for(auto& field : _connection.parser().fields()) {
+          if(field.id == header_id::UNKNOWN && field.name.resolve(base).equals_nocase(name)) {
+            return &field;
           }
-
-          header_line = _worker.read_line();
         }
+        return nullptr;
+      }
 
-        for(auto itr = _header.cbegin(); itr != _header.cend(); ++itr) {
-          _config.error_log() << qlog::debug << "  " << (*itr).first << ": " << (*itr).second <<
-              std::endl;
+      /**
+       * @brief Gets the value of a header found by request::find().
+       * @throws std::out_of_range if @p field is `nullptr`.
+       */
+      slice value(const request_parser::field* field) const {
+        if(field == nullptr) {
+          throw std::out_of_range("request::header");
         }
+        return field->value.resolve(_connection.input());
       }
 
     // Fields.
@@ -283,29 +334,24 @@ namespace webby {
       const webby::config& _config;
 
       /**
-       * @brief Worker socket.
-       */
-      const net::worker& _worker;
-
-      /**
-       * @brief Request method.
+       * @brief Connection to the connected host.
        */
-      webby::method _method;
+      webby::connection& _connection;
 
       /**
-       * @brief Path of the request.
+       * @brief Route that caused the request to be invoked.
        */
-      std::string _path;
+      slice _route;
 
       /**
-       * @brief Route that caused the request to be invoked.
+       * @brief Path parameters captured by the router.
        */
-      std::string _route;
+      param_list _params;
 
       /**
-       * @brief Headers.
+       * @brief Reads the body of the request.
        */
-      std::map<std::string, std::string, no_case_compare> _header;
+      mutable body_reader _body;
 
     // Friends
     friend class webby::server;
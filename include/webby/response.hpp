@@ -3,15 +3,28 @@
  */
 #pragma once
 
-#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/uio.h>
+#include <webby/arena.hpp>
+#include <webby/compression.hpp>
+#include <webby/connection.hpp>
+#include <webby/date_cache.hpp>
+#include <webby/deferred.hpp>
+#include <webby/header.hpp>
 #include <webby/utility.hpp>
 
 /**
  * @namespace webby
  */
 namespace webby {
-  // Forward reference.
+  // Forward references.
+  class cache_handler;
   class server;
 
   /**
@@ -37,15 +50,50 @@ namespace webby {
           explicit error(const char* what_arg) : runtime_error(what_arg) { }
       };
 
+      /**
+       * @brief Constructs a new webby::response object from a @p connection.
+       * @param[in] config Server configuration.
+       * @param[in] connection Connection used to communicate with the connected host.
+       *
+       * The server constructs the response for each handler. It can also be constructed over a
+       * webby::memory_connection to drive handlers without a network.
+       */
+      response(const webby::config& config, webby::connection& connection) :
+          _config(config),
+          _header(connection.arena()),
+          _sent_headers(false), _chunked(false), _finished(false), _accepts_gzip(false),
+          _output(arena_allocator<char>(connection.arena())), _status_code(200),
+          _connection(connection), _version("1.1"), _bytes_sent(0), _capture(nullptr),
+          _hold(false) {
+        WEBBY_DEBUG(_config) << "response::response()" << std::endl;
+      }
+
+      /**
+       * @brief Destroys the webby::response object.
+       *
+       * If the response has not yet been sent it is sent at this time.
+       */
+      ~response() {
+        WEBBY_DEBUG(_config) << "response::~response()" << std::endl;
+
+        // Errors cannot be thrown from a destructor, so they are logged instead.
+        try {
+          finish();
+        }
+        catch(const std::exception& e) {
+          WEBBY_ERROR(_config) << e.what() << std::endl;
+        }
+      }
+
       /**
        * @brief Sets a header value.
        * @param[in] name Name of the header.
        * @param[in] value Value of the header.
        * @returns Reference to this webby::response object for chaining.
        */
-      response& set_header(const std::string& name, const std::string& value) {
-        _config.error_log() << qlog::debug << "response::set_header" << std::endl;
-        _header[name] = value;
+      response& set_header(const slice& name, const slice& value) {
+        WEBBY_DEBUG(_config) << "response::set_header" << std::endl;
+        _header.set(name, value);
         return *this;
       }
 
@@ -55,8 +103,8 @@ namespace webby {
        * @returns Reference to this webby::response object for chaining.
        */
       response& set_status_code(unsigned short status_code) {
-        _config.error_log() << qlog::debug << "response::set_status_code" << std::endl;
-        if(0 == _status_map.count(status_code)) {
+        WEBBY_DEBUG(_config) << "response::set_status_code" << std::endl;
+        if(status_line(status_code).empty()) {
           throw response::error("Invalid status code.");
         }
         _status_code = status_code;
@@ -71,7 +119,7 @@ namespace webby {
        * In general this function should not be needed. The default HTTP version is 1.1.
        */
       response& set_version(const std::string& version) {
-        _config.error_log() << qlog::debug << "response::set_version" << std::endl;
+        WEBBY_DEBUG(_config) << "response::set_version" << std::endl;
         _version = version;
         return *this;
       }
@@ -82,90 +130,395 @@ namespace webby {
        * @param[in] length Length of the data buffer.
        *
        * When response::write_block() is invoked for the first time all of the headers are
-       * transmitted to the connected host. If the `Content-Length` header was not set, then a
-       * webby::response::error exception is thrown. The `Content-Length` header is not mandatory,
-       * but has become a de-facto standard, and is enforced.
+       * transmitted to the connected host. If the `Content-Length` header was not set, then the
+       * body is streamed as though response::start_chunked() had been called first. The same
+       * happens if the body is compressed; see webby::config::set_compression().
+       *
+       * Small blocks are buffered along with the headers and sent together, so a small response
+       * costs a single system call; see webby::config::set_response_buffer_size().
        */
       void write_block(const unsigned char* data, const unsigned long length) {
-        _config.error_log() << qlog::debug << "response::write_block" << std::endl;
+        WEBBY_DEBUG(_config) << "response::write_block" << std::endl;
 
         // Sends the headers if necessary.
         if(!_sent_headers) {
-          if(_header.count("Content-Length") == 0) {
-            throw response::error("The Content-Length header was not provided.");
+          if(_header.find(header_id::CONTENT_LENGTH) == nullptr || negotiate_encoding()) {
+            start_chunked();
+          }
+          else {
+            send_headers();
+          }
+        }
+
+        if(_finished) {
+          throw response::error("The response has already been finished.");
+        }
+
+        if(_capture != nullptr) {
+          _capture->append(reinterpret_cast<const char*>(data), length);
+        }
+
+#ifdef WEBBY_HAVE_ZLIB
+        if(_gzip) {
+          _gzip->write(data, length);
+          return;
+        }
+#endif
+        write_body(data, length);
+      }
+
+      /**
+       * @brief Sends a range of a file as the body, or as part of it.
+       * @param[in] fd Descriptor of an open file. It remains owned by the caller, and may be
+       *               closed as soon as this function returns.
+       * @param[in] offset Offset of the first byte to send.
+       * @param[in] length Number of bytes to send.
+       *
+       * If the headers have not been sent yet the `Content-Length` header defaults to
+       * @p length. Where the connection supports it the file is copied to the socket by the
+       * kernel with `sendfile(2)`, without passing through the server's memory.
+       */
+      void send_file(const int fd, const off_t offset, const unsigned long length) {
+        WEBBY_DEBUG(_config) << "response::send_file" << std::endl;
+
+        if(!_sent_headers) {
+          if(_header.find(header_id::CONTENT_LENGTH) == nullptr) {
+            _header.set(header_id::CONTENT_LENGTH, std::to_string(length));
           }
           send_headers();
         }
 
-        // Send the data to the connected host.
-        _worker.write(data, length);
+        if(_finished) {
+          throw response::error("The response has already been finished.");
+        }
+
+        // The file is not copied into the capture, which is abandoned instead, and the output
+        // that was held back goes ahead of it.
+        _capture = nullptr;
+        _hold = false;
+
+        if(_chunked) {
+          if(length == 0) {
+            return;
+          }
+          write_chunk_size(length);
+        }
+
+        // The buffered output goes first, and is held back to share a packet with the file.
+        flush_output(true);
+        _connection.send_file(fd, offset, length);
+        if(_chunked) {
+          _output.append("\r\n", 2);
+        }
         _bytes_sent += length;
       }
 
-    protected:
       /**
-       * @brief Constructs a new webby::response object from a @p worker socket.
-       * @param[in] worker Worker socket used to communicate with the connected host.
+       * @brief Sends all of the buffered output now.
+       *
+       * The headers and small body blocks are normally buffered until
+       * webby::config::response_buffer_size() bytes are pending or the response is finished. A
+       * handler that streams events as they happen calls this after each one. A compressed body
+       * is flushed out of the compressor first, at some cost to the compression ratio.
        */
-      response(const webby::config& config, const net::worker& worker) :
-          _config(config), _sent_headers(false), _worker(worker), _version("1.1"), _bytes_sent(0) {
-        _config.error_log() << qlog::debug << "response::response()" << std::endl;
+      void flush() {
+        WEBBY_DEBUG(_config) << "response::flush" << std::endl;
+#ifdef WEBBY_HAVE_ZLIB
+        if(_gzip) {
+          _gzip->flush();
+        }
+#endif
+        flush_output(false);
       }
 
       /**
-       * @brief Destroys the webby::response object.
+       * @brief Starts streaming a body of unknown length.
+       * @returns Reference to this webby::response object for chaining.
+       * @throws webby::response::error if the headers have already been sent.
        *
-       * If the response has not yet been sent it is sent at this time.
+       * The status line and headers are committed immediately, and each later call to
+       * response::write_block() is sent as a single chunk with `Transfer-Encoding: chunked`. Use
+       * response::flush() to push chunks out before the output buffer fills up. The body is ended
+       * when the response is destroyed. Clients that do not understand chunked
+       * encoding receive the body as is, and the connection is closed to mark its end.
+       *
+       * If compression is enabled and the `Content-Type` allows it, the body is compressed with
+       * gzip before it is split into chunks.
        */
-      ~response() {
-        _config.error_log() << qlog::debug << "response::~response()" << std::endl;
+      response& start_chunked() {
+        WEBBY_DEBUG(_config) << "response::start_chunked" << std::endl;
+        if(_sent_headers) {
+          throw response::error("The headers have already been sent.");
+        }
+#ifdef WEBBY_HAVE_ZLIB
+        if(negotiate_encoding()) {
+          _header.set(header_id::CONTENT_ENCODING, "gzip");
+          _gzip.reset(new gzip_stream(_config.compression_level(),
+              [this](const unsigned char* data, size_t length) { write_body(data, length); }));
+        }
+#endif
+        _header.erase(header_id::CONTENT_LENGTH);
+        slice version = _connection.parser().version().resolve(_connection.input());
+        if(version == "1.1") {
+          _header.set(header_id::TRANSFER_ENCODING, "chunked");
+          _chunked = true;
+        }
+        else {
+          _header.set(header_id::CONNECTION, "close");
+        }
+        send_headers();
+        return *this;
+      }
 
-        // Sends the headers if necessary.
+      /**
+       * @brief Defers the response so that the handler can return before it is complete.
+       * @returns Handle that completes the response later, from any thread.
+       * @throws webby::response::error if the response has already been deferred or finished.
+       *
+       * See webby::deferred. Whatever the handler has already written is sent as usual, and the
+       * rest of the response is written by the function passed to deferred::complete().
+       */
+      deferred defer() {
+        WEBBY_DEBUG(_config) << "response::defer" << std::endl;
+        if(_deferred || _finished) {
+          throw response::error("The response cannot be deferred.");
+        }
+        _deferred = std::make_shared<deferred::state>();
+        return deferred(_deferred);
+      }
+
+    protected:
+      /**
+       * @brief Sends the headers if the handler did not write a body, or ends a chunked body.
+       */
+      void finish() {
+        if(_finished) {
+          return;
+        }
         if(!_sent_headers) {
-          if(_header.count("Content-Length") == 0) {
-            _header["Content-Length"] = "0";
+          // 1xx, 204 and 304 responses never have a body, so they do not describe its length.
+          if(_header.find(header_id::CONTENT_LENGTH) == nullptr && _status_code >= 200 &&
+             _status_code != 204 && _status_code != 304) {
+            _header.set(header_id::CONTENT_LENGTH, "0");
           }
           send_headers();
         }
+        else {
+#ifdef WEBBY_HAVE_ZLIB
+          if(_gzip) {
+            _gzip->finish();
+            _gzip.reset();
+          }
+#endif
+          if(_chunked) {
+            _output.append("0\r\n\r\n", 5);
+          }
+        }
+        _finished = true;
+        flush_output(false);
       }
 
       /**
-       * @brief Sends the status line and headers to the connected host.
+       * @brief Replaces the response with an error, or abandons it if it has already started.
+       * @param[in] status_code Status code of the error.
+       *
+       * Either way the connection is closed afterwards, so a response that was cut short cannot
+       * be mistaken for a complete one.
+       */
+      void fail(const unsigned short status_code) {
+        if(!_sent_headers) {
+          _header = header_list(_connection.arena());
+          _header.set(header_id::CONNECTION, "close");
+          _status_code = status_code;
+        }
+        else {
+          flush_output(false);
+          _finished = true;
+        }
+      }
+
+      /**
+       * @brief Serializes the status line and headers into the output buffer.
        */
       void send_headers() {
-        _config.error_log() << qlog::debug << "response::send_headers()" << std::endl;
-        std::ostringstream res;
+        WEBBY_DEBUG(_config) << "response::send_headers()" << std::endl;
+
+        // The status line is preformatted for HTTP/1.1; other versions reuse the part after the
+        // version, "NNN Reason\r\n".
+        const std::string& status = status_line(_status_code);
+        const bool default_version = _version == "1.1";
+        const size_t status_length = default_version ? status.length()
+                                                     : 5 + _version.length() + status.length() - 8;
+
+        // Measures the headers so that they are copied into a single buffer.
+        size_t length = status_length + 6 + date_cache::length + 4;
+        for(auto& header : _header) {
+          length += header.name.length() + 2 + header.value.length() + 2;
+        }
 
-        // Generates the status line.
-        res << "HTTP/" << _version << " " << _status_code << " " << _status_map[_status_code]
-          << "\r\n";
+        const size_t start = _output.length();
+        _output.resize(start + length);
+        char* out = &_output[start];
+        if(default_version) {
+          out = copy(out, status.data(), status.length());
+        }
+        else {
+          out = copy(out, "HTTP/", 5);
+          out = copy(out, _version.data(), _version.length());
+          out = copy(out, status.data() + 8, status.length() - 8);
+        }
+        for(auto& header : _header) {
+          out = copy(out, header.name.data(), header.name.length());
+          out = copy(out, ": ", 2);
+          out = copy(out, header.value.data(), header.value.length());
+          out = copy(out, "\r\n", 2);
+        }
+        out = copy(out, "Date: ", 6);
+        out = copy(out, date_cache::now(), date_cache::length);
+        copy(out, "\r\n\r\n", 4);
+
+        // Flag that the headers have been sent.
+        _sent_headers = true;
+      }
 
-        // Adds all of the headers.
-        for(auto header = _header.cbegin(); header != _header.cend(); ++header) {
-          res << header->first << ": " << header->second << "\r\n";
+    private:
+      /**
+       * @brief Sends part of the body, framed as a chunk if necessary.
+       * @param[in] data Data to send.
+       * @param[in] length Length of the data.
+       */
+      void write_body(const unsigned char* data, const unsigned long length) {
+        // Empty chunks are skipped because a zero length chunk ends the body.
+        if(_chunked) {
+          if(length == 0) {
+            return;
+          }
+          write_chunk_size(length);
         }
 
-        // Adds the RFC 1123 Date header.
-        struct tm* timeinfo;
-        char buffer [80];
-        memset(buffer, 0, 80);
-        time_t tt = time(nullptr);
-        timeinfo = gmtime(&tt);
-        strftime (buffer, 80, "%a, %d %b %Y %H:%M:%S GMT", timeinfo);
-        res << "Date: " << buffer << "\r\n";
+        if(_hold || _output.length() + length + 2 <= _config.response_buffer_size()) {
+          _output.append(reinterpret_cast<const char*>(data), length);
+          if(_chunked) {
+            _output.append("\r\n", 2);
+          }
+        }
+        else {
+          // Large blocks are sent along with the buffered output without being copied.
+          struct iovec iov[3];
+          iov[0].iov_base = &_output[0];
+          iov[0].iov_len = _output.length();
+          iov[1].iov_base = const_cast<unsigned char*>(data);
+          iov[1].iov_len = length;
+          iov[2].iov_base = const_cast<char*>("\r\n");
+          iov[2].iov_len = 2;
+          _connection.writev(iov, _chunked ? 3 : 2, false);
+          _output.clear();
+        }
+        _bytes_sent += length;
+      }
 
-        // Blank line.
-        res << "\r\n";
+      /**
+       * @brief Sends the buffered output.
+       * @param[in] more `true` if more output follows straight away.
+       */
+      void flush_output(const bool more) {
+        if(_output.empty() || _hold) {
+          return;
+        }
+        struct iovec iov;
+        iov.iov_base = &_output[0];
+        iov.iov_len = _output.length();
+        _connection.writev(&iov, 1, more);
+        _output.clear();
+      }
 
-        const std::string& str = res.str();
-        _worker.write(str.c_str(), str.length());
+      /**
+       * @brief Decides whether the body is compressed.
+       * @returns `true` if the body should be compressed with gzip.
+       *
+       * Compression applies to `200 OK` responses whose `Content-Type` is listed in
+       * webby::config::compression_types(), that are not already encoded, and that are either
+       * streamed or at least webby::config::compression_min_size() bytes long. Such responses
+       * carry `Vary: Accept-Encoding` whether or not the client accepted gzip, because their
+       * encoding depends on the request.
+       */
+      bool negotiate_encoding() {
+#ifdef WEBBY_HAVE_ZLIB
+        if(!_config.compression() || _status_code != 200 ||
+           _header.find(header_id::CONTENT_ENCODING) != nullptr) {
+          return false;
+        }
+        const arena_string* length = _header.find(header_id::CONTENT_LENGTH);
+        if(length != nullptr &&
+           strtoul(length->c_str(), nullptr, 10) < _config.compression_min_size()) {
+          return false;
+        }
+        const arena_string* type = _header.find(header_id::CONTENT_TYPE);
+        if(type == nullptr) {
+          return false;
+        }
+        slice media(type->data(), type->length());
+        size_t end = 0;
+        while(end < media.length() && media[end] != ';' && media[end] != ' ') {
+          ++end;
+        }
+        media = media.substr(0, end);
+        for(auto& allowed : _config.compression_types()) {
+          if(media.equals_nocase(allowed)) {
+            _header.set(header_id::VARY, "Accept-Encoding");
+            return _accepts_gzip;
+          }
+        }
+#endif
+        return false;
+      }
 
-        // Flag that the headers have been sent.
-        _sent_headers = true;
+      /**
+       * @brief Sends the line that starts a chunk of a chunked body.
+       * @param[in] length Length of the chunk.
+       */
+      void write_chunk_size(const unsigned long length) {
+        char size[20];
+        int count = snprintf(size, sizeof(size), "%lx\r\n", length);
+        _output.append(size, static_cast<size_t>(count));
       }
 
-    private:
-      static std::map<unsigned short, std::string> _status_map;
+      /**
+       * @brief Copies bytes into the header buffer.
+       * @returns The end of the copied bytes.
+       */
+      static char* copy(char* out, const char* data, const size_t length) {
+        memcpy(out, data, length);
+        return out + length;
+      }
+
+      /**
+       * @brief Gets the status line for a status code, e.g. "HTTP/1.1 200 OK\r\n".
+       * @returns The status line, or an empty string if the status code is not known.
+       */
+      static const std::string& status_line(const unsigned short status_code) {
+        static const std::vector<std::string> lines = status_lines();
+        static const std::string unknown;
+        return status_code < lines.size() ? lines[status_code] : unknown;
+      }
+
+      /**
+       * @brief Formats the status line of every known status code.
+       * @returns The status lines, indexed by status code.
+       */
+      static std::vector<std::string> status_lines() {
+        std::vector<std::string> lines(600);
+        for(auto& status : _status_map) {
+          lines[status.first] = "HTTP/1.1 " + std::to_string(status.first) + " " +
+                                status.second + "\r\n";
+        }
+        return lines;
+      }
+
+      /**
+       * @brief Reason phrases of the known status codes.
+       */
+      static const std::map<unsigned short, std::string> _status_map;
 
       /**
        * @brief Server configuration.
@@ -175,22 +528,49 @@ namespace webby {
       /**
        * @brief Headers sent with the response.
        */
-      std::map<std::string, std::string, no_case_compare> _header;
+      header_list _header;
 
       /**
        * @brief `true` if the headers have already been sent; otherwise `false`.
        */
       bool _sent_headers;
 
+      /**
+       * @brief `true` if the body is sent with `Transfer-Encoding: chunked`.
+       */
+      bool _chunked;
+
+      /**
+       * @brief `true` once the whole response has been sent.
+       */
+      bool _finished;
+
+      /**
+       * @brief `true` if the client accepts gzip and compression is enabled. Set by webby::server.
+       */
+      bool _accepts_gzip;
+
+#ifdef WEBBY_HAVE_ZLIB
+      /**
+       * @brief Compresses the body, when it is compressed.
+       */
+      std::unique_ptr<gzip_stream> _gzip;
+#endif
+
+      /**
+       * @brief Headers and body that have not been sent yet.
+       */
+      arena_string _output;
+
       /**
        * @brief Status code of the response.
        */
       unsigned short _status_code;
 
       /**
-       * @brief Worker socket used to communicate with the connected host.
+       * @brief Connection used to communicate with the connected host.
        */
-      const net::worker& _worker;
+      webby::connection& _connection;
 
       /**
        * @brief HTTP version sent to the connected host.
@@ -198,17 +578,40 @@ namespace webby {
       std::string _version;
 
       /**
-       * @brief Number of bytes sent to the client.
+       * @brief Number of body bytes sent to the client, after compression and excluding chunk
+       *        framing.
        */
       unsigned long _bytes_sent;
 
+      /**
+       * @brief Receives a copy of the body as the handler writes it, before compression, or
+       *        `nullptr`. Reset to `nullptr` if part of the body is sent from a file.
+       */
+      std::string* _capture;
+
+      /**
+       * @brief `true` while all of the output is kept in memory rather than sent. Cleared if part
+       *        of the body is sent from a file.
+       */
+      bool _hold;
+
+      /**
+       * @brief State of the handle returned by response::defer(), until the server takes it.
+       */
+      std::shared_ptr<deferred::state> _deferred;
+
+      /**
+       * @brief Necessary so that webby::cache_handler can record and replay responses.
+       */
+      friend class webby::cache_handler;
+
       /**
        * @brief Necessary so that webby::server can call the send function.
        */
       friend class webby::server;
   };
 
-  std::map<unsigned short, std::string> response::_status_map = {
+  const std::map<unsigned short, std::string> response::_status_map = {
     {100, "Continue"},
     {101, "Switching Protocols"},
 
@@ -244,8 +647,9 @@ namespace webby {
     {413, "Request Entity Too Large"},
     {414, "Request-URI Too Large"},
     {415, "Unsupported Media Type"},
-    {416, "Requested rqange not satisfiable"},
+    {416, "Requested range not satisfiable"},
     {417, "Expectation Failed"},
+    {431, "Request Header Fields Too Large"},
 
     {500, "Internal Server Error"},
     {501, "Not Implemented"},
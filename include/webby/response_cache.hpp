@@ -0,0 +1,247 @@
+/**
+ * @file response_cache.hpp
+ */
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief A response recorded by webby::cache_handler.
+   */
+  struct cached_response {
+    /**
+     * @brief Status code.
+     */
+    unsigned short status_code;
+
+    /**
+     * @brief Headers set by the handler, without the ones that describe the connection or the
+     *        framing of the body.
+     */
+    std::vector<std::pair<std::string, std::string>> headers;
+
+    /**
+     * @brief Uncompressed body.
+     */
+    std::string body;
+
+    /**
+     * @brief Time the response was recorded.
+     */
+    std::chrono::steady_clock::time_point stored;
+
+    /**
+     * @brief Time after which the response is no longer served.
+     */
+    std::chrono::steady_clock::time_point expires;
+
+    /**
+     * @brief Gets the approximate memory used by the response, in bytes.
+     */
+    std::size_t size() const {
+      std::size_t total = sizeof(cached_response) + body.length();
+      for(auto& header : headers) {
+        total += header.first.length() + header.second.length() + 2 * sizeof(std::string);
+      }
+      return total;
+    }
+  };
+
+  /**
+   * @brief Bounded, thread-safe cache of recorded responses.
+   *
+   * The keys are spread over shards, each with its own lock, so that threads looking up different
+   * keys rarely contend. Each shard evicts its least recently used responses once they take more
+   * than its share of the byte budget, and a response that has expired is dropped when it is
+   * next looked up.
+   *
+   * Misses are coalesced: the first thread that misses a key is told to produce the response,
+   * and the threads that ask for the same key meanwhile wait for it rather than producing it
+   * again. The wait is bounded, so that a producer that takes too long only delays the others
+   * for so long.
+   */
+  class response_cache {
+    public:
+      /**
+       * @brief Constructs an empty cache.
+       * @param[in] max_bytes Maximum total size of the cached responses, in bytes.
+       * @param[in] shards Number of independently locked shards.
+       */
+      response_cache(const unsigned long max_bytes, const std::size_t shards)
+          : _shards(new shard[shards > 0 ? shards : 1]), _shard_count(shards > 0 ? shards : 1),
+            _shard_bytes(max_bytes / (shards > 0 ? shards : 1)) { }
+
+      response_cache(const response_cache&) = delete;
+      response_cache& operator=(const response_cache&) = delete;
+
+      /**
+       * @brief Looks up a response.
+       * @param[in] key Key of the response.
+       * @param[in] now Current time.
+       * @param[in] max_wait Longest time to wait for another thread that is producing the
+       *                     response, or zero not to wait at all.
+       * @param[out] produce Set to `true` if the caller must produce the response and pass it to
+       *                     response_cache::fill(), whether or not it can be cached.
+       * @returns The cached response, or `nullptr` if there is none. If @p produce is `false` as
+       *          well, the response that was waited for could not be cached or took too long,
+       *          and the caller should produce its own response without caching it.
+       *
+       * Blocks while another thread is producing the response for @p key.
+       */
+      std::shared_ptr<const cached_response> acquire(
+          const std::string& key, const std::chrono::steady_clock::time_point now,
+          const std::chrono::milliseconds max_wait, bool& produce) {
+        shard& s = shard_for(key);
+        std::unique_lock<std::mutex> lock(s.mutex);
+        const auto deadline = now + max_wait;
+        bool waited = false;
+        while(1) {
+          auto itr = s.entries.find(key);
+          if(itr != s.entries.end()) {
+            if(now < itr->second->second->expires) {
+              s.lru.splice(s.lru.begin(), s.lru, itr->second);
+              produce = false;
+              return itr->second->second;
+            }
+            remove(s, itr);
+          }
+          if(s.pending.find(key) == s.pending.end()) {
+            if(waited) {
+              produce = false;
+              return nullptr;
+            }
+            s.pending.insert(key);
+            produce = true;
+            return nullptr;
+          }
+          if(max_wait.count() == 0 ||
+             s.filled.wait_until(lock, deadline) == std::cv_status::timeout) {
+            produce = false;
+            return nullptr;
+          }
+          waited = true;
+        }
+      }
+
+      /**
+       * @brief Stores the response produced after response_cache::acquire() asked for it, and
+       *        wakes the threads that are waiting for it.
+       * @param[in] key Key of the response.
+       * @param[in] response The response, or `nullptr` if it cannot be cached.
+       */
+      void fill(const std::string& key, std::shared_ptr<const cached_response> response) {
+        shard& s = shard_for(key);
+        {
+          std::lock_guard<std::mutex> lock(s.mutex);
+          s.pending.erase(key);
+          auto itr = s.entries.find(key);
+          if(itr != s.entries.end()) {
+            remove(s, itr);
+          }
+          if(response && response->size() + key.length() <= _shard_bytes) {
+            s.bytes += response->size() + key.length();
+            s.lru.push_front(std::make_pair(key, std::move(response)));
+            s.entries[key] = s.lru.begin();
+            while(s.bytes > _shard_bytes) {
+              remove(s, s.entries.find(s.lru.back().first));
+            }
+          }
+        }
+        s.filled.notify_all();
+      }
+
+    private:
+      /**
+       * @brief Responses, most recently used first.
+       */
+      typedef std::list<std::pair<std::string, std::shared_ptr<const cached_response>>> lru_list;
+
+      /**
+       * @brief Responses indexed by key.
+       */
+      typedef std::unordered_map<std::string, lru_list::iterator> entry_map;
+
+      /**
+       * @brief Independently locked part of the cache.
+       */
+      struct shard {
+        shard() : bytes(0) { }
+
+        /**
+         * @brief Guards the fields below.
+         */
+        std::mutex mutex;
+
+        /**
+         * @brief Signalled when a response that was being produced has been stored or abandoned.
+         */
+        std::condition_variable filled;
+
+        /**
+         * @brief Responses, most recently used first.
+         */
+        lru_list lru;
+
+        /**
+         * @brief Responses indexed by key.
+         */
+        entry_map entries;
+
+        /**
+         * @brief Keys whose responses are being produced.
+         */
+        std::unordered_set<std::string> pending;
+
+        /**
+         * @brief Total size of the responses and their keys.
+         */
+        unsigned long bytes;
+      };
+
+      /**
+       * @brief Gets the shard that holds a key.
+       */
+      shard& shard_for(const std::string& key) {
+        return _shards[std::hash<std::string>()(key) % _shard_count];
+      }
+
+      /**
+       * @brief Removes a response. The shard's lock must be held.
+       */
+      static void remove(shard& s, const entry_map::iterator itr) {
+        s.bytes -= itr->second->second->size() + itr->first.length();
+        s.lru.erase(itr->second);
+        s.entries.erase(itr);
+      }
+
+      /**
+       * @brief The shards.
+       */
+      std::unique_ptr<shard[]> _shards;
+
+      /**
+       * @brief Number of shards.
+       */
+      const std::size_t _shard_count;
+
+      /**
+       * @brief Maximum total size of the responses in each shard.
+       */
+      const unsigned long _shard_bytes;
+  };
+}
@@ -0,0 +1,142 @@
+/**
+ * @file ring_buffer.hpp
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Bounded, lock-free queue that passes fixed-size items from many threads to one.
+   *
+   * Producers never block and never wait for the consumer: ring_buffer::push() claims a slot with
+   * a single compare-and-swap and returns `false` if the buffer is full. Each slot carries a
+   * sequence number that tells the producers and the consumer whose turn it is, so the item itself
+   * is copied without any further synchronization.
+   */
+  template<typename T> class ring_buffer {
+    public:
+      /**
+       * @brief Constructs an empty buffer.
+       * @param[in] capacity Minimum number of items the buffer holds. It is rounded up to a power
+       *                     of two.
+       */
+      explicit ring_buffer(std::size_t capacity)
+          : _mask(round_up(capacity) - 1), _slots(new slot[_mask + 1]), _head(0), _tail(0) {
+        for(std::size_t i = 0; i <= _mask; ++i) {
+          _slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+      }
+
+      ring_buffer(const ring_buffer&) = delete;
+      ring_buffer& operator=(const ring_buffer&) = delete;
+
+      /**
+       * @brief Copies an item into the buffer. Safe to call from any number of threads.
+       * @param[in] item Item to copy.
+       * @returns `true` if the item was queued; `false` if the buffer is full.
+       */
+      bool push(const T& item) {
+        std::size_t pos = _tail.load(std::memory_order_relaxed);
+        slot* s;
+        while(1) {
+          s = &_slots[pos & _mask];
+          std::size_t sequence = s->sequence.load(std::memory_order_acquire);
+          if(sequence == pos) {
+            if(_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+              break;
+            }
+          }
+          else if(sequence < pos) {
+            return false;
+          }
+          else {
+            pos = _tail.load(std::memory_order_relaxed);
+          }
+        }
+        s->item = item;
+        s->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+
+      /**
+       * @brief Removes the oldest item from the buffer. Only one thread may call this.
+       * @param[out] item Receives the item.
+       * @returns `true` if an item was removed; `false` if the buffer is empty.
+       */
+      bool pop(T& item) {
+        slot& s = _slots[_head & _mask];
+        if(s.sequence.load(std::memory_order_acquire) != _head + 1) {
+          return false;
+        }
+        item = s.item;
+        s.sequence.store(_head + _mask + 1, std::memory_order_release);
+        ++_head;
+        return true;
+      }
+
+      /**
+       * @brief Gets the number of items the buffer holds.
+       */
+      std::size_t capacity() const {
+        return _mask + 1;
+      }
+
+    private:
+      /**
+       * @brief Storage for a single item.
+       */
+      struct slot {
+        /**
+         * @brief Position the slot is next written at, plus one once it has been written.
+         */
+        std::atomic<std::size_t> sequence;
+
+        /**
+         * @brief The item.
+         */
+        T item;
+      };
+
+      /**
+       * @brief Rounds @p n up to a power of two, with a minimum of two.
+       */
+      static std::size_t round_up(std::size_t n) {
+        std::size_t result = 2;
+        while(result < n) {
+          result <<= 1;
+        }
+        return result;
+      }
+
+      /**
+       * @brief Capacity minus one, used to map positions to slots.
+       */
+      const std::size_t _mask;
+
+      /**
+       * @brief Slots.
+       */
+      std::unique_ptr<slot[]> _slots;
+
+      /**
+       * @brief Position of the next item removed. Only touched by the consumer.
+       */
+      std::size_t _head;
+
+      /**
+       * @brief Keeps the consumer's position and the producers' position on separate cache lines.
+       */
+      char _padding[64];
+
+      /**
+       * @brief Position of the next item added.
+       */
+      std::atomic<std::size_t> _tail;
+  };
+}
@@ -2,17 +2,58 @@
  * @file router.hpp
  */
 #pragma once
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
 #include <vector>
 
+#include <webby/method.hpp>
+#include <webby/request.hpp>
+#include <webby/response.hpp>
+#include <webby/slice.hpp>
+
 /**
  * @namespace webby
  */
 namespace webby {
   /**
    * @brief Routes request to the correct handler.
+   *
+   * Routes are stored in a compressed radix tree, so finding the handler for a request takes time
+   * proportional to the length of its path rather than to the number of routes. A route matches
+   * a path that it is equal to, or that continues past it with a new segment, so `/item` matches
+   * `/item` and `/item/1` but not `/items`. A route that ends with a `/` matches everything below
+   * it. When several routes match, the longest one is used regardless of the order they were
+   * added in.
+   *
+   * A segment of the form `:name` matches any single segment of the path, and the text it matched
+   * is available to the handler through webby::request::param(). A literal segment is preferred
+   * over a parameter when both match.
+   *
+   *     router.add("/item/:id", webby::method::GET, show_item);
    */
   class router {
     public:
+      /**
+       * @brief Reports routes that cannot be added to the table.
+       */
+      class error : public std::runtime_error {
+        public:
+          /**
+           * @brief Constructs the `router::error` object.
+           * @param[in] what_arg Explanatory string.
+           */
+          explicit error(const std::string& what_arg) : runtime_error(what_arg) { }
+
+          /**
+           * @brief Constructs the `router::error` object.
+           * @param[in] what_arg Explanatory string.
+           */
+          explicit error(const char* what_arg) : runtime_error(what_arg) { }
+      };
+
       /**
        * @brief Signature of route handler functions.
        */
@@ -21,15 +62,58 @@ namespace webby {
       /**
        * @brief Default constructor.
        */
-      router() {
+      router() : _root(new node) {
         _error_handler = router::default_error_handler;
       }
 
       /**
        * @brief Adds a new route to the table.
+       * @param[in] path Path to match. It must begin with a `/`, and may contain `:name`
+       *                 parameter segments.
+       * @param[in] mask HTTP methods that the route accepts. The same path may be added more than
+       *                 once with different methods.
+       * @param[in] handler Function that handles the requests.
+       * @returns Reference to this webby::router object for chaining.
+       * @throws router::error if the path is invalid, or if a parameter segment uses a different
+       *         name than a route that was already added at the same position.
        */
       router& add(const std::string& path, enum webby::method mask, handler_t handler) {
-        _route.push_back(route{path, mask, handler});
+        if(path.empty() || path[0] != '/') {
+          throw router::error("Routes must begin with '/': " + path);
+        }
+
+        // Splits the path into literal text and parameters, and adds each of them to the tree.
+        node* n = _root.get();
+        size_t pos = 0;
+        while(pos < path.length()) {
+          size_t colon = path.find("/:", pos);
+          if(colon == std::string::npos) {
+            n = insert(n, path.substr(pos));
+            break;
+          }
+          n = insert(n, path.substr(pos, colon + 1 - pos));
+
+          size_t end = path.find('/', colon + 1);
+          if(end == std::string::npos) {
+            end = path.length();
+          }
+          std::string name = path.substr(colon + 2, end - colon - 2);
+          if(name.empty()) {
+            throw router::error("Route parameters must be named: " + path);
+          }
+          if(!n->param) {
+            n->param.reset(new node);
+            n->param->label = name;
+          }
+          else if(n->param->label != name) {
+            throw router::error("Route parameter :" + name + " conflicts with :" +
+                                n->param->label + " in " + path);
+          }
+          n = n->param.get();
+          pos = end;
+        }
+
+        n->routes.push_back(route{path, mask, handler});
         return *this;
       }
 
@@ -37,18 +121,26 @@ namespace webby {
        * @brief Routes a request to the appropriate handler.
        */
       void dispatch(request& req, response& res) const {
-        for(auto itr = _route.cbegin(); itr != _route.cend(); ++itr) {
-          if(req.path().compare(0, itr->path.length(), itr->path) == 0) {
+        const slice path = req.path();
+        const request::param_list::allocator_type allocator(req.arena());
+        request::param_list params(allocator);
+        match best = {nullptr, 0, request::param_list(allocator)};
+        find(*_root, path, 0, params, best);
+
+        if(best.target != nullptr) {
+          enum webby::method allowed = static_cast<enum webby::method>(0);
+          for(auto itr = best.target->routes.cbegin(); itr != best.target->routes.cend(); ++itr) {
             if(req.method() == (req.method() & itr->mask)) {
               req.set_route(itr->path);
+              req.set_params(best.params);
               itr->handler(req, res);
+              return;
             }
-            else {
-              res.set_status_code(405)
-                 .set_header("Allow", to_string(itr->mask));
-            }
-            return;
+            allowed = allowed | itr->mask;
           }
+          res.set_status_code(405)
+             .set_header("Allow", to_string(allowed));
+          return;
         }
 
         _error_handler(req, res);
@@ -103,9 +195,153 @@ namespace webby {
       };
 
       /**
-       * @brief Stores routes and handlers.
+       * @brief Node of the radix tree.
+       */
+      struct node {
+        /**
+         * @brief Literal text matched by the edge that leads to this node, or the name of the
+         *        parameter if this is a parameter node.
+         */
+        std::string label;
+
+        /**
+         * @brief Children reached by literal text. No two of them begin with the same character.
+         */
+        std::vector<std::unique_ptr<node>> children;
+
+        /**
+         * @brief Child reached by a parameter segment.
+         */
+        std::unique_ptr<node> param;
+
+        /**
+         * @brief Routes that end at this node.
+         */
+        std::vector<route> routes;
+      };
+
+      /**
+       * @brief Best match found so far by router::find().
+       */
+      struct match {
+        /**
+         * @brief Node whose routes matched, or `nullptr`.
+         */
+        const node* target;
+
+        /**
+         * @brief Number of characters of the path that were matched.
+         */
+        size_t length;
+
+        /**
+         * @brief Parameters captured on the way to router::match::target.
+         */
+        request::param_list params;
+      };
+
+      /**
+       * @brief Adds literal text below a node, splitting edges where necessary.
+       * @param[in] n Node to start at.
+       * @param[in] text Text to add.
+       * @returns The node reached by the text.
+       */
+      static node* insert(node* n, std::string text) {
+        while(!text.empty()) {
+          node* child = nullptr;
+          for(auto& c : n->children) {
+            if(c->label[0] == text[0]) {
+              child = c.get();
+              break;
+            }
+          }
+
+          if(child == nullptr) {
+            std::unique_ptr<node> leaf(new node);
+            leaf->label = text;
+            n->children.push_back(std::move(leaf));
+            return n->children.back().get();
+          }
+
+          // Finds how much of the edge the text shares, and splits the edge if it is not all of
+          // it.
+          size_t common = 0;
+          while(common < text.length() && common < child->label.length() &&
+                text[common] == child->label[common]) {
+            ++common;
+          }
+          if(common < child->label.length()) {
+            std::unique_ptr<node> tail(new node);
+            tail->label = child->label.substr(common);
+            tail->children = std::move(child->children);
+            tail->param = std::move(child->param);
+            tail->routes = std::move(child->routes);
+            child->label.erase(common);
+            child->children.clear();
+            child->children.push_back(std::move(tail));
+            child->routes.clear();
+          }
+          n = child;
+          text.erase(0, common);
+        }
+        return n;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether a route ending at @p pos matches @p path.
+       */
+      static bool boundary(const slice& path, const size_t pos) {
+        return pos == path.length() || path[pos] == '/' || path[pos] == '?' ||
+               (pos > 0 && path[pos - 1] == '/');
+      }
+
+      /**
+       * @brief Finds the longest route that matches a path.
+       * @param[in] n Node to search from.
+       * @param[in] path Path of the request.
+       * @param[in] pos Offset of the first character of the path below @p n.
+       * @param[in,out] params Parameters captured on the way to @p n.
+       * @param[in,out] best Best match found so far.
+       *
+       * Literal children are searched before the parameter child, so that literal text wins when
+       * both match the same length of the path.
+       */
+      static void find(const node& n, const slice& path, const size_t pos,
+                       request::param_list& params, match& best) {
+        if(!n.routes.empty() && (best.target == nullptr || pos > best.length) &&
+           boundary(path, pos)) {
+          best.target = &n;
+          best.length = pos;
+          best.params = params;
+        }
+        if(pos == path.length()) {
+          return;
+        }
+
+        for(auto& child : n.children) {
+          if(child->label[0] == path[pos]) {
+            if(path.substr(pos).starts_with(child->label)) {
+              find(*child, path, pos + child->label.length(), params, best);
+            }
+            break;
+          }
+        }
+
+        if(n.param && path[pos] != '/' && path[pos] != '?') {
+          size_t end = pos;
+          while(end < path.length() && path[end] != '/' && path[end] != '?') {
+            ++end;
+          }
+          params.push_back(std::make_pair(slice(n.param->label), path.substr(pos, end - pos)));
+          find(*n.param, path, end, params, best);
+          params.pop_back();
+        }
+      }
+
+      /**
+       * @brief Root of the radix tree, which matches the empty string.
        */
-      std::vector<route> _route;
+      std::unique_ptr<node> _root;
 
       /**
        * @brief Stores the error handler.
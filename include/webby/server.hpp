@@ -3,13 +3,38 @@
  */
 #pragma once
 
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
 #include <asf.hpp>
-#include <net.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 
+#include <webby/access_log.hpp>
+#include <webby/affinity.hpp>
 #include <webby/config.hpp>
+#include <webby/connection.hpp>
+#include <webby/deferred.hpp>
+#include <webby/epoll_engine.hpp>
+#include <webby/handoff.hpp>
 #include <webby/request.hpp>
 #include <webby/response.hpp>
 #include <webby/router.hpp>
+#include <webby/socket.hpp>
+#include <webby/work_queue.hpp>
 
 namespace webby {
   /**
@@ -48,14 +73,17 @@ namespace webby {
        * request is handled, or if an error is sent back to the client.
        */
       server(const webby::config& config, const webby::router& router)
-            : _config(config), _router(router) {
-        _config.error_log() << qlog::debug
-                            << "server::server(const webby::config&)" << std::endl;
+            : _config(config), _router(router), _wake_fd(-1), _stopping(false),
+              _drain_expired(false) {
+        WEBBY_DEBUG(_config) << "server::server(const webby::config&)" << std::endl;
         try {
           init();
         }
         catch(const webby::server::error& e) {
-          _config.error_log() << qlog::error << e.what() << std::endl;
+          WEBBY_ERROR(_config) << e.what() << std::endl;
+          if(_wake_fd >= 0) {
+            ::close(_wake_fd);
+          }
           throw;
         }
       }
@@ -64,46 +92,573 @@ namespace webby {
        * @brief Destructor
        */
       ~server() {
-        _config.error_log() << qlog::debug << "server::~server" << std::endl;
+        WEBBY_DEBUG(_config) << "server::~server" << std::endl;
+        server* self = this;
+        signal_target().compare_exchange_strong(self, nullptr);
+        _engine.reset();
+        ::close(_wake_fd);
       }
 
       /**
-       * @brief Runs the server.
+       * @brief Stops the server.
+       *
+       * The server stops accepting connections, closes the connections that are waiting for a
+       * request, and answers the requests that have already arrived with `Connection: close`.
+       * server::run() returns once every connection is closed. Connections that are still busy
+       * when `webby::config::drain_timeout()` expires are shut down.
+       *
+       * This may be called from any thread, before or during server::run(), and from a signal
+       * handler.
+       */
+      void stop() {
+        _stopping.store(true);
+        const std::uint64_t one = 1;
+        ssize_t result = ::write(_wake_fd, &one, sizeof(one));
+        (void)result;
+      }
+
+      /**
+       * @brief Stops the server when the process receives a signal.
+       * @param[in] signal The signal, e.g. `SIGTERM`.
+       *
+       * Only one server per process can be stopped by signals; the last one to call this wins.
+       */
+      void stop_on_signal(const int signal) {
+        signal_target().store(this);
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = [](int) {
+          server* target = signal_target().load();
+          if(target != nullptr) {
+            target->stop();
+          }
+        };
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        ::sigaction(signal, &action, nullptr);
+      }
+
+      /**
+       * @brief Runs the server until server::stop() is called and the connections are drained.
+       *
+       * With `webby::engine::EPOLL` the calling thread runs one of the engine's event loops.
+       *
+       * With `webby::engine::BLOCKING`, when `webby::config::worker_threads()` is zero every
+       * connection is processed on the calling thread. When webby::config::reuse_port() is set,
+       * each worker thread accepts and processes the connections of its own listening socket, and
+       * the calling thread runs the first of them. Otherwise the calling thread only accepts
+       * connections and hands them to a pool of worker threads through a bounded queue. When that
+       * queue is full the calling thread waits for a free slot before accepting another
+       * connection.
+       *
+       * If webby::config::handoff_path() is set, a thread waits for a new process to ask for the
+       * listening sockets, and stops the server once they have been handed over.
        */
       void run() {
-        _config.error_log() << qlog::debug << "server::run()" << std::endl;
+        WEBBY_DEBUG(_config) << "server::run()" << std::endl;
+
+        std::thread handoff;
+        if(_handoff) {
+          handoff = std::thread([this] { handoff_loop(); });
+        }
+        try {
+          if(_engine) {
+            _engine->run();
+          }
+          else {
+            run_blocking();
+          }
+        }
+        catch(...) {
+          stop();
+          if(handoff.joinable()) {
+            handoff.join();
+          }
+          throw;
+        }
+        if(handoff.joinable()) {
+          handoff.join();
+        }
+        WEBBY_INFO(_config) << "Server stopped" << std::endl;
+      }
+
+    private:
+      /**
+       * @brief Runs the blocking engine until the server is stopped and drained.
+       */
+      void run_blocking() {
+        std::thread watchdog([this] { drain(); });
+
+        if(_listeners.size() > 1) {
+          std::vector<std::thread> workers;
+          for(unsigned i = 1; i < _listeners.size(); ++i) {
+            workers.push_back(std::thread([this, i] { accept_loop(i); }));
+          }
+          WEBBY_INFO(_config) << "Started " << _listeners.size() << " listening threads"
+                              << std::endl;
+          accept_loop(0);
+          for(auto& worker : workers) {
+            worker.join();
+          }
+        }
+        else if(_config.worker_threads() == 0) {
+          // The base implementation of the server is the simplest possible: A loop that blocks on
+          // the server::accept() call until a client connects.
+          accept_loop(0);
+        }
+        else {
+          work_queue<std::unique_ptr<socket_connection>> queue(_config.queue_capacity());
+          std::vector<std::thread> workers;
+          for(unsigned i = 0; i < _config.worker_threads(); ++i) {
+            workers.push_back(std::thread([this, &queue, i] {
+              pin_thread(_config, i);
+              std::unique_ptr<socket_connection> conn;
+              while(queue.pop(conn)) {
+                serve(*conn);
+                conn.reset();
+              }
+            }));
+          }
+
+          WEBBY_INFO(_config) << "Started " << workers.size() << " worker threads" << std::endl;
+
+          // Blocks while the queue is full so that the backlog builds up in the kernel rather
+          // than in this process.
+          while(std::unique_ptr<socket_connection> conn = accept(*_listeners[0])) {
+            queue.push(std::move(conn));
+          }
+
+          // Lets the workers finish the connections that were already accepted.
+          queue.close();
+          for(auto& worker : workers) {
+            worker.join();
+          }
+        }
 
-        // The base implementation of the server is the simplest possible: An infinite loop that
-        // blocks on the server::accept() call until a client connects.
+        watchdog.join();
+      }
+
+      /**
+       * @brief Waits for the next connection on a listening socket and accepts it.
+       * @returns The connection, or `nullptr` once the server is stopping.
+       *
+       * Errors are logged rather than thrown, so that a failed `accept()` does not stop the
+       * server.
+       */
+      std::unique_ptr<socket_connection> accept(const listener& l) {
         while(1) {
-          // Accept the incoming connection and create a worker socket for it.
-          net::worker worker = _server.accept();
+          struct pollfd pfd[2];
+          pfd[0].fd = l.fd();
+          pfd[0].events = POLLIN;
+          pfd[1].fd = _wake_fd;
+          pfd[1].events = POLLIN;
+          pfd[0].revents = pfd[1].revents = 0;
+          if(::poll(pfd, 2, -1) < 0 && errno != EINTR) {
+            WEBBY_ERROR(_config) << "poll: " << strerror(errno) << std::endl;
+          }
+          if(_stopping.load()) {
+            return nullptr;
+          }
+          if(!(pfd[0].revents & POLLIN)) {
+            continue;
+          }
+
+          std::string client_ip;
+          int fd;
+          try {
+            fd = l.accept(client_ip);
+          }
+          catch(const std::exception& e) {
+            // Backs off, as the cause, such as running out of descriptors, may take a while to
+            // go away.
+            WEBBY_ERROR(_config) << e.what() << std::endl;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+          }
+          if(fd >= 0) {
+            return std::unique_ptr<socket_connection>(
+                new socket_connection(_config, fd, client_ip));
+          }
+        }
+      }
 
-          // Some connection logging.
-          _config.error_log() << qlog::debug << "Accepted connection" << std::endl;
-          _config.error_log() << qlog::debug << "  Client Hostname: " << worker.client_hostname()
-              << std::endl;
-          _config.error_log() << qlog::debug << "  Client IP: " << worker.client_ip() << std::endl;
+      /**
+       * @brief Accepts and serves the connections of one listening socket until the server is
+       *        stopping.
+       * @param[in] index Index of the listening socket, which is also the index of the worker
+       *                  thread.
+       */
+      void accept_loop(const unsigned index) {
+        pin_thread(_config, index);
+        while(std::unique_ptr<socket_connection> conn = accept(*_listeners[index])) {
+          serve(*conn);
+        }
+      }
+
+      /**
+       * @brief Waits for the server to stop, then shuts down the connections that are still
+       *        open when `webby::config::drain_timeout()` expires.
+       *
+       * Shutting a socket down makes the blocking call of the thread serving it fail, so the
+       * thread can finish once its handler returns.
+       */
+      void drain() {
+        struct pollfd pfd;
+        pfd.fd = _wake_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        while(::poll(&pfd, 1, -1) < 0 && errno == EINTR) {
+        }
+        const auto deadline = std::chrono::steady_clock::now() + _config.drain_timeout();
+
+        std::unique_lock<std::mutex> lock(_active_mutex);
+        if(!_active_empty.wait_until(lock, deadline, [this] { return _active.empty(); })) {
+          WEBBY_INFO(_config) << "Closing " << _active.size()
+                              << " connections at the drain deadline" << std::endl;
+          for(auto conn : _active) {
+            conn->shutdown();
+          }
+        }
+        _drain_expired = true;
+      }
+
+      /**
+       * @brief Serves every request sent over a blocking connection.
+       * @param[in] conn Connection to the client.
+       *
+       * Requests are processed until the client or the response asks for the connection to be
+       * closed, `webby::config::max_requests_per_connection()` is reached, or no new request
+       * arrives within `webby::config::idle_timeout()`.
+       */
+      void serve(socket_connection& conn) {
+        // Some connection logging.
+        WEBBY_DEBUG(_config) << "Accepted connection" << std::endl;
+
+        // Connections are tracked so that they can be shut down when the server is drained.
+        {
+          std::lock_guard<std::mutex> lock(_active_mutex);
+          if(_drain_expired) {
+            return;
+          }
+          _active.insert(&conn);
+        }
+        if(_config.metrics() != nullptr) {
+          _config.metrics()->connection_opened();
+        }
+
+        // Once the server is stopping, waiting for a request only succeeds if it has already
+        // arrived, and that request is the last one.
+        try {
+          const unsigned max = _config.max_requests_per_connection();
+          for(unsigned count = 1; conn.wait(_config.idle_timeout(), _wake_fd) &&
+              process(conn, _stopping.load() || (max != 0 && count >= max)); ++count) {
+            conn.next();
+          }
+        }
+        catch(const std::exception& e) {
+          WEBBY_ERROR(_config) << e.what() << std::endl;
+        }
+
+        if(_config.metrics() != nullptr) {
+          _config.metrics()->connection_closed();
+        }
+        std::lock_guard<std::mutex> lock(_active_mutex);
+        _active.erase(&conn);
+        if(_active.empty()) {
+          _active_empty.notify_all();
+        }
+      }
+
+      /**
+       * @brief A request and the response to it.
+       *
+       * Both are allocated in the connection's arena rather than on the stack, so that a deferred
+       * response can outlive server::process().
+       */
+      struct exchange {
+        /**
+         * @brief Constructs the request and the default response.
+         */
+        exchange(const webby::config& config, webby::connection& conn,
+                 const std::chrono::steady_clock::time_point start)
+            : req(config, conn), res(config, conn), keep_alive(false), start(start) { }
+
+        /**
+         * @brief The request.
+         */
+        request req;
 
-          // Decompose the HTTP request from the client.
-          request req(_config, worker);
+        /**
+         * @brief The response.
+         */
+        response res;
 
-          // Create the default response for the handler to populate.
-          response res(_config, worker);
+        /**
+         * @brief `true` if the connection can be used for another request.
+         */
+        bool keep_alive;
+
+        /**
+         * @brief Time the server started processing the request.
+         */
+        std::chrono::steady_clock::time_point start;
+      };
+
+      /**
+       * @brief Destroys an exchange without freeing its memory, which belongs to the arena.
+       */
+      struct exchange_deleter {
+        void operator()(exchange* ex) const {
+          ex->~exchange();
+        }
+      };
+
+      /**
+       * @brief Owns an exchange.
+       */
+      typedef std::unique_ptr<exchange, exchange_deleter> exchange_ptr;
+
+      /**
+       * @brief Processes a single request.
+       * @param[in] conn Connection to the client.
+       * @param[in] last `true` if this is the last request allowed on the connection.
+       * @returns `true` if the connection can be used for another request.
+       *
+       * Errors are logged rather than thrown so that a misbehaving client cannot terminate the
+       * thread that is serving it.
+       */
+      bool process(webby::connection& conn, const bool last) {
+        WEBBY_DEBUG(_config) << "  Client IP: " << conn.client_ip() << std::endl;
+        const auto start = std::chrono::steady_clock::now();
+
+        try {
+          // Reads until the request line and headers are complete.
+          while(!conn.parse()) {
+            if(!conn.fill()) {
+              return false;
+            }
+          }
+
+          // Decompose the HTTP request from the client, and create the default response for the
+          // handler to populate.
+          exchange_ptr ex(new(conn.arena().allocate(sizeof(exchange), alignof(exchange)))
+                          exchange(_config, conn, start));
+          request& req = ex->req;
+          response& res = ex->res;
+          ex->keep_alive = !last && req.keep_alive();
+
+          if(_config.compression() && req.has_header(header_id::ACCEPT_ENCODING)) {
+            res._accepts_gzip = accepts_encoding(req.header(header_id::ACCEPT_ENCODING), "gzip");
+          }
 
           // Populates some default headers.
-          if(req.has_header("Host")) {
-            std::ostringstream location;
-            location << "http://" << req.header("Host") << req.path();
-            res.set_header("Location", location.str());
+          if(req.has_header(header_id::HOST)) {
+            const slice host = req.header(header_id::HOST);
+            const slice path = req.path();
+            arena_string location("http://", arena_allocator<char>(conn.arena()));
+            location.append(host.data(), host.length()).append(path.data(), path.length());
+            res._header.set(header_id::LOCATION, slice(location.data(), location.length()));
+          }
+
+          // HTTP/1.1 connections are persistent unless stated otherwise, and HTTP/1.0
+          // connections are closed unless stated otherwise.
+          if(!ex->keep_alive) {
+            res._header.set(header_id::CONNECTION, "close");
+          }
+          else if(req.version() != "1.1") {
+            res._header.set(header_id::CONNECTION, "keep-alive");
           }
 
           // Routes the request to a handler.
-          _router.dispatch(req, res);
+          return respond(conn, std::move(ex), [this](request& req, response& res) {
+            _router.dispatch(req, res);
+          });
+        }
+        catch(const request_parser::error& e) {
+          // Invalid requests are answered before the connection is closed.
+          WEBBY_ERROR(_config) << e.what() << std::endl;
+          try {
+            response res(_config, conn);
+            res.set_status_code(e.status_code())
+               .set_header("Connection", "close")
+               .finish();
+            record(conn, res, start);
+          }
+          catch(const std::exception& e) {
+            WEBBY_ERROR(_config) << e.what() << std::endl;
+          }
+        }
+        catch(const std::exception& e) {
+          WEBBY_ERROR(_config) << e.what() << std::endl;
+        }
+        return false;
+      }
+
+      /**
+       * @brief Lets a handler fill in a response, and sends it unless the handler deferred it.
+       * @param[in] conn Connection to the client.
+       * @param[in] ex The request and response.
+       * @param[in] handler Fills in the response: the router, or the function passed to
+       *                    deferred::complete().
+       * @returns `true` if the connection can be used for another request.
+       */
+      template<typename F>
+      bool respond(webby::connection& conn, exchange_ptr ex, F handler) {
+        // A body that cannot be read leaves the connection in an unknown state, so it is closed
+        // after the error has been answered.
+        try {
+          handler(ex->req, ex->res);
+        }
+        catch(const request_parser::error& e) {
+          WEBBY_ERROR(_config) << e.what() << std::endl;
+          ex->res._deferred.reset();
+          ex->res.fail(e.status_code());
+          ex->keep_alive = false;
+        }
+        if(ex->res._deferred) {
+          return defer(conn, std::move(ex));
+        }
+        return finish(conn, std::move(ex));
+      }
+
+      /**
+       * @brief Sends the rest of a response, and reads past the rest of the request.
+       * @param[in] conn Connection to the client.
+       * @param[in] ex The request and response.
+       * @returns `true` if the connection can be used for another request.
+       */
+      bool finish(webby::connection& conn, exchange_ptr ex) {
+        ex->res.finish();
+        record(conn, ex->res, ex->start);
+
+        // The handler may close the connection itself.
+        const arena_string* connection = ex->res._header.find(header_id::CONNECTION);
+        if(connection != nullptr &&
+           slice(connection->data(), connection->length()).equals_nocase("close")) {
+          ex->keep_alive = false;
+        }
+
+        // Skips whatever the handler left of the body so that the next request can be read.
+        if(ex->keep_alive) {
+          try {
+            ex->req.discard_body();
+          }
+          catch(const request_parser::error& e) {
+            WEBBY_ERROR(_config) << e.what() << std::endl;
+            return false;
+          }
+        }
+        return ex->keep_alive;
+      }
+
+      /**
+       * @brief Parks the connection until a deferred response is completed, or waits for it if
+       *        the connection cannot be parked.
+       * @param[in] conn Connection to the client.
+       * @param[in] ex The request and response.
+       * @returns `true` if the connection can be used for another request, which a parked
+       *          connection can until its response says otherwise.
+       */
+      bool defer(webby::connection& conn, exchange_ptr ex) {
+        std::shared_ptr<deferred::state> state = std::move(ex->res._deferred);
+
+        // Whatever the handler has written so far is sent while the rest is pending.
+        ex->res.flush();
+
+        exchange* parked = ex.get();
+        std::function<void()> notify = conn.park([this, &conn, parked, state](bool complete) {
+          exchange_ptr ex(parked);
+          if(!complete) {
+            // The connection is being closed, so nothing more is sent.
+            ex->res._finished = true;
+            return false;
+          }
+          return resume(conn, std::move(ex), *state);
+        });
+        if(notify) {
+          ex.release();
+          state->on_complete(std::move(notify));
+          return true;
+        }
+
+        // Gives up once the server has been stopped and its connections have been shut down.
+        const std::chrono::milliseconds limit = _config.deferred_timeout();
+        const auto deadline = std::chrono::steady_clock::now() + limit;
+        while(!state->wait_for(std::chrono::milliseconds(100))) {
+          {
+            std::lock_guard<std::mutex> lock(_active_mutex);
+            if(_drain_expired) {
+              ex->res._finished = true;
+              return false;
+            }
+          }
+          if(limit.count() > 0 && std::chrono::steady_clock::now() >= deadline) {
+            break;
+          }
+        }
+        return resume(conn, std::move(ex), *state);
+      }
+
+      /**
+       * @brief Finishes a deferred response once it has been completed, or once
+       *        `webby::config::deferred_timeout()` has run out.
+       * @param[in] conn Connection to the client.
+       * @param[in] ex The request and response.
+       * @param[in] state State of the deferred response.
+       * @returns `true` if the connection can be used for another request.
+       *
+       * Errors are logged rather than thrown, since a parked connection is resumed by its event
+       * loop.
+       */
+      bool resume(webby::connection& conn, exchange_ptr ex, deferred::state& state) {
+        const bool expired = state.expire();
+        bool dropped = false;
+        const deferred::fill_t fill = expired ? deferred::fill_t() : state.take(dropped);
+        try {
+          if(expired || dropped) {
+            WEBBY_ERROR(_config) << (expired ? "A deferred response timed out"
+                                             : "A deferred response was never completed")
+                                 << std::endl;
+            ex->res.fail(expired ? 504 : 500);
+            ex->keep_alive = false;
+            return finish(conn, std::move(ex));
+          }
+          return respond(conn, std::move(ex), [&fill](request&, response& res) {
+            if(fill) {
+              fill(res);
+            }
+          });
+        }
+        catch(const std::exception& e) {
+          WEBBY_ERROR(_config) << e.what() << std::endl;
+        }
+        return false;
+      }
+
+      /**
+       * @brief Queues an access log record and records the statistics of a request that has been
+       *        answered.
+       * @param[in] conn Connection to the client.
+       * @param[in] res Response that was sent.
+       * @param[in] start Time the server started processing the request.
+       */
+      void record(const webby::connection& conn, const response& res,
+                  const std::chrono::steady_clock::time_point start) {
+        if(!_access_log && _config.metrics() == nullptr) {
+          return;
+        }
+        const auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start);
+        if(_access_log) {
+          const request_parser& parser = conn.parser();
+          _access_log->log(parser.method(), parser.path().resolve(conn.input()), res._status_code,
+                           res._bytes_sent, latency, conn.client_ip());
+        }
+        if(_config.metrics() != nullptr) {
+          _config.metrics()->record_request(res._status_code, res._bytes_sent, latency);
         }
       }
 
-    private:
       /** Server configuration. */
       const webby::config& _config;
 
@@ -116,15 +671,184 @@ namespace webby {
        * @brief Initializes the server.
        */
       void init() {
-        _config.error_log() << qlog::debug << "server::init()" << std::endl;
-        _server.connect(_config.address(), _config.port());
-        _config.error_log() << qlog::info << "Server listening at " << _config.address() << ":"
+        WEBBY_DEBUG(_config) << "server::init()" << std::endl;
+
+        // The epoll engine buffers whole request bodies, which would otherwise grow without limit.
+        if(_config.engine() == webby::engine::EPOLL && _config.max_body_size() == 0) {
+          throw server::error("The epoll engine needs a maximum request body size");
+        }
+
+        // sendfile(2) cannot be told not to raise SIGPIPE when the client has gone away, so the
+        // signal is ignored and the error is reported as EPIPE instead.
+        ::signal(SIGPIPE, SIG_IGN);
+
+        _wake_fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if(_wake_fd < 0) {
+          throw server::error(std::string("eventfd: ") + strerror(errno));
+        }
+
+        if(_config.has_access_log()) {
+          _access_log.reset(new access_log_writer(_config));
+        }
+
+        // Takes over the listening sockets of the process that this one replaces, if there is one.
+        std::vector<int> inherited;
+        if(!_config.handoff_path().empty()) {
+          try {
+            if(handoff_socket::receive(_config.handoff_path(), inherited)) {
+              WEBBY_INFO(_config) << "Took over " << inherited.size()
+                                  << " listening sockets from the previous process" << std::endl;
+            }
+            _handoff.reset(new handoff_socket(_config.handoff_path()));
+          }
+          catch(const std::exception& e) {
+            throw server::error(e.what());
+          }
+        }
+
+        // With SO_REUSEPORT each worker thread gets its own listening socket. The connections of
+        // both engines are non-blocking; the blocking engine waits for them with poll() so that
+        // slow clients time out.
+        const bool nonblocking = true;
+        const unsigned count = _config.reuse_port() && _config.worker_threads() > 1 ?
+                               _config.worker_threads() : 1;
+        try {
+          for(unsigned i = 0; i < count; ++i) {
+            if(i < inherited.size()) {
+              _listeners.emplace_back(new listener(inherited[i], nonblocking));
+            }
+            else {
+              _listeners.emplace_back(new listener(_config, nonblocking, _config.reuse_port()));
+            }
+          }
+        }
+        catch(const std::exception& e) {
+          for(size_t i = _listeners.size(); i < inherited.size(); ++i) {
+            ::close(inherited[i]);
+          }
+          throw server::error(e.what());
+        }
+        if(inherited.size() > count) {
+          WEBBY_ERROR(_config) << "Closing " << inherited.size() - count
+                               << " unused listening sockets from the previous process"
+                               << std::endl;
+          for(size_t i = count; i < inherited.size(); ++i) {
+            ::close(inherited[i]);
+          }
+        }
+        for(auto& l : _listeners) {
+          _listener_fds.push_back(l->fd());
+        }
+
+        if(_config.engine() == webby::engine::EPOLL) {
+          _engine.reset(new epoll_engine(_config, [this](webby::connection& conn, bool last) {
+            return process(conn, last);
+          }, std::move(_listeners), _wake_fd));
+          _listeners.clear();
+        }
+        WEBBY_INFO(_config) << "Server listening at " << _config.address() << ":"
           << _config.port() << std::endl;
       }
 
       /**
-       * @brief Server socket.
+       * @brief Waits for a new process to ask for the listening sockets, hands them over, and
+       *        stops the server.
+       */
+      void handoff_loop() {
+        struct pollfd pfd[2];
+        pfd[0].fd = _handoff->fd();
+        pfd[0].events = POLLIN;
+        pfd[1].fd = _wake_fd;
+        pfd[1].events = POLLIN;
+        while(1) {
+          pfd[0].revents = pfd[1].revents = 0;
+          if(::poll(pfd, 2, -1) < 0) {
+            if(errno == EINTR) {
+              continue;
+            }
+            WEBBY_ERROR(_config) << "poll: " << strerror(errno) << std::endl;
+            return;
+          }
+          if(pfd[1].revents != 0) {
+            return;
+          }
+          if(pfd[0].revents & POLLIN) {
+            try {
+              _handoff->send(_listener_fds);
+              WEBBY_INFO(_config) << "Handed the listening sockets to a new process" << std::endl;
+              stop();
+              return;
+            }
+            catch(const std::exception& e) {
+              WEBBY_ERROR(_config) << e.what() << std::endl;
+            }
+          }
+        }
+      }
+
+      /**
+       * @brief Gets the server that server::stop_on_signal() stops.
+       */
+      static std::atomic<server*>& signal_target() {
+        static std::atomic<server*> target(nullptr);
+        return target;
+      }
+
+      /**
+       * @brief Writes the access log, if one has been set.
+       */
+      std::unique_ptr<access_log_writer> _access_log;
+
+      /**
+       * @brief Listening sockets, when `webby::engine::BLOCKING` is selected: one, or one for each
+       *        worker thread when webby::config::reuse_port() is set.
+       */
+      std::vector<std::unique_ptr<listener>> _listeners;
+
+      /**
+       * @brief Descriptors of the listening sockets of either engine, for the handoff.
+       */
+      std::vector<int> _listener_fds;
+
+      /**
+       * @brief Event engine, when `webby::engine::EPOLL` is selected.
+       */
+      std::unique_ptr<epoll_engine> _engine;
+
+      /**
+       * @brief Socket over which the listening sockets are handed to a new process, if enabled.
+       */
+      std::unique_ptr<handoff_socket> _handoff;
+
+      /**
+       * @brief `eventfd` that becomes readable, and stays readable, once the server is stopping.
+       */
+      int _wake_fd;
+
+      /**
+       * @brief `true` once the server is stopping.
+       */
+      std::atomic<bool> _stopping;
+
+      /**
+       * @brief Guards the connections of the blocking engine.
+       */
+      std::mutex _active_mutex;
+
+      /**
+       * @brief Signalled when the last connection of the blocking engine is closed.
+       */
+      std::condition_variable _active_empty;
+
+      /**
+       * @brief Connections of the blocking engine that are being served.
+       */
+      std::unordered_set<socket_connection*> _active;
+
+      /**
+       * @brief `true` once the drain deadline has passed. Connections that are accepted later
+       *        are closed straight away.
        */
-      net::server _server;
+      bool _drain_expired;
   };
 }
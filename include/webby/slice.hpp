@@ -0,0 +1,186 @@
+/**
+ * @file slice.hpp
+ */
+#pragma once
+
+#include <string.h>
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Non-owning view of a range of characters.
+   *
+   * The request parser tokenizes the request line and headers in place, and hands out slices of
+   * the connection's input buffer rather than copying each token into a `std::string`. A slice is
+   * only valid for as long as the request it came from.
+   */
+  class slice {
+    public:
+      /**
+       * @brief Constructs an empty slice.
+       */
+      slice() : _data(""), _length(0) { }
+
+      /**
+       * @brief Constructs a slice of @p length characters starting at @p data.
+       */
+      slice(const char* data, const size_t length) : _data(data), _length(length) { }
+
+      /**
+       * @brief Constructs a slice of a string.
+       */
+      slice(const std::string& str) : _data(str.data()), _length(str.length()) { }
+
+      /**
+       * @brief Constructs a slice of a null terminated string.
+       */
+      slice(const char* str) : _data(str), _length(strlen(str)) { }
+
+      /**
+       * @brief Gets a pointer to the first character.
+       */
+      const char* data() const {
+        return _data;
+      }
+
+      /**
+       * @brief Gets the number of characters in the slice.
+       */
+      size_t length() const {
+        return _length;
+      }
+
+      /**
+       * @brief Gets the number of characters in the slice.
+       */
+      size_t size() const {
+        return _length;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether the slice is empty.
+       */
+      bool empty() const {
+        return _length == 0;
+      }
+
+      const char* begin() const {
+        return _data;
+      }
+
+      const char* end() const {
+        return _data + _length;
+      }
+
+      char operator[](const size_t index) const {
+        return _data[index];
+      }
+
+      /**
+       * @brief Gets part of the slice.
+       * @param[in] pos Offset of the first character.
+       * @param[in] count Maximum number of characters.
+       */
+      slice substr(size_t pos, size_t count = std::string::npos) const {
+        if(pos > _length) {
+          pos = _length;
+        }
+        if(count > _length - pos) {
+          count = _length - pos;
+        }
+        return slice(_data + pos, count);
+      }
+
+      /**
+       * @brief Gets a value that indicates whether the slice begins with @p prefix.
+       */
+      bool starts_with(const slice& prefix) const {
+        return _length >= prefix._length && memcmp(_data, prefix._data, prefix._length) == 0;
+      }
+
+      /**
+       * @brief Compares two slices, ignoring case.
+       */
+      bool equals_nocase(const slice& other) const {
+        return _length == other._length && strncasecmp(_data, other._data, _length) == 0;
+      }
+
+      /**
+       * @brief Gets a value that indicates whether @p needle occurs in the slice, ignoring case.
+       */
+      bool contains_nocase(const slice& needle) const {
+        for(size_t pos = 0; pos + needle._length <= _length; ++pos) {
+          if(strncasecmp(_data + pos, needle._data, needle._length) == 0) {
+            return true;
+          }
+        }
+        return false;
+      }
+
+      /**
+       * @brief Copies the slice into a string.
+       */
+      std::string str() const {
+        return std::string(_data, _length);
+      }
+
+      /**
+       * @brief Copies the slice into a string.
+       */
+      explicit operator std::string() const {
+        return str();
+      }
+
+    private:
+      /**
+       * @brief First character.
+       */
+      const char* _data;
+
+      /**
+       * @brief Number of characters.
+       */
+      size_t _length;
+  };
+
+  inline bool operator==(const slice& lhs, const slice& rhs) {
+    return lhs.length() == rhs.length() && memcmp(lhs.data(), rhs.data(), lhs.length()) == 0;
+  }
+
+  inline bool operator!=(const slice& lhs, const slice& rhs) {
+    return !(lhs == rhs);
+  }
+
+  inline bool operator==(const slice& lhs, const std::string& rhs) {
+    return lhs == slice(rhs);
+  }
+
+  inline bool operator==(const std::string& lhs, const slice& rhs) {
+    return slice(lhs) == rhs;
+  }
+
+  inline bool operator!=(const slice& lhs, const std::string& rhs) {
+    return !(lhs == slice(rhs));
+  }
+
+  inline bool operator!=(const std::string& lhs, const slice& rhs) {
+    return !(slice(lhs) == rhs);
+  }
+
+  inline bool operator==(const slice& lhs, const char* rhs) {
+    return lhs == slice(rhs);
+  }
+
+  inline bool operator!=(const slice& lhs, const char* rhs) {
+    return !(lhs == slice(rhs));
+  }
+
+  inline std::ostream& operator<<(std::ostream& os, const slice& s) {
+    return os.write(s.data(), static_cast<std::streamsize>(s.length()));
+  }
+}
@@ -0,0 +1,193 @@
+/**
+ * @file socket.hpp
+ */
+#pragma once
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#include <webby/config.hpp>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Listening socket bound to the configured address and port.
+   *
+   * The server owns its sockets directly rather than going through `net::server` because the
+   * engines need the descriptors for non-blocking I/O, `poll()` based idle timeouts, and socket
+   * options, none of which the `net` sockets expose.
+   *
+   * The listening socket itself is always non-blocking, so that a thread waiting for connections
+   * with `poll()` can also be woken to stop, and so that a socket handed to another process keeps
+   * working for both, whichever engine each of them uses.
+   */
+  class listener {
+    public:
+      /**
+       * @brief Opens the listening socket.
+       * @param[in] config Server configuration.
+       * @param[in] nonblocking `true` to make the accepted sockets non-blocking.
+       * @param[in] reuse_port `true` to set `SO_REUSEPORT`, so that several listeners can be
+       *                       bound to the same address and port. The kernel then spreads the
+       *                       incoming connections between them.
+       * @throws std::system_error if the socket could not be opened.
+       */
+      listener(const webby::config& config, const bool nonblocking, const bool reuse_port = false)
+          : _fd(open(config, reuse_port)), _nonblocking(nonblocking) { }
+
+      /**
+       * @brief Takes over a listening socket that is already bound, such as one received from
+       *        the process that this one replaces.
+       * @param[in] fd Descriptor of the socket. The listener takes ownership of it.
+       * @param[in] nonblocking `true` to make the accepted sockets non-blocking.
+       */
+      listener(const int fd, const bool nonblocking) : _fd(fd), _nonblocking(nonblocking) {
+        const int flags = ::fcntl(fd, F_GETFL);
+        if(flags >= 0 && !(flags & O_NONBLOCK)) {
+          ::fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+        }
+      }
+
+      /**
+       * @brief Closes the listening socket.
+       */
+      ~listener() {
+        ::close(_fd);
+      }
+
+      listener(const listener&) = delete;
+      listener& operator=(const listener&) = delete;
+
+      /**
+       * @brief Gets the socket descriptor.
+       */
+      int fd() const {
+        return _fd;
+      }
+
+      /**
+       * @brief Accepts a connection.
+       * @param[out] client_ip Receives the IP address of the connected host.
+       * @returns The descriptor of the accepted socket, or `-1` if there are no pending
+       *          connections.
+       * @throws std::system_error if the connection could not be accepted.
+       */
+      int accept(std::string& client_ip) const {
+        while(1) {
+          struct sockaddr_storage addr;
+          socklen_t length = sizeof(addr);
+          int fd = ::accept4(_fd, reinterpret_cast<struct sockaddr*>(&addr), &length,
+                             SOCK_CLOEXEC | (_nonblocking ? SOCK_NONBLOCK : 0));
+          if(fd >= 0) {
+            client_ip = address(addr);
+            return fd;
+          }
+          switch(errno) {
+            case EINTR:
+            case ECONNABORTED:
+              continue;
+            case EAGAIN:
+#if EAGAIN != EWOULDBLOCK
+            case EWOULDBLOCK:
+#endif
+              return -1;
+            default:
+              throw std::system_error(errno, std::system_category(), "accept4");
+          }
+        }
+      }
+
+    private:
+      /**
+       * @brief Opens a non-blocking listening socket.
+       * @param[in] config Server configuration.
+       * @param[in] reuse_port `true` to set `SO_REUSEPORT`.
+       * @returns The socket descriptor.
+       */
+      static int open(const webby::config& config, const bool reuse_port) {
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+
+        struct addrinfo* info = nullptr;
+        std::string port = std::to_string(config.port());
+        const char* host = config.address().empty() ? nullptr : config.address().c_str();
+        int result = ::getaddrinfo(host, port.c_str(), &hints, &info);
+        if(result != 0) {
+          throw std::runtime_error(std::string("getaddrinfo: ") + gai_strerror(result));
+        }
+
+        int fd = -1;
+        int error = 0;
+        for(struct addrinfo* ai = info; ai != nullptr; ai = ai->ai_next) {
+          fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC | SOCK_NONBLOCK,
+                        ai->ai_protocol);
+          if(fd < 0) {
+            error = errno;
+            continue;
+          }
+          int on = 1;
+          ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+          if(reuse_port && ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0) {
+            error = errno;
+            ::close(fd);
+            fd = -1;
+            continue;
+          }
+          if(::bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && ::listen(fd, SOMAXCONN) == 0) {
+            break;
+          }
+          error = errno;
+          ::close(fd);
+          fd = -1;
+        }
+        ::freeaddrinfo(info);
+
+        if(fd < 0) {
+          throw std::system_error(error, std::system_category(), "listen");
+        }
+        return fd;
+      }
+
+      /**
+       * @brief Formats the IP address of a connected host.
+       * @param[in] addr Address returned by `accept()`.
+       */
+      static std::string address(const struct sockaddr_storage& addr) {
+        char buffer[INET6_ADDRSTRLEN] = { 0 };
+        if(addr.ss_family == AF_INET) {
+          const struct sockaddr_in& in = reinterpret_cast<const struct sockaddr_in&>(addr);
+          ::inet_ntop(AF_INET, &in.sin_addr, buffer, sizeof(buffer));
+        }
+        else if(addr.ss_family == AF_INET6) {
+          const struct sockaddr_in6& in6 = reinterpret_cast<const struct sockaddr_in6&>(addr);
+          ::inet_ntop(AF_INET6, &in6.sin6_addr, buffer, sizeof(buffer));
+        }
+        return buffer;
+      }
+
+      /**
+       * @brief Socket descriptor.
+       */
+      const int _fd;
+
+      /**
+       * @brief `true` if the accepted sockets are non-blocking.
+       */
+      const bool _nonblocking;
+  };
+}
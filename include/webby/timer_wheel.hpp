@@ -0,0 +1,238 @@
+/**
+ * @file timer_wheel.hpp
+ */
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Hashed timing wheel that tracks the deadlines of many connections.
+   *
+   * Time is divided into ticks of a fixed resolution, and each tick maps onto one of a ring of
+   * slots. A timer is linked into the slot of the tick in which it expires, along with the number
+   * of full turns of the ring left before then. Scheduling, rescheduling and cancelling a timer
+   * are O(1), and each tick only visits the timers of its own slot, so the cost does not grow with
+   * the number of connections that are waiting.
+   *
+   * Timers expire up to one tick late, never early. The wheel is not thread safe; each event loop
+   * owns its own.
+   */
+  class timer_wheel {
+    public:
+      /**
+       * @brief Clock that deadlines are measured with.
+       */
+      typedef std::chrono::steady_clock clock;
+
+      /**
+       * @brief Entry in a timer_wheel. Objects that have a deadline derive from it.
+       *
+       * A timer unlinks itself from its wheel when it is destroyed.
+       */
+      class timer {
+        public:
+          /**
+           * @brief Constructs a timer that is not scheduled.
+           */
+          timer() : _prev(nullptr), _next(nullptr), _rounds(0) { }
+
+          /**
+           * @brief Cancels the timer.
+           */
+          ~timer() {
+            cancel();
+          }
+
+          timer(const timer&) = delete;
+          timer& operator=(const timer&) = delete;
+
+          /**
+           * @brief Gets a value that indicates whether the timer is scheduled.
+           */
+          bool scheduled() const {
+            return _next != nullptr;
+          }
+
+          /**
+           * @brief Removes the timer from its wheel, if it is scheduled.
+           */
+          void cancel() {
+            if(_next != nullptr) {
+              _prev->_next = _next;
+              _next->_prev = _prev;
+              _prev = _next = nullptr;
+            }
+          }
+
+        private:
+          friend class timer_wheel;
+
+          /**
+           * @brief Links the timer in front of @p head, which is the sentinel of a slot.
+           */
+          void link(timer& head) {
+            _prev = head._prev;
+            _next = &head;
+            _prev->_next = this;
+            head._prev = this;
+          }
+
+          /**
+           * @brief Makes the timer the sentinel of an empty list.
+           */
+          void make_head() {
+            _prev = _next = this;
+          }
+
+          /**
+           * @brief Previous timer in the slot.
+           */
+          timer* _prev;
+
+          /**
+           * @brief Next timer in the slot, or `nullptr` if the timer is not scheduled.
+           */
+          timer* _next;
+
+          /**
+           * @brief Number of times the slot is passed over before the timer expires.
+           */
+          std::size_t _rounds;
+      };
+
+      /**
+       * @brief Constructs the wheel.
+       * @param[in] resolution Length of a tick.
+       * @param[in] slots Number of slots. A turn of the ring lasts `resolution * slots`; later
+       *                  deadlines take more than one turn.
+       * @param[in] now Current time.
+       */
+      timer_wheel(const std::chrono::milliseconds resolution, const std::size_t slots,
+                  const clock::time_point now)
+          : _resolution(resolution), _slots(new timer[slots]), _slot_count(slots), _cursor(0),
+            _time(now) {
+        for(std::size_t i = 0; i < _slot_count; ++i) {
+          _slots[i].make_head();
+        }
+      }
+
+      /**
+       * @brief Unlinks the timers that are still scheduled.
+       */
+      ~timer_wheel() {
+        for(std::size_t i = 0; i < _slot_count; ++i) {
+          while(_slots[i]._next != &_slots[i]) {
+            _slots[i]._next->cancel();
+          }
+          _slots[i]._prev = _slots[i]._next = nullptr;
+        }
+      }
+
+      timer_wheel(const timer_wheel&) = delete;
+      timer_wheel& operator=(const timer_wheel&) = delete;
+
+      /**
+       * @brief Schedules a timer, replacing its previous deadline.
+       * @param[in,out] t The timer.
+       * @param[in] deadline Time at which it expires. A deadline that has already passed expires
+       *                     on the next tick, and `clock::time_point::max()` cancels the timer.
+       */
+      void schedule(timer& t, const clock::time_point deadline) {
+        t.cancel();
+        if(deadline == clock::time_point::max()) {
+          return;
+        }
+        std::size_t ticks = 1;
+        if(deadline > _time) {
+          const auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(
+              deadline - _time);
+          ticks = static_cast<std::size_t>(
+              (delay.count() + _resolution.count() - 1) / _resolution.count());
+          ticks = ticks > 0 ? ticks : 1;
+        }
+        t._rounds = (ticks - 1) / _slot_count;
+        t.link(_slots[(_cursor + ticks) % _slot_count]);
+      }
+
+      /**
+       * @brief Moves the wheel forward to the current time, expiring the timers that are due.
+       * @param[in] now Current time.
+       * @param[in] expired Called with each expired timer, which is no longer scheduled. It may
+       *                    destroy or reschedule the timer, and any other timer.
+       */
+      template<typename F>
+      void advance(const clock::time_point now, F expired) {
+        while(now - _time >= _resolution) {
+          _time += _resolution;
+          _cursor = (_cursor + 1) % _slot_count;
+
+          // The slot is moved to a local list first, so that timers that are rescheduled while
+          // it is being processed are not visited again.
+          timer due;
+          timer& head = _slots[_cursor];
+          if(head._next == &head) {
+            continue;
+          }
+          due._prev = head._prev;
+          due._next = head._next;
+          due._prev->_next = &due;
+          due._next->_prev = &due;
+          head.make_head();
+
+          while(due._next != &due) {
+            timer& t = *due._next;
+            t.cancel();
+            if(t._rounds > 0) {
+              --t._rounds;
+              t.link(head);
+            }
+            else {
+              expired(t);
+            }
+          }
+          due._prev = due._next = nullptr;
+        }
+      }
+
+      /**
+       * @brief Gets the time until the next tick.
+       * @param[in] now Current time.
+       */
+      std::chrono::milliseconds until_next_tick(const clock::time_point now) const {
+        const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - _time);
+        return elapsed >= _resolution ? std::chrono::milliseconds(0) : _resolution - elapsed;
+      }
+
+    private:
+      /**
+       * @brief Length of a tick.
+       */
+      const std::chrono::milliseconds _resolution;
+
+      /**
+       * @brief Sentinels of the slots' circular lists.
+       */
+      std::unique_ptr<timer[]> _slots;
+
+      /**
+       * @brief Number of slots.
+       */
+      const std::size_t _slot_count;
+
+      /**
+       * @brief Slot of the last tick that was processed.
+       */
+      std::size_t _cursor;
+
+      /**
+       * @brief Time of the last tick that was processed.
+       */
+      clock::time_point _time;
+  };
+}
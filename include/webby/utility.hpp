@@ -5,21 +5,13 @@
 #pragma once
 #include <algorithm>
 #include <string.h>
+#include <time.h>
 #include <string>
 
 /**
  * @namespace webby
  */
 namespace webby {
-  /**
-   * @brief Comparison function for the header map.
-   */
-  struct no_case_compare {
-    bool operator()(const std::string& lhs, const std::string& rhs) const {
-      return strcasecmp(lhs.c_str(), rhs.c_str()) < 0;
-    }
-  };
-
   /**
    * @brief Converts a string to all lowercase characters.
    */
@@ -27,4 +19,37 @@ namespace webby {
     std::transform(s.begin(), s.end(), s.begin(), ::tolower);
     return s;
   }
+
+  /**
+   * @brief Formats a time as an HTTP date, e.g. "Sun, 06 Nov 1994 08:49:37 GMT".
+   */
+  std::string http_date(const time_t t) {
+    struct tm tm;
+    char buffer[32];
+    gmtime_r(&t, &tm);
+    size_t length = strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return std::string(buffer, length);
+  }
+
+  /**
+   * @brief Parses an HTTP date in any of the three formats allowed by RFC 7231.
+   * @param[in] str The date.
+   * @returns The time, or `-1` if it could not be parsed.
+   */
+  time_t parse_http_date(const std::string& str) {
+    static const char* const formats[] = {
+      "%a, %d %b %Y %H:%M:%S GMT", // IMF-fixdate
+      "%A, %d-%b-%y %H:%M:%S GMT", // RFC 850
+      "%a %b %e %H:%M:%S %Y"       // asctime()
+    };
+    for(auto format : formats) {
+      struct tm tm;
+      memset(&tm, 0, sizeof(tm));
+      const char* end = strptime(str.c_str(), format, &tm);
+      if(end != nullptr && *end == '\0') {
+        return timegm(&tm);
+      }
+    }
+    return -1;
+  }
 }
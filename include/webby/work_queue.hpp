@@ -0,0 +1,112 @@
+/**
+ * @file work_queue.hpp
+ */
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+/**
+ * @namespace webby
+ */
+namespace webby {
+  /**
+   * @brief Bounded, blocking hand-off queue used to pass work between threads.
+   *
+   * Producers block in work_queue::push() while the queue is full, which applies backpressure to
+   * whoever is generating the work. Consumers block in work_queue::pop() until an item is
+   * available or the queue has been closed.
+   */
+  template<typename T> class work_queue {
+    public:
+      /**
+       * @brief Constructs an empty queue.
+       * @param[in] capacity Maximum number of items that may be queued at once.
+       */
+      explicit work_queue(std::size_t capacity)
+          : _capacity(capacity ? capacity : 1), _closed(false) { }
+
+      /**
+       * @brief Adds an item to the queue, blocking while the queue is full.
+       * @param[in] item Item to move into the queue.
+       * @returns `true` if the item was queued; `false` if the queue was closed.
+       */
+      bool push(T&& item) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _not_full.wait(lock, [this] { return _closed || _items.size() < _capacity; });
+        if(_closed) {
+          return false;
+        }
+        _items.push_back(std::move(item));
+        lock.unlock();
+        _not_empty.notify_one();
+        return true;
+      }
+
+      /**
+       * @brief Removes an item from the queue, blocking while the queue is empty.
+       * @param[out] item Receives the item removed from the queue.
+       * @returns `true` if an item was removed; `false` if the queue is closed and empty.
+       */
+      bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _not_empty.wait(lock, [this] { return _closed || !_items.empty(); });
+        if(_items.empty()) {
+          return false;
+        }
+        item = std::move(_items.front());
+        _items.pop_front();
+        lock.unlock();
+        _not_full.notify_one();
+        return true;
+      }
+
+      /**
+       * @brief Closes the queue.
+       *
+       * Blocked producers return immediately. Consumers continue to receive the items that are
+       * already queued, and then return `false` from work_queue::pop().
+       */
+      void close() {
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          _closed = true;
+        }
+        _not_full.notify_all();
+        _not_empty.notify_all();
+      }
+
+    private:
+      /**
+       * @brief Maximum number of queued items.
+       */
+      const std::size_t _capacity;
+
+      /**
+       * @brief `true` once work_queue::close() has been called.
+       */
+      bool _closed;
+
+      /**
+       * @brief Queued items.
+       */
+      std::deque<T> _items;
+
+      /**
+       * @brief Guards all of the fields above.
+       */
+      std::mutex _mutex;
+
+      /**
+       * @brief Signalled when an item is removed.
+       */
+      std::condition_variable _not_full;
+
+      /**
+       * @brief Signalled when an item is added.
+       */
+      std::condition_variable _not_empty;
+  };
+}
@@ -3,26 +3,35 @@
 #include <map>
 #include <sstream>
 #include <string>
+#include <thread>
 
 // Example implementation of a restful web service.
 class item : public webby::rest_handler<item> {
   public:
-    // Responds with all of the items in a JSON array.
+    // Responds with all of the items in a JSON array. The array is streamed one item at a time,
+    // so the size of the collection does not need to be known up front.
     void index(const webby::request& req, webby::response& res) {
-      std::string s = get_all();
       res.set_status_code(200)
-         .set_header("Content-Length", std::to_string(s.length()))
-         .write_block(reinterpret_cast<const unsigned char*>(s.c_str()), s.length());
+         .set_header("Content-Type", "application/json")
+         .start_chunked();
+      write(res, "[");
+      bool first = true;
+      for(auto i : _item) {
+        write(res, (first ? "" : ",") + get_by_id(i.first));
+        first = false;
+      }
+      write(res, "]");
     }
 
     // Responds with a single item in JSON format.
     void show(const webby::request& req, webby::response& res) {
-      // Parse the ID of the resource to respond with from the request path.
-      int id = std::stoi(req.path().substr(req.route().length() + 1));
+      // The ID of the resource to respond with is captured from the path by the router.
+      int id = std::stoi(req.param("id").str());
       std::string s = get_by_id(id);
 
       if(s.length()) {
         res.set_status_code(200)
+           .set_header("Content-Type", "application/json")
            .set_header("Content-Length", std::to_string(s.length()))
            .write_block(reinterpret_cast<const unsigned char*>(s.c_str()), s.length());
       }
@@ -32,21 +41,9 @@ class item : public webby::rest_handler<item> {
     }
 
   private:
-    // Gets all of the items in JSON format. This should really be handled by a JSON generator,
-    // but for the purpose of this example it's good enough.
-    std::string get_all() {
-      std::stringstream ss;
-      ss << "[";
-      bool first = true;
-      for(auto i : _item) {
-        if(!first) {
-          ss << ",";
-          first = false;
-        }
-        ss << "{id:" << i.first << ", value:\"" << i.second << "\"}";
-      }
-      ss << "]";
-      return ss.str();
+    // Writes part of a streamed response.
+    void write(webby::response& res, const std::string& s) {
+      res.write_block(reinterpret_cast<const unsigned char*>(s.c_str()), s.length());
     }
 
     // Gets a single item by its ID in JSON format. Again, this should be performed by a JSON
@@ -69,27 +66,63 @@ std::map<int, std::string> item::_item = {
   {2, "Second item"}
 };
 
+// Example of a deferred response. The handler returns straight away, and the response is completed
+// later on another thread, the way a handler that waits for a database or another service would
+// complete it.
+void delayed(const webby::request&, webby::response& res) {
+  webby::deferred done = res.defer();
+  std::thread([done] {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    done.complete([](webby::response& res) {
+      const std::string s = "{status:\"done\"}";
+      res.set_status_code(200)
+         .set_header("Content-Type", "application/json")
+         .set_header("Content-Length", std::to_string(s.length()))
+         .write_block(reinterpret_cast<const unsigned char*>(s.c_str()), s.length());
+    });
+  }).detach();
+}
+
 int main() {
   // Set up the logs. As there can be only one owner for the log, std::unique_ptr is used
   // to manage its owership and lifetime.
   std::unique_ptr<qlog::logger> access_log(new qlog::logger(std::cout, qlog::severity::DEBUG));
   std::unique_ptr<qlog::logger> error_log(new qlog::logger(std::cerr, qlog::severity::DEBUG));
 
+  // Statistics about the requests served, published at /metrics.
+  webby::metrics metrics;
+
   // Creates the server configuration.
   webby::config config;
   config.set_address("localhost")
         .set_port(8080)
+        .set_worker_threads(4)
         .set_access_log(access_log)
-        .set_error_log(error_log);
+        .set_error_log(error_log)
+        .set_log_level(webby::log_level::DEBUG)
+        .set_compression(true)
+        .set_metrics(metrics)
+        .set_drain_timeout(std::chrono::seconds(10))
+        .set_handoff_path("/tmp/webbyd.sock");
 
-  // Sets up the routing table.
+  // Sets up the routing table. The items never change, so their JSON is served from a cache
+  // rather than rebuilt for every request.
   webby::router router;
-  router.add("/item", webby::method::REST, item())
+  webby::cache_handler items(item(), std::chrono::seconds(5));
+  router.add("/item", webby::method::REST, items)
+        .add("/item/:id", webby::method::REST, items)
+        .add("/delayed", webby::method::GET, delayed)
+        .add("/metrics", webby::method::GET, webby::metrics_handler(metrics))
         .add("/", webby::method::GET | webby::method::HEAD, webby::file_handler("../include"));
 
   // Create the server.
   webby::server server(config, router);
 
+  // Drains the connections and exits on SIGTERM or Ctrl-C. Starting another instance hands the
+  // listening socket over to it and stops this one.
+  server.stop_on_signal(SIGTERM);
+  server.stop_on_signal(SIGINT);
+
   // Run the server.
   server.run();
 